@@ -0,0 +1,152 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FAKECONTROLLER_H
+#define FAKECONTROLLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include <BluetoothPlatform.h>
+#include <HostController.h>
+#include <VirtualEventQueue.h>
+
+/// Stand-in for the Bluetooth controller and the peers around it, driven by a script of timed events (see
+/// host/ReadMe.md for the format). It raises what a controller and a cooperative peer would on the Host, on the
+/// virtual clock of the event queue: advertising reports while scanning, connections made by the peer or requested by
+/// the host, PHY updates, ATT MTU exchanges and so on. Anything else that the peers do, such as disconnecting or
+/// sending GATT traffic, and the operator's input come from the script.
+struct FakeController : HostController {
+    FakeController(VirtualEventQueue &queue, Host &host);
+
+    FakeController(const FakeController &) = delete;
+
+    /// Read a script, printing any error with its line number to stderr. Returns false upon error.
+    bool load(FILE *file, const char *name);
+
+    /// Schedule the scripted events, relative to the current time.
+    void start() override;
+
+    const uint8_t *localAddress() const override;
+
+    /// Return and clear the error set for the next call of an operation by a `fail` command, or 0 if there is none.
+    int takeFailure(const char *operation) override;
+
+    void setScanning(bool scanning, const uint8_t *filterAddress) override;
+
+    /// Accept or refuse scripted connections from peers while advertising.
+    void setAdvertising(bool advertising, bool periodic) override;
+
+    /// onConnected() is raised after a connection interval.
+    void connect(const uint8_t *peer, uint32_t intervalMs) override;
+
+    void disconnect() override;
+
+    /// onSynced() is raised after a periodic interval, or nothing is if the advertiser has gone by then.
+    void sync(const uint8_t *peer, uint8_t sid) override;
+
+    void stopSync() override;
+
+    /// onPhyUpdated() is raised after two connection intervals.
+    void requestPhy(BluetoothPlatform::phy_t phy, uint32_t intervalMs) override;
+
+    /// onMtuExchanged() is raised after two connection intervals.
+    void exchangeMtu(uint32_t intervalMs) override;
+
+private:
+    enum class command_t {
+        input,
+        advertiser,
+        periodic_advertiser,
+        remove,
+        connect,
+        disconnect,
+        sync_lost,
+        phy,
+        conn_params,
+        subscribe,
+        receive,
+        fail,
+        end,
+    };
+
+    struct Command {
+        FakeController *owner;
+        uint64_t time;
+        command_t command;
+        std::vector<uint32_t> values;
+        std::string text;
+        Advertiser advertiser;
+
+        // Reports the advertiser while scanning, 0 when not scanning.
+        int tick;
+    };
+
+    struct Failure {
+        std::string operation;
+        int error;
+    };
+
+    VirtualEventQueue &_queue;
+    Host &_host;
+    std::vector<Command> _script;
+
+    // Advertisers added and not removed yet, which live in their commands.
+    std::vector<Command *> _advertisers;
+    std::vector<Failure> _failures;
+    uint8_t _local_address[6];
+
+    bool _is_scanning;
+    bool _is_filtered;
+    uint8_t _filter_address[6];
+    bool _is_connectable;
+    bool _is_connected;
+    bool _is_synced;
+
+    // Peer being connected to or synced with, and pending calls, cancelled if the link goes first.
+    uint8_t _peer[6];
+    uint8_t _sid;
+    int _link_timer;
+    int _gatt_timer;
+    int _phy_timer;
+    BluetoothPlatform::phy_t _phy;
+
+    // Parse one line of the script. Returns false, with message set, upon error.
+    bool parse(char *line, Command &command, std::string &message);
+
+    // Start reporting an advertiser, if it passes the filter.
+    void startTicking(Command &command);
+
+    Command *findAdvertiser(const uint8_t *address);
+
+    // Run a command of the script. arg is a pointer to the Command.
+    static void runCommand(void *arg);
+    void run(Command &command);
+
+    // Scheduled calls. arg is a pointer to this or, for callTick, to the advertiser's Command.
+    static void callTick(void *arg);
+    static void callConnected(void *arg);
+    static void callDisconnected(void *arg);
+    static void callSynced(void *arg);
+    static void callPhyUpdated(void *arg);
+    static void callMtuExchanged(void *arg);
+};
+
+#endif // ! FAKECONTROLLER_H
@@ -0,0 +1,211 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOSTBLUETOOTHPLATFORM_H
+#define HOSTBLUETOOTHPLATFORM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <BluetoothPlatform.h>
+#include <HostController.h>
+#include <VirtualEventQueue.h>
+
+/// Implementation of BluetoothPlatform for a Linux process, on a virtual clock and with a HostController in place of
+/// the radio: a scripted FakeController, or a SimController on a simulated medium. Output goes to stdout by default.
+struct HostBluetoothPlatform : BluetoothPlatform, HostController::Host {
+    static constexpr const char *DEFAULT_DEVICE_NAME = "Power Consumption (Host)";
+
+    /// The name must outlive the platform. A scanning program looks for peers with its own name.
+    explicit HostBluetoothPlatform(const char *deviceName = DEFAULT_DEVICE_NAME);
+
+    HostBluetoothPlatform(const HostBluetoothPlatform &) = delete;
+
+    /// Set the controller, which must be set before init() and outlive the platform.
+    void setController(HostController &controller);
+
+    /// Gets the event queue, for the controller and for hosts which dispatch events themselves.
+    VirtualEventQueue &eventQueue();
+
+    /// Set where the output goes, nullptr to discard it.
+    void setOutput(FILE *output);
+
+    /// Stop the event loop once the virtual time reaches `ms`, if it has not stopped before.
+    void setTimeLimit(uint64_t ms);
+
+    int init() override;
+
+    /// Dispatch until the script ends, the time limit is reached or nothing is left to run, then exit the process.
+    void runEventLoop() override;
+
+    void getLocalAddress(uint8_t buf[6]) override;
+
+    void call(BluetoothPlatform::callback_t fn, void *arg) override;
+
+    timer_id_t callIn(uint32_t millis, BluetoothPlatform::callback_t fn, void *arg) override;
+
+    timer_id_t callIn(uint32_t millis, uint32_t toleranceMs, BluetoothPlatform::callback_t fn, void *arg) override;
+
+    timer_id_t callIn(
+        uint32_t millis,
+        uint32_t toleranceMs,
+        BluetoothPlatform::callback_t fn,
+        const void *payload,
+        size_t size
+    ) override;
+
+    timer_id_t callEvery(uint32_t periodMs, BluetoothPlatform::callback_t fn, void *arg) override;
+
+    bool cancel(timer_id_t id) override;
+
+    WakeupStats getWakeupStats() override;
+
+    bool getSchedulerStats(SchedulerStats &stats) override;
+
+    uint32_t uptimeMs() override;
+
+    void printError(intmax_t error, const char *msg) override;
+
+    void putchar(int c) override;
+
+    const char *deviceName() const override;
+
+    bool isPeriodicAdvertisingAvailable() override;
+
+    int startAdvertising() override;
+
+    int startPeriodicAdvertising() override;
+
+    int setScanFilter(const uint8_t *peerAddress) override;
+
+    int startScan() override;
+
+    int startScanForPeriodicAdvertising() override;
+
+    int establishConnection(uint8_t peerAddressType, const uint8_t *peerAddress) override;
+
+    int syncToPeriodicAdvertising(
+        int32_t sid,
+        uint8_t peerAddressType,
+        const uint8_t *peerAddress,
+        uint32_t syncTimeoutMs
+    ) override;
+
+    int setPhy(handle_t connection_handle, phy_t phy) override;
+
+    int startThroughput(handle_t connection_handle) override;
+
+    int prepareWorkload(handle_t connection_handle, traffic_t traffic) override;
+
+    int sendWorkload(handle_t connection_handle, size_t size) override;
+
+    bool getTrafficStats(TrafficStats &stats) override;
+
+    int disconnect(handle_t connection_handle) override;
+
+    int stopSync(handle_t sync_handle) override;
+
+protected:
+    void vprint(const char *fmt, va_list args) override;
+
+    void write(const uint8_t *data, size_t size) override;
+
+private:
+    VirtualEventQueue _event_queue;
+    const char *_device_name;
+    HostController *_controller;
+    FILE *_output;
+    uint64_t _time_limit;
+    bool _is_running;
+
+    // Ends advertising or scanning after the configured time, 0 if not scheduled.
+    timer_id_t _end_timer;
+
+    // Flags.
+    bool _is_scanner;
+    bool _is_periodic;
+    bool _is_scan_filtered;
+    bool _is_scanning_or_advertising;
+    bool _is_connecting_or_syncing;
+    uint8_t _filter_address[6];
+
+    // Handles passed to the event handler; members so that they outlive the events that refer to them.
+    uint16_t _connection_handle;
+    uint16_t _sync_handle;
+    ConnectionParameters _parameters;
+
+    // GATT throughput run or workload. While the sender has a backlog, each connection event sends up to
+    // CONFIG_THROUGHPUT_WINDOW PDUs (one for indications). _backlog is the number of bytes left to send, unbounded
+    // for a throughput run.
+    uint16_t _att_mtu;
+    bool _is_workload;
+    traffic_t _traffic;
+    uint64_t _backlog;
+    bool _is_streaming;
+    bool _has_traffic;
+    timer_id_t _connection_event_timer;
+    uint32_t _traffic_start_ms;
+    uint32_t _traffic_last_ms;
+    TrafficStats _traffic_stats;
+
+    // Connection parameters requested with params(), as the controller rounds them.
+    ConnectionParameters requestedParameters();
+
+    // Connection interval in whole ms, for timers.
+    uint32_t intervalMs() const;
+
+    // Return a failure set by the script for an operation, printing it, or 0.
+    int takeFailure(const char *operation, const char *msg);
+
+    void endAdvertising();
+    void endScan();
+
+    // Send the PDUs of a connection event, and stop the connection events once the backlog is empty.
+    void runConnectionEvent();
+
+    // Start connection events if there is a backlog.
+    void startConnectionEvents();
+    void stopConnectionEvents();
+
+    // Raise EventHandler::onThroughputStart().
+    void startedThroughput(intmax_t error, connection_role_t role);
+
+    // Raise EventHandler::onWorkloadReady().
+    void workloadReady(intmax_t error, connection_role_t role);
+
+    // HostController::Host overrides.
+    void onReport(const HostController::Advertiser &advertiser) override;
+    void onConnected(const uint8_t *peer, connection_role_t role) override;
+    void onConnectionFailed(int error) override;
+    void onDisconnected() override;
+    void onConnectionParametersUpdated(const ConnectionParameters &parameters) override;
+    void onPhyUpdated(phy_t phy) override;
+    void onSynced(const HostController::Advertiser &advertiser) override;
+    void onSyncLost() override;
+    void onMtuExchanged(uint16_t mtu) override;
+    void onSubscribed(traffic_t traffic) override;
+    void onReceived(bool is_workload, uint64_t bytes, uint32_t packets) override;
+    void onInput(int c) override;
+    void onEnd() override;
+
+    // Internal callbacks. arg is a pointer to this.
+    static void endAdvertisingCallback(void *arg);
+    static void endScanCallback(void *arg);
+    static void connectionEventCallback(void *arg);
+};
+
+#endif // ! HOSTBLUETOOTHPLATFORM_H
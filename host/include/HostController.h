@@ -0,0 +1,103 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOSTCONTROLLER_H
+#define HOSTCONTROLLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <BluetoothPlatform.h>
+
+/// Bluetooth controller as seen by HostBluetoothPlatform, standing in for the radio of a board: the scripted
+/// FakeController for a single program, or a SimController on the shared medium of a simulation.
+struct HostController {
+    /// Address type of peers, which use random static addresses as the boards do.
+    static constexpr uint8_t PEER_ADDRESS_TYPE = 1;
+
+    /// ATT MTU which peers accept.
+    static constexpr uint16_t ATT_MTU = 247;
+
+    /// An advertiser, as reported while scanning.
+    struct Advertiser {
+        /// Address, least significant byte first.
+        uint8_t address[6];
+
+        /// Advertising data: the flags and the complete local name.
+        uint8_t data[31];
+        size_t data_size;
+
+        uint32_t interval_ms;
+        bool is_periodic;
+        uint8_t sid;
+        uint32_t periodic_interval_ms;
+    };
+
+    /// What the controller raises, as HCI events would be raised to a host stack.
+    struct Host {
+        virtual void onReport(const Advertiser &advertiser) = 0;
+        virtual void onConnected(const uint8_t *peer, BluetoothPlatform::connection_role_t role) = 0;
+        virtual void onConnectionFailed(int error) = 0;
+        virtual void onDisconnected() = 0;
+        virtual void onConnectionParametersUpdated(const BluetoothPlatform::ConnectionParameters &parameters) = 0;
+        virtual void onPhyUpdated(BluetoothPlatform::phy_t phy) = 0;
+        virtual void onSynced(const Advertiser &advertiser) = 0;
+        virtual void onSyncLost() = 0;
+        virtual void onMtuExchanged(uint16_t mtu) = 0;
+        virtual void onSubscribed(BluetoothPlatform::traffic_t traffic) = 0;
+        virtual void onReceived(bool is_workload, uint64_t bytes, uint32_t packets) = 0;
+        virtual void onInput(int c) = 0;
+        virtual void onEnd() = 0;
+    };
+
+    virtual ~HostController() = default;
+
+    /// Called once the host has initialised.
+    virtual void start() = 0;
+
+    /// Gets the local address, least significant byte first.
+    virtual const uint8_t *localAddress() const = 0;
+
+    /// Return an error for an operation which must fail, or 0. Operations are named advertise, scan, filter, connect,
+    /// sync, phy, throughput and workload.
+    virtual int takeFailure(const char *operation) = 0;
+
+    /// Start or stop reporting advertisers, only the one with filterAddress if it is not nullptr.
+    virtual void setScanning(bool scanning, const uint8_t *filterAddress) = 0;
+
+    /// Start or stop advertising. Periodic advertising is not connectable.
+    virtual void setAdvertising(bool advertising, bool periodic) = 0;
+
+    /// Connect to an advertiser as main. onConnected() or onConnectionFailed() follows.
+    virtual void connect(const uint8_t *peer, uint32_t intervalMs) = 0;
+
+    /// End the connection. onDisconnected() is raised once the caller has returned.
+    virtual void disconnect() = 0;
+
+    /// Sync to an advertiser's periodic advertising. onSynced() follows unless the advertiser has gone.
+    virtual void sync(const uint8_t *peer, uint8_t sid) = 0;
+
+    /// Stop the sync without raising anything.
+    virtual void stopSync() = 0;
+
+    /// Ask the peer for a PHY. onPhyUpdated() follows.
+    virtual void requestPhy(BluetoothPlatform::phy_t phy, uint32_t intervalMs) = 0;
+
+    /// Exchange the ATT MTU and discover the peer's service. onMtuExchanged() follows.
+    virtual void exchangeMtu(uint32_t intervalMs) = 0;
+};
+
+#endif // ! HOSTCONTROLLER_H
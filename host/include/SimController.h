@@ -0,0 +1,205 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIMCONTROLLER_H
+#define SIMCONTROLLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <HostBluetoothPlatform.h>
+#include <HostController.h>
+
+/// Controller of one device of a Simulation. Devices share the three advertising channels: advertisers put their
+/// packets on them and scanners hear those which did not collide, on the channel they listen to at the time. Only
+/// what reaches the host through the filter accept list wakes it. Connections are made through messages between
+/// controllers. Periodic advertising, PHY updates and GATT traffic are not modelled and fail with -ENOTSUP.
+///
+/// The controller works from the state which the host left it in at the start of each synchronisation window: what
+/// the host changes takes effect at the next window, as if commands took that long to reach the controller.
+struct SimController : HostController {
+    /// Legacy advertising packets on the 1M PHY: preamble, access address, header, AdvA, data and CRC, 8 µs a byte.
+    static constexpr uint32_t PACKET_OVERHEAD = 1 + 4 + 2 + 6 + 3;
+    static constexpr uint32_t US_PER_BYTE = 8;
+
+    /// Time from the end of a packet to the start of the next one of the same advertising event.
+    static constexpr uint32_t CHANNEL_GAP_US = 150;
+
+    /// Upper bound of the random delay added to each advertising interval (advDelay).
+    static constexpr uint32_t MAX_ADV_DELAY_US = 10000;
+
+    /// A packet on an advertising channel.
+    struct Packet {
+        uint64_t start_us;
+        uint64_t end_us;
+        const SimController *source;
+
+        /// Overlaps another packet on the channel, so nobody receives it.
+        bool collided;
+    };
+
+    /// Message to the controller of another device, delivered at the start of the next window.
+    struct Message {
+        enum class type_t : uint8_t {
+            connect,
+            accept,
+            reject,
+            disconnect,
+        };
+
+        type_t type;
+        uint32_t from;
+        uint32_t to;
+
+        /// Connection interval in ms for connect, error for reject.
+        int32_t value;
+    };
+
+    /// Counts kept by the controller.
+    struct Stats {
+        uint64_t packets_sent;
+
+        /// Packets received intact while scanning.
+        uint64_t heard;
+
+        /// Packets on the channel listened to which were lost to a collision.
+        uint64_t collided;
+
+        /// Packets heard and dropped by the filter accept list, without waking the host.
+        uint64_t filtered;
+
+        /// Reports raised to the host.
+        uint64_t reports;
+
+        /// Time spent scanning in ms.
+        uint64_t scan_ms;
+    };
+
+    /// input is typed when the device starts, startDelayMs after the simulation does. Messages go to outbox.
+    SimController(
+        HostBluetoothPlatform &platform,
+        uint32_t index,
+        std::string input,
+        uint32_t startDelayMs,
+        uint32_t seed,
+        std::vector<Message> &outbox
+    );
+
+    SimController(const SimController &) = delete;
+
+    /// Gets the address of a device, least significant byte first.
+    static void address(uint32_t index, uint8_t address[6]);
+
+    uint32_t index() const;
+
+    /// Gets the counts, with the time scanning up to now.
+    Stats stats() const;
+
+    bool isScanning() const;
+
+    /// Start of the next advertising event, UINT64_MAX if not advertising.
+    uint64_t nextTransmissionUs() const;
+
+    /// Put the packets of the advertising events which start in [beginUs, endUs) on the three channels. The last
+    /// packets of an event may start after endUs.
+    void transmit(uint64_t beginUs, uint64_t endUs, std::vector<Packet> channels[3]);
+
+    /// Hear the packets which start from beginUs on the channels, sorted by start, and queue reports for the host.
+    void receive(uint64_t beginUs, const std::vector<Packet> channels[3]);
+
+    /// Handle a message from another controller.
+    void deliver(const Message &message);
+
+    void start() override;
+
+    const uint8_t *localAddress() const override;
+
+    int takeFailure(const char *operation) override;
+
+    void setScanning(bool scanning, const uint8_t *filterAddress) override;
+
+    void setAdvertising(bool advertising, bool periodic) override;
+
+    void connect(const uint8_t *peer, uint32_t intervalMs) override;
+
+    void disconnect() override;
+
+    void sync(const uint8_t *peer, uint8_t sid) override;
+
+    void stopSync() override;
+
+    void requestPhy(BluetoothPlatform::phy_t phy, uint32_t intervalMs) override;
+
+    void exchangeMtu(uint32_t intervalMs) override;
+
+private:
+    // Queued report; copied by the event queue.
+    struct Report {
+        SimController *self;
+        const Advertiser *advertiser;
+    };
+
+    HostBluetoothPlatform &_platform;
+    Host &_host;
+    VirtualEventQueue &_queue;
+    uint32_t _index;
+    std::string _input;
+    size_t _input_position;
+    uint32_t _start_delay_ms;
+    std::minstd_rand _random;
+    std::vector<Message> &_outbox;
+
+    // Address and advertising data, which do not change so that scanners on other threads may read them.
+    Advertiser _advertiser;
+
+    bool _is_advertising;
+    bool _is_connectable;
+    uint32_t _adv_interval_us;
+    uint64_t _next_event_us;
+
+    bool _is_scanning;
+    bool _is_filtered;
+    uint8_t _filter_address[6];
+    uint64_t _scan_start_us;
+    uint32_t _scan_interval_us;
+    uint32_t _scan_window_us;
+
+    // Device connected to or being connected to, or -1, and the result of a connection attempt for the host.
+    int64_t _peer;
+    bool _is_connected;
+    uint8_t _peer_address[6];
+    BluetoothPlatform::connection_role_t _role;
+    int _connect_error;
+
+    Stats _stats;
+
+    uint64_t nowUs() const;
+
+    void send(Message::type_t type, uint32_t to, int32_t value);
+
+    // Scheduled calls. arg is a pointer to this, or to a Report for callReport.
+    static void callInput(void *arg);
+    static void callReport(void *arg);
+    static void callConnected(void *arg);
+    static void callConnectionFailed(void *arg);
+    static void callDisconnected(void *arg);
+};
+
+#endif // ! SIMCONTROLLER_H
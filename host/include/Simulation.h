@@ -0,0 +1,150 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <HostBluetoothPlatform.h>
+#include <PowerConsumptionTest.h>
+#include <SimController.h>
+
+/// Many devices running PowerConsumptionTest on a shared advertising medium (see SimController.h).
+///
+/// The devices are split between worker threads, each of which runs its own devices. The threads synchronise
+/// conservatively, every lookahead ms of virtual time: in each window they put the advertising packets of their
+/// devices on the channels, then the collisions are worked out, then each thread delivers what its scanners heard and
+/// runs its devices' events up to the end of the window. Devices only affect each other through the medium and
+/// through messages, which take effect at the next window, so the threads never need to wait for each other within a
+/// window and the results do not depend on the number of threads.
+struct Simulation {
+    struct Options {
+        /// Number of devices, of which the first scanners scan and the rest advertise.
+        uint32_t devices = 1000;
+        uint32_t scanners = 1;
+
+        /// Advertisers named like the scanners, which match them by name and connect to them. The other advertisers
+        /// have names of their own.
+        uint32_t peers = 0;
+
+        /// Advertising intervals in ms, given to the advertisers in turn.
+        std::vector<uint32_t> intervals = { 100, 250, 1000 };
+
+        /// Make the scanners match the first peer by MAC, or an absent device if there are no peers, so that the
+        /// controller filters the reports of the other advertisers.
+        bool filter = false;
+
+        /// Test parameters set on every device, as "<name> <value>".
+        std::vector<std::string> parameters;
+
+        uint32_t duration_ms = 60000;
+        uint32_t lookahead_ms = 10;
+        uint32_t threads = 1;
+        uint32_t seed = 1;
+
+        /// Device whose output is printed to stderr, or -1 for none.
+        int64_t verbose = -1;
+    };
+
+    explicit Simulation(const Options &options);
+
+    Simulation(const Simulation &) = delete;
+
+    ~Simulation();
+
+    /// Run the simulation to the end.
+    void run();
+
+    /// Print one CSV line of statistics for each device, then a summary to stderr.
+    void printStats(FILE *out) const;
+
+private:
+    struct Device {
+        Device(
+            const char *name,
+            uint32_t index,
+            std::string input,
+            uint32_t startDelayMs,
+            uint32_t seed,
+            std::vector<SimController::Message> &outbox
+        );
+
+        HostBluetoothPlatform platform;
+        SimController controller;
+        PowerConsumptionTest test;
+        const char *role;
+        uint32_t adv_interval_ms;
+    };
+
+    // What a worker needs to know to skip a device in a window, kept together so that idle devices cost little.
+    struct Slot {
+        uint64_t next_transmission_us;
+        uint64_t next_event_ms;
+        bool is_scanning;
+    };
+
+    // Buffers of a worker thread, which runs every threads-th device from its index so that the scanners are spread.
+    // Messages are sent into sent, which becomes outbox at the end of the window for the other threads to read.
+    struct Worker {
+        std::vector<Slot> slots;
+        std::vector<SimController::Packet> packets[3];
+        std::vector<SimController::Message> sent;
+        std::vector<SimController::Message> outbox;
+    };
+
+    // Sense-reversing barrier which spins, then yields: windows are short, so threads rarely wait for long.
+    struct Barrier {
+        explicit Barrier(uint32_t threads);
+        void wait();
+
+        uint32_t _threads;
+        std::atomic<uint32_t> _count;
+        std::atomic<uint32_t> _generation;
+    };
+
+    Options _options;
+    std::vector<std::string> _names;
+    std::vector<std::unique_ptr<Device>> _devices;
+    std::vector<Worker> _workers;
+    Barrier _barrier;
+
+    // Packets of the current window on each channel, sorted by start, and the end of the last packet of the previous
+    // window which may overlap the first ones of this window.
+    std::vector<SimController::Packet> _channels[3];
+    uint64_t _carried_end_us[3];
+    uint64_t _packets[3];
+    uint64_t _collided[3];
+    double _wall_time_s;
+
+    // Run the windows with the devices of a worker.
+    void work(uint32_t worker);
+
+    // Update a device's slot after it has run.
+    void updateSlot(uint32_t worker, uint32_t device);
+
+    // Gather, sort and mark the collisions of a channel.
+    void resolve(size_t channel);
+};
+
+#endif // ! SIMULATION_H
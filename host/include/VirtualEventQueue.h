@@ -0,0 +1,147 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VIRTUALEVENTQUEUE_H
+#define VIRTUALEVENTQUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <set>
+
+#include <config.h>
+#include <SchedulerStats.h>
+
+/// Event queue with the interface of the Zephyr backend's EventQueue, running on a virtual clock.
+/// Time only advances when the queue has nothing left to run at the current time, and then jumps straight to the next
+/// wakeup, so a run takes as long as its callbacks and is the same every time. Callbacks are ordered as on Zephyr: by
+/// the latest time they may run (deadline plus slack), then by the order they were scheduled. A wakeup happens at the
+/// earliest such latest time and runs every callback whose deadline has passed, so calls with overlapping windows
+/// share it.
+/// Single threaded: everything, including the fake controller, runs on the dispatching thread.
+struct VirtualEventQueue {
+    typedef void (*callback_t)(void *);
+
+    /// Maximum size of a payload copied into an event by call_in().
+    static constexpr size_t PAYLOAD_SIZE = 4 * sizeof(void *);
+
+    VirtualEventQueue();
+
+    VirtualEventQueue(const VirtualEventQueue &) = delete;
+
+    /// Add an event to be dispatched at the current time, after those already due. Returns the event id.
+    int call(callback_t fn, void *arg);
+
+    /// Schedule callback to be called after `millis` ms. Returns the event id.
+    int call_in(uint32_t millis, callback_t fn, void *arg);
+
+    /// Schedule callback to be called after at least `millis` ms and at most `millis + slack` ms. Returns the event id.
+    int call_in(uint32_t millis, uint32_t slack, callback_t fn, void *arg);
+
+    /// As call_in(millis, slack, fn, arg), but the callback gets a pointer to a copy of `size` bytes of `payload`,
+    /// which must not exceed PAYLOAD_SIZE.
+    int call_in(uint32_t millis, uint32_t slack, callback_t fn, const void *payload, size_t size);
+
+    /// Schedule callback to be called every `period` ms, starting `period` ms from now. Returns the event id, or 0 if
+    /// `period` is 0.
+    int call_every(uint32_t period, callback_t fn, void *arg);
+
+    /// Cancel a pending event. Returns false if the id is 0 or the event has already been dispatched or cancelled.
+    /// A recurring event may cancel itself from its callback.
+    bool cancel(int id);
+
+    /// Virtual time in ms since the queue was created.
+    uint64_t now() const;
+
+    /// Time of the next wakeup, UINT64_MAX if no event is pending.
+    uint64_t next() const;
+
+    /// Advance to the next wakeup and run the callbacks due then. Returns false without running anything if no event
+    /// is pending or the next wakeup is after `until`, in which case the time is moved to `until`.
+    bool dispatch_once(uint64_t until);
+
+    /// Counts of wakeups that ran events.
+    struct WakeupStats {
+        /// Wakeups that ran timed events, none of them before the end of its slack.
+        uint32_t uncoalesced;
+
+        /// Wakeups that also ran timed events before the end of their slack, which would otherwise have needed
+        /// wakeups of their own.
+        uint32_t coalesced;
+
+        /// Timed events run before the end of their slack by the coalesced wakeups, i.e. wakeups saved.
+        uint32_t coalesced_events;
+    };
+
+    WakeupStats wakeupStats() const;
+
+#if CONFIG_SCHED_STATS
+    /// Virtual lateness and real duration of every callback run.
+    const SchedulerStats &schedulerStats() const;
+#endif
+
+private:
+    struct Event {
+        callback_t fn;
+        void *arg;
+        uint64_t deadline;
+        uint64_t latest;
+        uint32_t sequence;
+
+        // Interval between calls of a recurring event, 0 for a one-shot event.
+        uint32_t period;
+
+        // Whether arg points to payload.
+        bool has_payload;
+
+        alignas(8) uint8_t payload[PAYLOAD_SIZE];
+    };
+
+    // Order of the pending events: latest time, then sequence. Each key also holds the event id.
+    struct Key {
+        uint64_t latest;
+        uint32_t sequence;
+        int id;
+
+        bool operator<(const Key &other) const;
+    };
+
+    std::map<int, Event> _events;
+    std::set<Key> _order;
+    uint64_t _now;
+    uint32_t _sequence;
+    int _next_id;
+
+    // Id of the event whose callback is running and whether it cancelled itself.
+    int _current;
+    bool _current_cancelled;
+
+    WakeupStats _wakeup_stats;
+
+#if CONFIG_SCHED_STATS
+    SchedulerStats _sched_stats;
+#endif
+
+    // Add an event and return its id.
+    int schedule(const Event &event);
+
+    // Remove the first due event from the queue and run it. Returns false if none is due. Sets early if the event
+    // ran before the end of its slack.
+    bool runDue(bool &early);
+};
+
+#endif // ! VIRTUALEVENTQUEUE_H
@@ -0,0 +1,21 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#define CONFIG_SCAN_TIME         (CONFIG_APP_SCAN_TIME)
+#define CONFIG_ADVERTISE_TIME    (CONFIG_APP_ADVERTISE_TIME)
+#define CONFIG_CONNECT_TIME      (CONFIG_APP_CONNECT_TIME)
+#define CONFIG_PERIODIC_INTERVAL (CONFIG_APP_PERIODIC_INTERVAL)
+#define CONFIG_TIMER_SLACK       (CONFIG_APP_TIMER_SLACK)
+#define CONFIG_LIST_SCAN_DEVS    (CONFIG_APP_LIST_SCAN_DEVS)
+#define CONFIG_SCHED_STATS       (CONFIG_APP_SCHED_STATS)
+#define CONFIG_LOG_BUFFER_SIZE   (CONFIG_APP_LOG_BUFFER_SIZE)
+#define CONFIG_BINARY_LOG        (CONFIG_APP_BINARY_LOG)
+#define CONFIG_THROUGHPUT_WINDOW (CONFIG_APP_THROUGHPUT_WINDOW)
+
+// As on Zephyr. The fake controller does not model scan requests.
+#define CONFIG_ACTIVE_SCAN       1
+
+// The fake controller supports periodic advertising.
+#define CONFIG_USE_PER_ADV_SYNC  1
+
+#endif // ! CONFIG_H
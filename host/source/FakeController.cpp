@@ -0,0 +1,582 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <FakeController.h>
+
+// AD types used in the advertising data of scripted advertisers.
+static constexpr uint8_t AD_FLAGS = 0x01;
+static constexpr uint8_t AD_COMPLETE_LOCAL_NAME = 0x09;
+static constexpr uint8_t AD_FLAGS_LE_GENERAL_DISCOVERABLE_BR_EDR_NOT_SUPPORTED = 0x06;
+
+// Address of the device under test, as printed: c0:ff:ee:00:00:01.
+static const uint8_t LOCAL_ADDRESS[6] = { 0x01, 0x00, 0x00, 0xee, 0xff, 0xc0 };
+
+// Parse 12 hex digits, with optional ':' separators, into an address stored least significant byte first.
+static bool parseAddress(const char *text, uint8_t *address)
+{
+    size_t digits = 0;
+    uint8_t bytes[6] = {};
+    for (auto c = text; *c != '\0'; c++) {
+        if (*c == ':') {
+            continue;
+        }
+
+        if (!isxdigit(static_cast<unsigned char>(*c)) || digits == 12) {
+            return false;
+        }
+
+        auto value = isdigit(static_cast<unsigned char>(*c)) ? *c - '0' : tolower(*c) - 'a' + 10;
+        bytes[digits / 2] = static_cast<uint8_t>(bytes[digits / 2] << 4 | value);
+        digits++;
+    }
+
+    if (digits != 12) {
+        return false;
+    }
+
+    for (size_t i = 0; i < 6; i++) {
+        address[i] = bytes[5 - i];
+    }
+
+    return true;
+}
+
+// Parse a decimal number which must fit in 32 bits.
+static bool parseNumber(const char *text, uint32_t &value)
+{
+    if (text == nullptr || !isdigit(static_cast<unsigned char>(*text))) {
+        return false;
+    }
+
+    char *end;
+    auto parsed = strtoull(text, &end, 10);
+    if (*end != '\0' || parsed > UINT32_MAX) {
+        return false;
+    }
+
+    value = static_cast<uint32_t>(parsed);
+    return true;
+}
+
+// Expand the escapes of an input command: \n, \r, \t and \\.
+static bool unescape(const char *text, std::string &out)
+{
+    for (auto c = text; *c != '\0'; c++) {
+        if (*c != '\\') {
+            out += *c;
+            continue;
+        }
+
+        c++;
+        switch (*c) {
+            case 'n':  out += '\n'; break;
+            case 'r':  out += '\r'; break;
+            case 't':  out += '\t'; break;
+            case '\\': out += '\\'; break;
+            default:   return false;
+        }
+    }
+
+    return true;
+}
+
+FakeController::FakeController(VirtualEventQueue &queue, Host &host)
+: _queue(queue)
+, _host(host)
+, _is_scanning(false)
+, _is_filtered(false)
+, _filter_address{}
+, _is_connectable(false)
+, _is_connected(false)
+, _is_synced(false)
+, _peer{}
+, _sid(0)
+, _link_timer(0)
+, _gatt_timer(0)
+, _phy_timer(0)
+, _phy(BluetoothPlatform::phy_t::le_1m)
+{
+    memcpy(_local_address, LOCAL_ADDRESS, sizeof(_local_address));
+}
+
+bool FakeController::load(FILE *file, const char *name)
+{
+    char line[256];
+    size_t number = 0;
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        number++;
+        auto length = strlen(line);
+        if (length == sizeof(line) - 1 && line[length - 1] != '\n') {
+            fprintf(stderr, "%s:%zu: line too long\n", name, number);
+            return false;
+        }
+
+        // Strip the newline and skip blank lines and comments.
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            line[--length] = '\0';
+        }
+
+        auto start = line;
+        while (isspace(static_cast<unsigned char>(*start))) {
+            start++;
+        }
+
+        if (*start == '\0' || *start == '#') {
+            continue;
+        }
+
+        Command command = {};
+        command.owner = this;
+        std::string message;
+        if (!parse(start, command, message)) {
+            fprintf(stderr, "%s:%zu: %s\n", name, number, message.c_str());
+            return false;
+        }
+
+        _script.push_back(command);
+    }
+
+    // Commands at the same time run in the order they were written.
+    std::stable_sort(_script.begin(), _script.end(), [](const Command &a, const Command &b) {
+        return a.time < b.time;
+    });
+    return true;
+}
+
+bool FakeController::parse(char *line, Command &command, std::string &message)
+{
+    // "<ms> <command> <arguments>". The name of an advertiser and the text of an input run to the end of the line.
+    auto time = strtok(line, " \t");
+    auto name = strtok(nullptr, " \t");
+    auto rest = strtok(nullptr, "");
+    uint32_t ms;
+    if (!parseNumber(time, ms) || name == nullptr) {
+        message = "expected \"<ms> <command> [arguments]\"";
+        return false;
+    }
+
+    command.time = ms;
+    static const struct {
+        const char *name;
+        command_t command;
+        size_t values;
+    } commands[] = {
+        { "input",               command_t::input,               0 },
+        { "advertiser",          command_t::advertiser,          1 },
+        { "periodic_advertiser", command_t::periodic_advertiser, 3 },
+        { "remove",              command_t::remove,              0 },
+        { "connect",             command_t::connect,             0 },
+        { "disconnect",          command_t::disconnect,          0 },
+        { "sync_lost",           command_t::sync_lost,           0 },
+        { "phy",                 command_t::phy,                 1 },
+        { "conn_params",         command_t::conn_params,         3 },
+        { "subscribe",           command_t::subscribe,           1 },
+        { "receive",             command_t::receive,             2 },
+        { "fail",                command_t::fail,                1 },
+        { "end",                 command_t::end,                 0 },
+    };
+
+    auto entry = std::find_if(std::begin(commands), std::end(commands), [name](decltype(commands[0]) &c) {
+        return strcmp(c.name, name) == 0;
+    });
+    if (entry == std::end(commands)) {
+        message = std::string("unknown command \"") + name + "\"";
+        return false;
+    }
+
+    command.command = entry->command;
+    if (command.command == command_t::input) {
+        if (rest == nullptr || !unescape(rest, command.text)) {
+            message = "expected text with only \\n, \\r, \\t and \\\\ escapes";
+            return false;
+        }
+
+        return true;
+    }
+
+    // Commands about a peer take its address first, and fail and receive take a word.
+    auto &advertiser = command.advertiser;
+    auto has_address = command.command == command_t::advertiser
+        || command.command == command_t::periodic_advertiser
+        || command.command == command_t::remove
+        || command.command == command_t::connect;
+    auto has_word = command.command == command_t::fail || command.command == command_t::receive;
+    auto is_advertiser = command.command == command_t::advertiser || command.command == command_t::periodic_advertiser;
+    if (has_address || has_word) {
+        auto word = strtok(rest, " \t");
+        rest = strtok(nullptr, "");
+        if (word == nullptr || (has_address && !parseAddress(word, advertiser.address))) {
+            message = has_address ? "expected an address" : "expected an operation or characteristic";
+            return false;
+        }
+
+        command.text = has_word ? word : "";
+    }
+
+    if (command.command == command_t::receive && command.text != "throughput" && command.text != "workload") {
+        message = "expected throughput or workload";
+        return false;
+    }
+
+    for (size_t i = 0; i < entry->values; i++) {
+        auto word = strtok(rest, " \t");
+        rest = strtok(nullptr, "");
+        uint32_t value;
+        if (!parseNumber(word, value)) {
+            message = std::string("expected ") + std::to_string(entry->values) + " numbers";
+            return false;
+        }
+
+        command.values.push_back(value);
+    }
+
+    if (is_advertiser) {
+        // The name is the rest of the line, after the flags in the advertising data.
+        auto name_length = rest == nullptr ? 0 : strlen(rest);
+        if (name_length == 0 || name_length > sizeof(advertiser.data) - 5) {
+            message = "expected a name of up to 26 characters";
+            return false;
+        }
+
+        if (command.values[0] == 0) {
+            message = "the advertising interval must not be 0";
+            return false;
+        }
+
+        advertiser.data[0] = 2;
+        advertiser.data[1] = AD_FLAGS;
+        advertiser.data[2] = AD_FLAGS_LE_GENERAL_DISCOVERABLE_BR_EDR_NOT_SUPPORTED;
+        advertiser.data[3] = static_cast<uint8_t>(name_length + 1);
+        advertiser.data[4] = AD_COMPLETE_LOCAL_NAME;
+        memcpy(&advertiser.data[5], rest, name_length);
+        advertiser.data_size = 5 + name_length;
+        advertiser.interval_ms = command.values[0];
+        advertiser.is_periodic = command.command == command_t::periodic_advertiser;
+        if (advertiser.is_periodic) {
+            advertiser.sid = static_cast<uint8_t>(command.values[1]);
+            advertiser.periodic_interval_ms = command.values[2];
+        }
+    } else if (rest != nullptr && strtok(rest, " \t") != nullptr) {
+        message = "too many arguments";
+        return false;
+    }
+
+    // Values which the command takes as they are.
+    auto is_valid = true;
+    switch (command.command) {
+        case command_t::phy:       is_valid = command.values[0] >= 1 && command.values[0] <= 3; break;
+        case command_t::subscribe: is_valid = command.values[0] >= 1 && command.values[0] <= 2; break;
+        case command_t::receive:   is_valid = command.values[1] > 0;                            break;
+        default:                                                                                break;
+    }
+
+    if (!is_valid) {
+        message = "argument out of range";
+        return false;
+    }
+
+    return true;
+}
+
+void FakeController::start()
+{
+    auto now = _queue.now();
+    for (auto &command : _script) {
+        auto delay = command.time > now ? command.time - now : 0;
+        _queue.call_in(static_cast<uint32_t>(delay), &runCommand, &command);
+    }
+}
+
+const uint8_t *FakeController::localAddress() const
+{
+    return _local_address;
+}
+
+int FakeController::takeFailure(const char *operation)
+{
+    auto it = std::find_if(_failures.begin(), _failures.end(), [operation](const Failure &failure) {
+        return failure.operation == operation;
+    });
+    if (it == _failures.end()) {
+        return 0;
+    }
+
+    auto error = it->error;
+    _failures.erase(it);
+    return error;
+}
+
+void FakeController::setScanning(bool scanning, const uint8_t *filterAddress)
+{
+    _is_scanning = scanning;
+    _is_filtered = filterAddress != nullptr;
+    if (_is_filtered) {
+        memcpy(_filter_address, filterAddress, sizeof(_filter_address));
+    }
+
+    for (auto command : _advertisers) {
+        if (scanning) {
+            startTicking(*command);
+        } else {
+            _queue.cancel(command->tick);
+            command->tick = 0;
+        }
+    }
+}
+
+void FakeController::setAdvertising(bool advertising, bool periodic)
+{
+    _is_connectable = advertising && !periodic;
+}
+
+void FakeController::connect(const uint8_t *peer, uint32_t intervalMs)
+{
+    memcpy(_peer, peer, sizeof(_peer));
+    _link_timer = _queue.call_in(intervalMs, &callConnected, this);
+}
+
+void FakeController::disconnect()
+{
+    _queue.cancel(_link_timer);
+    _queue.cancel(_gatt_timer);
+    _queue.cancel(_phy_timer);
+    _link_timer = _gatt_timer = _phy_timer = 0;
+    if (_is_connected) {
+        _is_connected = false;
+        _queue.call(&callDisconnected, this);
+    }
+}
+
+void FakeController::sync(const uint8_t *peer, uint8_t sid)
+{
+    memcpy(_peer, peer, sizeof(_peer));
+    _sid = sid;
+    auto command = findAdvertiser(peer);
+    auto delay = command != nullptr && command->advertiser.is_periodic ? command->advertiser.periodic_interval_ms : 0;
+    _link_timer = _queue.call_in(delay, &callSynced, this);
+}
+
+void FakeController::stopSync()
+{
+    _queue.cancel(_link_timer);
+    _link_timer = 0;
+    _is_synced = false;
+}
+
+void FakeController::requestPhy(BluetoothPlatform::phy_t phy, uint32_t intervalMs)
+{
+    _phy = phy;
+    _queue.cancel(_phy_timer);
+    _phy_timer = _queue.call_in(2 * intervalMs, &callPhyUpdated, this);
+}
+
+void FakeController::exchangeMtu(uint32_t intervalMs)
+{
+    _queue.cancel(_gatt_timer);
+    _gatt_timer = _queue.call_in(2 * intervalMs, &callMtuExchanged, this);
+}
+
+void FakeController::startTicking(Command &command)
+{
+    auto &advertiser = command.advertiser;
+    if (command.tick != 0) {
+        return;
+    }
+
+    if (_is_filtered && memcmp(advertiser.address, _filter_address, sizeof(_filter_address)) != 0) {
+        return;
+    }
+
+    command.tick = _queue.call_every(advertiser.interval_ms, &callTick, &command);
+}
+
+FakeController::Command *FakeController::findAdvertiser(const uint8_t *address)
+{
+    for (auto command : _advertisers) {
+        if (memcmp(command->advertiser.address, address, sizeof(command->advertiser.address)) == 0) {
+            return command;
+        }
+    }
+
+    return nullptr;
+}
+
+void FakeController::runCommand(void *arg)
+{
+    auto command = reinterpret_cast<Command *>(arg);
+    command->owner->run(*command);
+}
+
+void FakeController::run(Command &command)
+{
+    switch (command.command) {
+        case command_t::input:
+            for (auto c : command.text) {
+                _host.onInput(static_cast<unsigned char>(c));
+            }
+            break;
+
+        case command_t::advertiser:
+        case command_t::periodic_advertiser: {
+            // A later command with the same address replaces the advertiser.
+            auto previous = findAdvertiser(command.advertiser.address);
+            if (previous != nullptr) {
+                _queue.cancel(previous->tick);
+                previous->tick = 0;
+                _advertisers.erase(std::find(_advertisers.begin(), _advertisers.end(), previous));
+            }
+
+            _advertisers.push_back(&command);
+            if (_is_scanning) {
+                startTicking(command);
+            }
+            break;
+        }
+
+        case command_t::remove: {
+            auto previous = findAdvertiser(command.advertiser.address);
+            if (previous == nullptr) {
+                break;
+            }
+
+            _queue.cancel(previous->tick);
+            previous->tick = 0;
+            _advertisers.erase(std::find(_advertisers.begin(), _advertisers.end(), previous));
+
+            // A periodic advertiser which goes away ends the sync with it.
+            if (_is_synced && memcmp(_peer, command.advertiser.address, sizeof(_peer)) == 0) {
+                _is_synced = false;
+                _host.onSyncLost();
+            }
+            break;
+        }
+
+        case command_t::connect:
+            // Connections can only be made to us while we advertise.
+            if (_is_connectable && !_is_connected) {
+                _is_connectable = false;
+                _is_connected = true;
+                memcpy(_peer, command.advertiser.address, sizeof(_peer));
+                _host.onConnected(_peer, BluetoothPlatform::connection_role_t::peripheral);
+            }
+            break;
+
+        case command_t::disconnect:
+            disconnect();
+            break;
+
+        case command_t::sync_lost:
+            if (_is_synced) {
+                _is_synced = false;
+                _host.onSyncLost();
+            }
+            break;
+
+        case command_t::phy:
+            if (_is_connected) {
+                _host.onPhyUpdated(static_cast<BluetoothPlatform::phy_t>(command.values[0]));
+            }
+            break;
+
+        case command_t::conn_params:
+            if (_is_connected) {
+                _host.onConnectionParametersUpdated(
+                    BluetoothPlatform::ConnectionParameters {
+                        command.values[0],
+                        static_cast<uint16_t>(command.values[1]),
+                        command.values[2]
+                    }
+                );
+            }
+            break;
+
+        case command_t::subscribe:
+            if (_is_connected) {
+                _host.onSubscribed(static_cast<BluetoothPlatform::traffic_t>(command.values[0]));
+            }
+            break;
+
+        case command_t::receive:
+            if (_is_connected) {
+                _host.onReceived(command.text == "workload", command.values[0], command.values[1]);
+            }
+            break;
+
+        case command_t::fail:
+            _failures.push_back(Failure { command.text, -static_cast<int>(command.values[0]) });
+            break;
+
+        case command_t::end:
+            _host.onEnd();
+            break;
+    }
+}
+
+void FakeController::callTick(void *arg)
+{
+    auto command = reinterpret_cast<Command *>(arg);
+    command->owner->_host.onReport(command->advertiser);
+}
+
+void FakeController::callConnected(void *arg)
+{
+    auto self = reinterpret_cast<FakeController *>(arg);
+    self->_link_timer = 0;
+    self->_is_connected = true;
+    self->_host.onConnected(self->_peer, BluetoothPlatform::connection_role_t::main);
+}
+
+void FakeController::callDisconnected(void *arg)
+{
+    auto self = reinterpret_cast<FakeController *>(arg);
+    self->_host.onDisconnected();
+}
+
+void FakeController::callSynced(void *arg)
+{
+    auto self = reinterpret_cast<FakeController *>(arg);
+    self->_link_timer = 0;
+    auto command = self->findAdvertiser(self->_peer);
+    if (command == nullptr || !command->advertiser.is_periodic || command->advertiser.sid != self->_sid) {
+        return;
+    }
+
+    self->_is_synced = true;
+    self->_host.onSynced(command->advertiser);
+}
+
+void FakeController::callPhyUpdated(void *arg)
+{
+    auto self = reinterpret_cast<FakeController *>(arg);
+    self->_phy_timer = 0;
+    self->_host.onPhyUpdated(self->_phy);
+}
+
+void FakeController::callMtuExchanged(void *arg)
+{
+    auto self = reinterpret_cast<FakeController *>(arg);
+    self->_gatt_timer = 0;
+    self->_host.onMtuExchanged(ATT_MTU);
+}
@@ -0,0 +1,724 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <config.h>
+#include <HostBluetoothPlatform.h>
+
+HostBluetoothPlatform::HostBluetoothPlatform(const char *deviceName)
+: _device_name(deviceName)
+, _controller(nullptr)
+, _output(stdout)
+, _time_limit(UINT64_MAX)
+, _is_running(true)
+, _end_timer(0)
+, _is_scanner(false)
+, _is_periodic(false)
+, _is_scan_filtered(false)
+, _is_scanning_or_advertising(false)
+, _is_connecting_or_syncing(false)
+, _filter_address{}
+, _connection_handle(0)
+, _sync_handle(0)
+, _parameters{}
+, _att_mtu(23)
+, _is_workload(false)
+, _traffic(traffic_t::notification)
+, _backlog(0)
+, _is_streaming(false)
+, _has_traffic(false)
+, _connection_event_timer(0)
+, _traffic_start_ms(0)
+, _traffic_last_ms(0)
+, _traffic_stats{}
+{}
+
+void HostBluetoothPlatform::setController(HostController &controller)
+{
+    _controller = &controller;
+}
+
+VirtualEventQueue &HostBluetoothPlatform::eventQueue()
+{
+    return _event_queue;
+}
+
+void HostBluetoothPlatform::setOutput(FILE *output)
+{
+    _output = output;
+}
+
+void HostBluetoothPlatform::setTimeLimit(uint64_t ms)
+{
+    _time_limit = ms;
+}
+
+int HostBluetoothPlatform::init()
+{
+    assert(_controller != nullptr);
+    getEventHandler()->onInitComplete();
+
+    // After onInitComplete() so that the first prompt comes before any scripted input at time 0.
+    _controller->start();
+    return 0;
+}
+
+void HostBluetoothPlatform::runEventLoop()
+{
+    while (_is_running && _event_queue.dispatch_once(_time_limit)) {
+    }
+
+    flushLog();
+    if (_output != nullptr) {
+        fflush(_output);
+    }
+    exit(EXIT_SUCCESS);
+}
+
+void HostBluetoothPlatform::getLocalAddress(uint8_t buf[6])
+{
+    memcpy(buf, _controller->localAddress(), 6);
+}
+
+void HostBluetoothPlatform::call(BluetoothPlatform::callback_t fn, void *arg)
+{
+    _event_queue.call(fn, arg);
+}
+
+BluetoothPlatform::timer_id_t HostBluetoothPlatform::callIn(
+    uint32_t millis,
+    BluetoothPlatform::callback_t fn,
+    void *arg
+)
+{
+    return _event_queue.call_in(millis, fn, arg);
+}
+
+BluetoothPlatform::timer_id_t HostBluetoothPlatform::callIn(
+    uint32_t millis,
+    uint32_t toleranceMs,
+    BluetoothPlatform::callback_t fn,
+    void *arg
+)
+{
+    return _event_queue.call_in(millis, toleranceMs, fn, arg);
+}
+
+BluetoothPlatform::timer_id_t HostBluetoothPlatform::callIn(
+    uint32_t millis,
+    uint32_t toleranceMs,
+    BluetoothPlatform::callback_t fn,
+    const void *payload,
+    size_t size
+)
+{
+    static_assert(MAX_PAYLOAD_SIZE <= VirtualEventQueue::PAYLOAD_SIZE, "VirtualEventQueue payload too small");
+    return _event_queue.call_in(millis, toleranceMs, fn, payload, size);
+}
+
+BluetoothPlatform::timer_id_t HostBluetoothPlatform::callEvery(
+    uint32_t periodMs,
+    BluetoothPlatform::callback_t fn,
+    void *arg
+)
+{
+    return _event_queue.call_every(periodMs, fn, arg);
+}
+
+bool HostBluetoothPlatform::cancel(BluetoothPlatform::timer_id_t id)
+{
+    return _event_queue.cancel(id);
+}
+
+BluetoothPlatform::WakeupStats HostBluetoothPlatform::getWakeupStats()
+{
+    auto stats = _event_queue.wakeupStats();
+    return WakeupStats{stats.uncoalesced, stats.coalesced, stats.coalesced_events, 0};
+}
+
+bool HostBluetoothPlatform::getSchedulerStats(SchedulerStats &stats)
+{
+#if CONFIG_SCHED_STATS
+    stats = _event_queue.schedulerStats();
+    return true;
+#else
+    (void)stats;
+    return false;
+#endif
+}
+
+uint32_t HostBluetoothPlatform::uptimeMs()
+{
+    return static_cast<uint32_t>(_event_queue.now());
+}
+
+void HostBluetoothPlatform::printError(intmax_t error, const char *msg)
+{
+    if (_output == nullptr) {
+        return;
+    }
+
+    fprintf(_output, "%s: error %" PRIdMAX, msg, error);
+    if (error < 0) {
+        fprintf(_output, " (%s)\n", strerror(static_cast<int>(-error)));
+    } else {
+        fprintf(_output, "\n");
+    }
+}
+
+void HostBluetoothPlatform::vprint(const char *fmt, va_list args)
+{
+    if (_output != nullptr) {
+        vfprintf(_output, fmt, args);
+    }
+}
+
+void HostBluetoothPlatform::write(const uint8_t *data, size_t size)
+{
+    if (_output != nullptr) {
+        fwrite(data, 1, size, _output);
+    }
+}
+
+void HostBluetoothPlatform::putchar(int c)
+{
+    if (_output != nullptr) {
+        fputc(c, _output);
+    }
+}
+
+const char *HostBluetoothPlatform::deviceName() const
+{
+    return _device_name;
+}
+
+bool HostBluetoothPlatform::isPeriodicAdvertisingAvailable()
+{
+    return CONFIG_USE_PER_ADV_SYNC;
+}
+
+BluetoothPlatform::ConnectionParameters HostBluetoothPlatform::requestedParameters()
+{
+    // As on the boards: the interval in 1.25 ms units and the supervision timeout in 10 ms units. The controller
+    // picks the longest interval of the requested range, as the Zephyr one does.
+    auto max_interval = params().conn_interval + params().conn_interval_span;
+    auto interval = std::min(std::max(max_interval * 4 / 5, 0x0006U), 0x0c80U);
+    return ConnectionParameters {
+        interval * 1250U,
+        static_cast<uint16_t>(params().conn_latency),
+        params().supervision_timeout / 10 * 10
+    };
+}
+
+uint32_t HostBluetoothPlatform::intervalMs() const
+{
+    return std::max(_parameters.intervalUs / 1000, 1U);
+}
+
+int HostBluetoothPlatform::takeFailure(const char *operation, const char *msg)
+{
+    auto error = _controller->takeFailure(operation);
+    if (error) {
+        printError(error, msg);
+    }
+
+    return error;
+}
+
+int HostBluetoothPlatform::startAdvertising()
+{
+    assert(!_is_connecting_or_syncing);
+    assert(!_is_scanning_or_advertising);
+    _is_scanner = false;
+    _is_periodic = false;
+
+    auto error = takeFailure("advertise", "Start advertising");
+    if (error) {
+        return error;
+    }
+
+    _controller->setAdvertising(true, false);
+    _is_scanning_or_advertising = true;
+    _end_timer = _event_queue.call_in(params().advertise_time, CONFIG_TIMER_SLACK, &endAdvertisingCallback, this);
+
+    getEventHandler()->onAdvertisingStart(AdvertisingStartEvent(params().advertise_time, false, 0));
+    return 0;
+}
+
+int HostBluetoothPlatform::startPeriodicAdvertising()
+{
+    assert(!_is_connecting_or_syncing);
+    assert(!_is_scanning_or_advertising);
+    _is_scanner = false;
+    _is_periodic = true;
+
+    auto error = takeFailure("advertise", "Start periodic advertising");
+    if (error) {
+        return error;
+    }
+
+    _controller->setAdvertising(true, true);
+    _is_scanning_or_advertising = true;
+    _end_timer = _event_queue.call_in(params().advertise_time, CONFIG_TIMER_SLACK, &endAdvertisingCallback, this);
+
+    getEventHandler()->onAdvertisingStart(
+        AdvertisingStartEvent(params().advertise_time, true, params().periodic_interval)
+    );
+    return 0;
+}
+
+int HostBluetoothPlatform::setScanFilter(const uint8_t *peerAddress)
+{
+    assert(!_is_scanning_or_advertising);
+    _is_scan_filtered = false;
+    auto error = takeFailure("filter", "Set scan filter");
+    if (error) {
+        return error;
+    }
+
+    if (peerAddress != nullptr) {
+        memcpy(_filter_address, peerAddress, sizeof(_filter_address));
+        _is_scan_filtered = true;
+    }
+
+    return 0;
+}
+
+int HostBluetoothPlatform::startScan()
+{
+    assert(!_is_connecting_or_syncing);
+    assert(!_is_scanning_or_advertising);
+    _is_scanner = true;
+    _is_periodic = false;
+
+    auto error = takeFailure("scan", "Start scanning");
+    if (error) {
+        return error;
+    }
+
+    _controller->setScanning(true, _is_scan_filtered ? _filter_address : nullptr);
+    _is_scanning_or_advertising = true;
+    _end_timer = _event_queue.call_in(params().scan_time, CONFIG_TIMER_SLACK, &endScanCallback, this);
+
+    getEventHandler()->onScanStart(ScanStartEvent(params().scan_time));
+    return 0;
+}
+
+int HostBluetoothPlatform::startScanForPeriodicAdvertising()
+{
+    auto ret = startScan();
+    _is_periodic = true;
+    return ret;
+}
+
+int HostBluetoothPlatform::establishConnection(uint8_t /* peerAddressType */, const uint8_t *peerAddress)
+{
+    assert(_is_scanner);
+    if (_is_connecting_or_syncing) {
+        return -EALREADY;
+    }
+
+    _is_connecting_or_syncing = true;
+    endScan();
+
+    auto error = takeFailure("connect", "Create connection");
+    if (error) {
+        // As on the boards, the failure is also raised so that the program carries on.
+        _is_connecting_or_syncing = false;
+        getEventHandler()->onConnection(ConnectEvent(error));
+        return error;
+    }
+
+    _parameters = requestedParameters();
+    _controller->connect(peerAddress, intervalMs());
+    return 0;
+}
+
+int HostBluetoothPlatform::syncToPeriodicAdvertising(
+    int32_t sid,
+    uint8_t /* peerAddressType */,
+    const uint8_t *peerAddress,
+    uint32_t /* syncTimeoutMs */
+)
+{
+    if (_is_connecting_or_syncing) {
+        return -EALREADY;
+    }
+
+    auto error = takeFailure("sync", "Create sync");
+    if (error) {
+        return error;
+    }
+
+    // Scanning goes on until the sync is established.
+    _is_connecting_or_syncing = true;
+    _controller->sync(peerAddress, static_cast<uint8_t>(sid));
+    return 0;
+}
+
+int HostBluetoothPlatform::setPhy(handle_t connection_handle, phy_t phy)
+{
+    assert(connection_handle == &_connection_handle);
+    auto error = takeFailure("phy", "Update PHY");
+    if (error) {
+        return error;
+    }
+
+    _controller->requestPhy(phy, intervalMs());
+    return 0;
+}
+
+int HostBluetoothPlatform::startThroughput(handle_t connection_handle)
+{
+    assert(connection_handle == &_connection_handle);
+    _is_workload = false;
+    auto error = takeFailure("throughput", "Start throughput run");
+    if (error) {
+        return error;
+    }
+
+    // Continues in onMtuExchanged().
+    _controller->exchangeMtu(intervalMs());
+    return 0;
+}
+
+int HostBluetoothPlatform::prepareWorkload(handle_t connection_handle, traffic_t traffic)
+{
+    assert(connection_handle == &_connection_handle);
+    _is_workload = true;
+    _traffic = traffic;
+    auto error = takeFailure("workload", "Prepare workload");
+    if (error) {
+        return error;
+    }
+
+    // Continues in onMtuExchanged().
+    _controller->exchangeMtu(intervalMs());
+    return 0;
+}
+
+int HostBluetoothPlatform::sendWorkload(handle_t /* connection_handle */, size_t size)
+{
+    // The connection may have been closed by disconnect() since the burst was scheduled.
+    if (!_is_connecting_or_syncing || !_is_workload || !_is_streaming) {
+        return -ENOTCONN;
+    }
+
+    if (_backlog > 0) {
+        return -EBUSY;
+    }
+
+    _backlog = size;
+    startConnectionEvents();
+    return 0;
+}
+
+bool HostBluetoothPlatform::getTrafficStats(TrafficStats &stats)
+{
+    stats = _traffic_stats;
+    stats.durationMs = 0;
+    if (_has_traffic && !_is_workload && stats.packets > 0) {
+        stats.durationMs = _traffic_last_ms - _traffic_start_ms;
+    }
+
+    return _has_traffic || stats.packets > 0;
+}
+
+int HostBluetoothPlatform::disconnect(handle_t connection_handle)
+{
+    assert(connection_handle == &_connection_handle);
+    assert(_is_connecting_or_syncing);
+
+    // onDisconnected() follows once the caller has returned.
+    _is_connecting_or_syncing = false;
+    stopConnectionEvents();
+    _controller->disconnect();
+    return 0;
+}
+
+int HostBluetoothPlatform::stopSync(handle_t sync_handle)
+{
+    assert(sync_handle == &_sync_handle);
+    assert(_is_connecting_or_syncing);
+    _controller->stopSync();
+    _is_connecting_or_syncing = false;
+    return 0;
+}
+
+void HostBluetoothPlatform::endAdvertising()
+{
+    if (!_is_scanning_or_advertising || _is_scanner) {
+        return;
+    }
+
+    // Update flags, cancel the timeout if ending early and stop advertising.
+    _is_scanning_or_advertising = false;
+    _event_queue.cancel(_end_timer);
+    _end_timer = 0;
+    _controller->setAdvertising(false, _is_periodic);
+
+    // Trigger timeout, unless we are already connecting.
+    if (!_is_connecting_or_syncing) {
+        getEventHandler()->onAdvertisingTimeout();
+    }
+}
+
+void HostBluetoothPlatform::endScan()
+{
+    if (!_is_scanning_or_advertising || !_is_scanner) {
+        return;
+    }
+
+    // Update flags, cancel the timeout if ending early & stop the scan.
+    _is_scanning_or_advertising = false;
+    _event_queue.cancel(_end_timer);
+    _end_timer = 0;
+    _controller->setScanning(false, nullptr);
+
+    // Trigger timeout unless we are already connecting.
+    if (!_is_connecting_or_syncing) {
+        getEventHandler()->onScanTimeout();
+    }
+}
+
+void HostBluetoothPlatform::runConnectionEvent()
+{
+    // Only one indication may await confirmation, which comes in the next connection event.
+    uint32_t window = _is_workload && _traffic == traffic_t::indication ? 1 : CONFIG_THROUGHPUT_WINDOW;
+    for (uint32_t i = 0; i < window && _backlog > 0; i++) {
+        auto length = std::min<uint64_t>(_att_mtu - 3U, _backlog);
+        if (_backlog != UINT64_MAX) {
+            _backlog -= length;
+        }
+
+        _traffic_stats.packets++;
+        _traffic_stats.bytes += length;
+    }
+
+    _traffic_last_ms = uptimeMs();
+    if (_backlog == 0) {
+        stopConnectionEvents();
+    }
+}
+
+void HostBluetoothPlatform::startConnectionEvents()
+{
+    if (_connection_event_timer == 0 && _backlog > 0) {
+        _connection_event_timer = _event_queue.call_every(intervalMs(), &connectionEventCallback, this);
+    }
+}
+
+void HostBluetoothPlatform::stopConnectionEvents()
+{
+    _event_queue.cancel(_connection_event_timer);
+    _connection_event_timer = 0;
+}
+
+void HostBluetoothPlatform::startedThroughput(intmax_t error, connection_role_t role)
+{
+    _has_traffic = error == 0;
+    _traffic_start_ms = uptimeMs();
+    getEventHandler()->onThroughputStart(ThroughputStartEvent(error, role, _att_mtu));
+}
+
+void HostBluetoothPlatform::workloadReady(intmax_t error, connection_role_t role)
+{
+    _has_traffic = error == 0;
+    getEventHandler()->onWorkloadReady(WorkloadReadyEvent(error, role, _traffic, _att_mtu));
+}
+
+void HostBluetoothPlatform::onReport(const HostController::Advertiser &advertiser)
+{
+    // A connection or sync may have been started by an earlier report.
+    if (_is_connecting_or_syncing || !_is_scanning_or_advertising) {
+        return;
+    }
+
+    getEventHandler()->onAdvertisingReport(
+        AdvertisingReportEvent(
+            advertiser.sid,
+            HostController::PEER_ADDRESS_TYPE,
+            advertiser.address,
+            sizeof(advertiser.address),
+            advertiser.data,
+            advertiser.data_size,
+            advertiser.is_periodic,
+            advertiser.periodic_interval_ms
+        )
+    );
+}
+
+void HostBluetoothPlatform::onConnected(const uint8_t *peer, connection_role_t role)
+{
+    // Update flags and stop scan/adv.
+    _is_connecting_or_syncing = true;
+    _connection_handle++;
+    _att_mtu = 23;
+    _is_streaming = false;
+    _has_traffic = false;
+    _is_workload = false;
+    _backlog = 0;
+    _traffic_stats = {};
+    if (_is_scanner) {
+        endScan();
+    } else {
+        _parameters = requestedParameters();
+        endAdvertising();
+    }
+
+    getEventHandler()->onConnection(
+        ConnectEvent(
+            HostController::PEER_ADDRESS_TYPE,
+            peer,
+            6,
+            0,
+            role,
+            &_connection_handle,
+            _parameters
+        )
+    );
+}
+
+void HostBluetoothPlatform::onConnectionFailed(int error)
+{
+    _is_connecting_or_syncing = false;
+    printError(error, "Create connection");
+    getEventHandler()->onConnection(ConnectEvent(error));
+}
+
+void HostBluetoothPlatform::onDisconnected()
+{
+    _is_connecting_or_syncing = false;
+    _is_streaming = false;
+    stopConnectionEvents();
+    getEventHandler()->onDisconnect();
+}
+
+void HostBluetoothPlatform::onConnectionParametersUpdated(const ConnectionParameters &parameters)
+{
+    // Connection events follow the new interval.
+    _parameters = parameters;
+    if (_connection_event_timer != 0) {
+        stopConnectionEvents();
+        startConnectionEvents();
+    }
+
+    getEventHandler()->onConnectionParametersUpdate(
+        ConnectionParametersUpdateEvent(0, &_connection_handle, _parameters)
+    );
+}
+
+void HostBluetoothPlatform::onPhyUpdated(phy_t phy)
+{
+    getEventHandler()->onPhyUpdate(PhyUpdateEvent(0, &_connection_handle, phy, phy));
+}
+
+void HostBluetoothPlatform::onSynced(const HostController::Advertiser &advertiser)
+{
+    _is_connecting_or_syncing = true;
+    _sync_handle++;
+    endScan();
+    getEventHandler()->onPeriodicSync(
+        PeriodicSyncEvent(
+            advertiser.sid,
+            HostController::PEER_ADDRESS_TYPE,
+            advertiser.address,
+            sizeof(advertiser.address),
+            0,
+            connection_role_t::main,
+            &_sync_handle
+        )
+    );
+}
+
+void HostBluetoothPlatform::onSyncLost()
+{
+    _is_connecting_or_syncing = false;
+    getEventHandler()->onSyncLoss();
+}
+
+void HostBluetoothPlatform::onMtuExchanged(uint16_t mtu)
+{
+    _att_mtu = mtu;
+    _is_streaming = true;
+    if (!_is_workload) {
+        _backlog = UINT64_MAX;
+        startedThroughput(0, connection_role_t::main);
+        startConnectionEvents();
+        return;
+    }
+
+    // For notifications and indications main is subscribed by now, and the peer sends them.
+    workloadReady(0, connection_role_t::main);
+}
+
+void HostBluetoothPlatform::onSubscribed(traffic_t traffic)
+{
+    _is_workload = true;
+    _traffic = traffic;
+    _is_streaming = true;
+    _backlog = 0;
+    workloadReady(0, connection_role_t::peripheral);
+}
+
+void HostBluetoothPlatform::onReceived(bool is_workload, uint64_t bytes, uint32_t packets)
+{
+    // The peer's first write starts a throughput run on the peripheral.
+    _traffic_last_ms = uptimeMs();
+    if (!is_workload && !_has_traffic) {
+        _is_workload = false;
+        startedThroughput(0, connection_role_t::peripheral);
+    }
+
+    _traffic_stats.packets += packets;
+    _traffic_stats.bytes += bytes;
+}
+
+void HostBluetoothPlatform::onInput(int c)
+{
+    getEventHandler()->onInput(c);
+}
+
+void HostBluetoothPlatform::onEnd()
+{
+    _is_running = false;
+}
+
+void HostBluetoothPlatform::endAdvertisingCallback(void *arg)
+{
+    reinterpret_cast<HostBluetoothPlatform *>(arg)->endAdvertising();
+}
+
+void HostBluetoothPlatform::endScanCallback(void *arg)
+{
+    reinterpret_cast<HostBluetoothPlatform *>(arg)->endScan();
+}
+
+void HostBluetoothPlatform::connectionEventCallback(void *arg)
+{
+    reinterpret_cast<HostBluetoothPlatform *>(arg)->runConnectionEvent();
+}
@@ -0,0 +1,396 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <SimController.h>
+
+// AD types used in the advertising data.
+static constexpr uint8_t AD_FLAGS = 0x01;
+static constexpr uint8_t AD_COMPLETE_LOCAL_NAME = 0x09;
+static constexpr uint8_t AD_FLAGS_LE_GENERAL_DISCOVERABLE_BR_EDR_NOT_SUPPORTED = 0x06;
+
+// Longest name which fits in the advertising data after the flags.
+static constexpr size_t MAX_NAME_LENGTH = 31 - 3 - 2;
+
+// Operations which are not modelled.
+static const char *const UNSUPPORTED_OPERATIONS[] = { "sync", "phy", "throughput", "workload" };
+
+static uint32_t airtimeUs(const HostController::Advertiser &advertiser)
+{
+    return (SimController::PACKET_OVERHEAD + advertiser.data_size) * SimController::US_PER_BYTE;
+}
+
+SimController::SimController(
+    HostBluetoothPlatform &platform,
+    uint32_t index,
+    std::string input,
+    uint32_t startDelayMs,
+    uint32_t seed,
+    std::vector<Message> &outbox
+)
+: _platform(platform)
+, _host(platform)
+, _queue(platform.eventQueue())
+, _index(index)
+, _input(std::move(input))
+, _input_position(0)
+, _start_delay_ms(startDelayMs)
+, _random(seed)
+, _outbox(outbox)
+, _advertiser{}
+, _is_advertising(false)
+, _is_connectable(false)
+, _adv_interval_us(0)
+, _next_event_us(0)
+, _is_scanning(false)
+, _is_filtered(false)
+, _filter_address{}
+, _scan_start_us(0)
+, _scan_interval_us(0)
+, _scan_window_us(0)
+, _peer(-1)
+, _is_connected(false)
+, _peer_address{}
+, _role(BluetoothPlatform::connection_role_t::main)
+, _connect_error(0)
+, _stats{}
+{
+    address(index, _advertiser.address);
+
+    auto name = platform.deviceName();
+    auto length = std::min(strlen(name), MAX_NAME_LENGTH);
+    auto data = _advertiser.data;
+    data[0] = 2;
+    data[1] = AD_FLAGS;
+    data[2] = AD_FLAGS_LE_GENERAL_DISCOVERABLE_BR_EDR_NOT_SUPPORTED;
+    data[3] = static_cast<uint8_t>(length + 1);
+    data[4] = AD_COMPLETE_LOCAL_NAME;
+    memcpy(data + 5, name, length);
+    _advertiser.data_size = 5 + length;
+}
+
+void SimController::address(uint32_t index, uint8_t address[6])
+{
+    // Random static addresses d0:0d:xx:xx:xx:xx, from the index.
+    address[0] = static_cast<uint8_t>(index);
+    address[1] = static_cast<uint8_t>(index >> 8);
+    address[2] = static_cast<uint8_t>(index >> 16);
+    address[3] = static_cast<uint8_t>(index >> 24);
+    address[4] = 0x0d;
+    address[5] = 0xd0;
+}
+
+uint32_t SimController::index() const
+{
+    return _index;
+}
+
+SimController::Stats SimController::stats() const
+{
+    auto stats = _stats;
+    if (_is_scanning) {
+        stats.scan_ms += (nowUs() - _scan_start_us) / 1000;
+    }
+
+    return stats;
+}
+
+bool SimController::isScanning() const
+{
+    return _is_scanning;
+}
+
+uint64_t SimController::nextTransmissionUs() const
+{
+    return _is_advertising ? _next_event_us : UINT64_MAX;
+}
+
+void SimController::transmit(uint64_t beginUs, uint64_t endUs, std::vector<Packet> channels[3])
+{
+    if (!_is_advertising) {
+        return;
+    }
+
+    // Advertising started by the host during the previous window starts now.
+    _next_event_us = std::max(_next_event_us, beginUs);
+    auto airtime = airtimeUs(_advertiser);
+    std::uniform_int_distribution<uint32_t> adv_delay(0, MAX_ADV_DELAY_US);
+    while (_next_event_us < endUs) {
+        auto start = _next_event_us;
+        for (size_t channel = 0; channel < 3; channel++) {
+            channels[channel].push_back(Packet{start, start + airtime, this, false});
+            start += airtime + CHANNEL_GAP_US;
+        }
+
+        _stats.packets_sent += 3;
+        _next_event_us += _adv_interval_us + adv_delay(_random);
+    }
+}
+
+void SimController::receive(uint64_t beginUs, const std::vector<Packet> channels[3])
+{
+    if (!_is_scanning || _scan_start_us > beginUs) {
+        return;
+    }
+
+    // The last packets of an event may start after the window, so go up to the last packet.
+    uint64_t limit = beginUs;
+    for (size_t channel = 0; channel < 3; channel++) {
+        if (!channels[channel].empty()) {
+            limit = std::max(limit, channels[channel].back().start_us + 1);
+        }
+    }
+
+    // The scanner listens for scan_window at the start of each scan_interval, moving from channel 37 to 38 to 39.
+    auto now_ms = _queue.now();
+    for (auto k = (beginUs - _scan_start_us) / _scan_interval_us;; k++) {
+        auto window_start = _scan_start_us + k * _scan_interval_us;
+        auto window_end = window_start + _scan_window_us;
+        if (window_start >= limit) {
+            break;
+        }
+
+        auto &packets = channels[k % 3];
+        auto from = std::max(window_start, beginUs);
+        auto it = std::lower_bound(packets.begin(), packets.end(), from, [](const Packet &packet, uint64_t start) {
+            return packet.start_us < start;
+        });
+        for (; it != packets.end() && it->start_us < window_end; ++it) {
+            // Packets cut off by the end of the scan window are not heard at all.
+            if (it->source == this || it->end_us > window_end) {
+                continue;
+            }
+
+            if (it->collided) {
+                _stats.collided++;
+                continue;
+            }
+
+            _stats.heard++;
+            auto &advertiser = it->source->_advertiser;
+            if (_is_filtered && memcmp(advertiser.address, _filter_address, sizeof(_filter_address)) != 0) {
+                _stats.filtered++;
+                continue;
+            }
+
+            // Raised once the packet has been received, in the ms after its end.
+            Report report = { this, &advertiser };
+            auto delay = static_cast<uint32_t>((it->end_us + 999) / 1000 - now_ms);
+            _queue.call_in(delay, 0, &callReport, &report, sizeof(report));
+        }
+    }
+}
+
+void SimController::deliver(const Message &message)
+{
+    switch (message.type) {
+        case Message::type_t::connect:
+            // Only a connectable advertiser can be connected to, and it stops advertising when it is.
+            if (!_is_advertising || !_is_connectable || _peer >= 0) {
+                send(Message::type_t::reject, message.from, -ETIMEDOUT);
+                break;
+            }
+
+            _is_advertising = false;
+            _peer = message.from;
+            _role = BluetoothPlatform::connection_role_t::peripheral;
+            address(message.from, _peer_address);
+            send(Message::type_t::accept, message.from, 0);
+            _queue.call(&callConnected, this);
+            break;
+
+        case Message::type_t::accept:
+            if (_peer == message.from && !_is_connected) {
+                _queue.call(&callConnected, this);
+            }
+            break;
+
+        case Message::type_t::reject:
+            if (_peer == message.from && !_is_connected) {
+                _peer = -1;
+                _connect_error = message.value;
+                _queue.call(&callConnectionFailed, this);
+            }
+            break;
+
+        case Message::type_t::disconnect:
+            if (_peer == message.from) {
+                _peer = -1;
+                _is_connected = false;
+                _queue.call(&callDisconnected, this);
+            }
+            break;
+    }
+}
+
+void SimController::start()
+{
+    _queue.call_in(_start_delay_ms, &callInput, this);
+}
+
+const uint8_t *SimController::localAddress() const
+{
+    return _advertiser.address;
+}
+
+int SimController::takeFailure(const char *operation)
+{
+    for (auto unsupported : UNSUPPORTED_OPERATIONS) {
+        if (strcmp(operation, unsupported) == 0) {
+            return -ENOTSUP;
+        }
+    }
+
+    return 0;
+}
+
+void SimController::setScanning(bool scanning, const uint8_t *filterAddress)
+{
+    if (_is_scanning) {
+        _stats.scan_ms += (nowUs() - _scan_start_us) / 1000;
+    }
+
+    _is_scanning = scanning;
+    _is_filtered = filterAddress != nullptr;
+    if (_is_filtered) {
+        memcpy(_filter_address, filterAddress, sizeof(_filter_address));
+    }
+
+    if (scanning) {
+        _scan_start_us = nowUs();
+        _scan_interval_us = _platform.params().scan_interval * 1000;
+        _scan_window_us = std::min(_platform.params().scan_window, _platform.params().scan_interval) * 1000;
+    }
+}
+
+void SimController::setAdvertising(bool advertising, bool periodic)
+{
+    // Periodic advertising is modelled by its legacy advertising alone.
+    _is_advertising = advertising;
+    _is_connectable = !periodic;
+    if (advertising) {
+        _adv_interval_us = _platform.params().adv_interval * 1000;
+        _next_event_us = nowUs();
+    }
+}
+
+void SimController::connect(const uint8_t *peer, uint32_t intervalMs)
+{
+    // Peers have addresses from address(), and anything else cannot be found.
+    uint32_t index = peer[0] | peer[1] << 8 | peer[2] << 16 | static_cast<uint32_t>(peer[3]) << 24;
+    _role = BluetoothPlatform::connection_role_t::main;
+    _is_connected = false;
+    memcpy(_peer_address, peer, sizeof(_peer_address));
+    uint8_t expected[6];
+    address(index, expected);
+    if (memcmp(peer, expected, sizeof(expected)) != 0) {
+        _connect_error = -ETIMEDOUT;
+        _queue.call(&callConnectionFailed, this);
+        return;
+    }
+
+    _peer = index;
+    send(Message::type_t::connect, index, static_cast<int32_t>(intervalMs));
+}
+
+void SimController::disconnect()
+{
+    if (_peer >= 0) {
+        send(Message::type_t::disconnect, static_cast<uint32_t>(_peer), 0);
+    }
+
+    _peer = -1;
+    _is_connected = false;
+    _queue.call(&callDisconnected, this);
+}
+
+void SimController::sync(const uint8_t * /* peer */, uint8_t /* sid */)
+{
+    // takeFailure() refuses syncs.
+}
+
+void SimController::stopSync()
+{
+}
+
+void SimController::requestPhy(BluetoothPlatform::phy_t /* phy */, uint32_t /* intervalMs */)
+{
+    // takeFailure() refuses PHY updates.
+}
+
+void SimController::exchangeMtu(uint32_t /* intervalMs */)
+{
+    // takeFailure() refuses throughput runs and workloads.
+}
+
+uint64_t SimController::nowUs() const
+{
+    return _queue.now() * 1000;
+}
+
+void SimController::send(Message::type_t type, uint32_t to, int32_t value)
+{
+    _outbox.push_back(Message{type, _index, to, value});
+}
+
+void SimController::callInput(void *arg)
+{
+    // One character at a time, each after what the previous one has queued, as an operator would type them.
+    auto self = reinterpret_cast<SimController *>(arg);
+    if (self->_input_position < self->_input.size()) {
+        self->_host.onInput(static_cast<unsigned char>(self->_input[self->_input_position++]));
+        self->_queue.call(&callInput, self);
+    }
+}
+
+void SimController::callReport(void *arg)
+{
+    auto report = reinterpret_cast<Report *>(arg);
+    auto self = report->self;
+
+    // Reports queued before the host stopped scanning are dropped.
+    if (!self->_is_scanning) {
+        return;
+    }
+
+    self->_stats.reports++;
+    self->_host.onReport(*report->advertiser);
+}
+
+void SimController::callConnected(void *arg)
+{
+    auto self = reinterpret_cast<SimController *>(arg);
+    self->_is_connected = true;
+    self->_host.onConnected(self->_peer_address, self->_role);
+}
+
+void SimController::callConnectionFailed(void *arg)
+{
+    auto self = reinterpret_cast<SimController *>(arg);
+    self->_host.onConnectionFailed(self->_connect_error);
+}
+
+void SimController::callDisconnected(void *arg)
+{
+    auto self = reinterpret_cast<SimController *>(arg);
+    self->_host.onDisconnected();
+}
@@ -0,0 +1,392 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <thread>
+
+#include <Simulation.h>
+
+// Longest time which the states may last, from bt_test_params.h.
+static constexpr uint32_t MAX_STATE_TIME = 655350;
+
+// Devices start at random within this time, so that their advertising events are not aligned.
+static constexpr uint32_t START_SPREAD_MS = 1000;
+
+// Spins of Barrier::wait() before it yields.
+static constexpr uint32_t BARRIER_SPINS = 1000;
+
+Simulation::Device::Device(
+    const char *name,
+    uint32_t index,
+    std::string input,
+    uint32_t startDelayMs,
+    uint32_t seed,
+    std::vector<SimController::Message> &outbox
+)
+: platform(name)
+, controller(platform, index, std::move(input), startDelayMs, seed, outbox)
+, test(platform)
+, role(nullptr)
+, adv_interval_ms(0)
+{
+    platform.setController(controller);
+}
+
+Simulation::Barrier::Barrier(uint32_t threads)
+: _threads(threads)
+, _count(0)
+, _generation(0)
+{}
+
+void Simulation::Barrier::wait()
+{
+    auto generation = _generation.load(std::memory_order_acquire);
+    if (_count.fetch_add(1, std::memory_order_acq_rel) + 1 == _threads) {
+        _count.store(0, std::memory_order_relaxed);
+        _generation.fetch_add(1, std::memory_order_release);
+        return;
+    }
+
+    for (uint32_t spins = 0; _generation.load(std::memory_order_acquire) == generation; spins++) {
+        if (spins >= BARRIER_SPINS) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+Simulation::Simulation(const Options &options)
+: _options(options)
+, _workers(std::max(std::min(options.threads, options.devices), 1U))
+, _barrier(static_cast<uint32_t>(_workers.size()))
+, _carried_end_us{}
+, _packets{}
+, _collided{}
+, _wall_time_s(0)
+{
+    auto threads = _workers.size();
+    auto state_time = std::to_string(std::min(options.duration_ms, MAX_STATE_TIME));
+    std::string common;
+    for (auto &parameter : options.parameters) {
+        common += "t" + parameter + "\n";
+    }
+
+    // The scanners look for the first peer, by MAC if filtering, or for an address which no device has.
+    uint8_t target[6];
+    SimController::address(options.peers > 0 ? options.scanners : UINT32_MAX, target);
+    char target_mac[13];
+    snprintf(
+        target_mac,
+        sizeof(target_mac),
+        "%02x%02x%02x%02x%02x%02x",
+        target[5],
+        target[4],
+        target[3],
+        target[2],
+        target[1],
+        target[0]
+    );
+
+    std::minstd_rand random(options.seed);
+    std::uniform_int_distribution<uint32_t> start_delay(0, START_SPREAD_MS - 1);
+    _names.reserve(options.devices);
+    _devices.reserve(options.devices);
+    for (uint32_t i = 0; i < options.devices; i++) {
+        auto input = common;
+        const char *role;
+        uint32_t interval = 0;
+        if (i < options.scanners) {
+            _names.push_back(HostBluetoothPlatform::DEFAULT_DEVICE_NAME);
+            role = "scanner";
+            input += "tscan_time " + state_time + "\n";
+            if (options.filter) {
+                input += std::string("m") + target_mac + "\n";
+            }
+            input += "s";
+        } else {
+            auto advertiser = i - options.scanners;
+            auto is_peer = advertiser < options.peers;
+            _names.push_back(is_peer ? HostBluetoothPlatform::DEFAULT_DEVICE_NAME : "Advertiser " + std::to_string(i));
+            role = is_peer ? "peer" : "advertiser";
+            interval = options.intervals[advertiser % options.intervals.size()];
+            input += "tadv_interval " + std::to_string(interval) + "\n";
+            input += "tadvertise_time " + state_time + "\n";
+            input += "a";
+        }
+
+        _devices.emplace_back(
+            new Device(
+                _names.back().c_str(),
+                i,
+                input,
+                start_delay(random),
+                options.seed * 7919 + i,
+                _workers[i % threads].sent
+            )
+        );
+        _devices.back()->role = role;
+        _devices.back()->adv_interval_ms = interval;
+        _devices.back()->platform.setOutput(static_cast<int64_t>(i) == options.verbose ? stderr : nullptr);
+    }
+}
+
+Simulation::~Simulation()
+{
+}
+
+void Simulation::run()
+{
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < _devices.size(); i++) {
+        _devices[i]->test.start();
+        updateSlot(i % _workers.size(), i);
+    }
+
+    std::vector<std::thread> threads;
+    for (uint32_t worker = 1; worker < _workers.size(); worker++) {
+        threads.emplace_back(&Simulation::work, this, worker);
+    }
+
+    work(0);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    // Idle devices are skipped, so bring every clock to the end.
+    for (auto &device : _devices) {
+        device->platform.eventQueue().dispatch_once(_options.duration_ms);
+    }
+
+    _wall_time_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Simulation::work(uint32_t worker)
+{
+    auto &own = _workers[worker];
+    auto threads = static_cast<uint32_t>(_workers.size());
+    auto devices = static_cast<uint32_t>(_devices.size());
+    std::vector<SimController::Message> inbox;
+    for (uint64_t begin = 0; begin < _options.duration_ms; begin += _options.lookahead_ms) {
+        auto end = std::min<uint64_t>(begin + _options.lookahead_ms, _options.duration_ms);
+
+        // Deliver the messages sent during the previous window, in the order of the senders whatever the threads, and
+        // put the packets of the window on the channels.
+        inbox.clear();
+        for (auto &other : _workers) {
+            for (auto &message : other.outbox) {
+                if (message.to < devices && message.to % threads == worker) {
+                    inbox.push_back(message);
+                } else if (message.to >= devices && message.from % threads == worker) {
+                    // Nobody has the address: the attempt to connect times out.
+                    inbox.push_back(
+                        SimController::Message{
+                            SimController::Message::type_t::reject,
+                            message.to,
+                            message.from,
+                            -ETIMEDOUT
+                        }
+                    );
+                }
+            }
+        }
+
+        std::stable_sort(
+            inbox.begin(),
+            inbox.end(),
+            [](const SimController::Message &a, const SimController::Message &b) { return a.from < b.from; }
+        );
+        for (auto &message : inbox) {
+            // The clock of a device which has been skipped is behind.
+            auto &device = *_devices[message.to];
+            device.platform.eventQueue().dispatch_once(begin);
+            device.controller.deliver(message);
+            updateSlot(worker, message.to);
+        }
+
+        for (auto &packets : own.packets) {
+            packets.clear();
+        }
+
+        for (auto i = worker, slot = 0U; i < devices; i += threads, slot++) {
+            if (own.slots[slot].next_transmission_us < end * 1000) {
+                _devices[i]->controller.transmit(begin * 1000, end * 1000, own.packets);
+                own.slots[slot].next_transmission_us = _devices[i]->controller.nextTransmissionUs();
+            }
+        }
+
+        _barrier.wait();
+
+        for (auto channel = worker; channel < 3; channel += threads) {
+            resolve(channel);
+        }
+
+        _barrier.wait();
+
+        // Scanners hear the window's packets, then the hosts run up to the end of the window.
+        for (auto i = worker, slot = 0U; i < devices; i += threads, slot++) {
+            if (!own.slots[slot].is_scanning && own.slots[slot].next_event_ms > end) {
+                continue;
+            }
+
+            auto &device = *_devices[i];
+            auto &queue = device.platform.eventQueue();
+            queue.dispatch_once(begin);
+            device.controller.receive(begin * 1000, _channels);
+            while (queue.dispatch_once(end)) {
+            }
+
+            updateSlot(worker, i);
+        }
+
+        own.outbox.swap(own.sent);
+        own.sent.clear();
+        _barrier.wait();
+    }
+}
+
+void Simulation::updateSlot(uint32_t worker, uint32_t device)
+{
+    auto &slots = _workers[worker].slots;
+    auto slot = device / _workers.size();
+    if (slot >= slots.size()) {
+        slots.resize(slot + 1);
+    }
+
+    auto &controller = _devices[device]->controller;
+    slots[slot].next_transmission_us = controller.nextTransmissionUs();
+    slots[slot].next_event_ms = _devices[device]->platform.eventQueue().next();
+    slots[slot].is_scanning = controller.isScanning();
+}
+
+void Simulation::resolve(size_t channel)
+{
+    auto &packets = _channels[channel];
+    packets.clear();
+    for (auto &worker : _workers) {
+        packets.insert(packets.end(), worker.packets[channel].begin(), worker.packets[channel].end());
+    }
+
+    std::sort(packets.begin(), packets.end(), [](const SimController::Packet &a, const SimController::Packet &b) {
+        return a.start_us != b.start_us ? a.start_us < b.start_us : a.source->index() < b.source->index();
+    });
+
+    // A packet which starts before the end of an earlier one collides with it, and so with the one which ends last.
+    auto last_end = _carried_end_us[channel];
+    SimController::Packet *last = nullptr;
+    for (auto &packet : packets) {
+        if (packet.start_us < last_end) {
+            packet.collided = true;
+            if (last != nullptr) {
+                last->collided = true;
+            }
+        }
+
+        if (packet.end_us > last_end) {
+            last_end = packet.end_us;
+            last = &packet;
+        }
+    }
+
+    _carried_end_us[channel] = last_end;
+    _packets[channel] += packets.size();
+    _collided[channel] += std::count_if(packets.begin(), packets.end(), [](const SimController::Packet &packet) {
+        return packet.collided;
+    });
+}
+
+void Simulation::printStats(FILE *out) const
+{
+    fprintf(
+        out,
+        "device,address,name,role,adv_interval_ms,packets_sent,heard,collided,filtered,reports,scan_s,report_rate,"
+        "wakeups,wakeup_rate\n"
+    );
+
+    auto duration_s = _options.duration_ms / 1000.0;
+    uint64_t scanner_reports = 0;
+    uint64_t scanner_wakeups = 0;
+    double scanner_time_s = 0;
+    for (auto &device : _devices) {
+        auto stats = device->controller.stats();
+        auto wakeup_stats = device->platform.getWakeupStats();
+        auto wakeups = static_cast<uint64_t>(wakeup_stats.uncoalesced) + wakeup_stats.coalesced;
+        auto scan_s = stats.scan_ms / 1000.0;
+        uint8_t address[6];
+        SimController::address(device->controller.index(), address);
+        fprintf(
+            out,
+            "%" PRIu32 ",%02x:%02x:%02x:%02x:%02x:%02x,%s,%s,%" PRIu32 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+            ",%" PRIu64 ",%.3f,%.2f,%" PRIu64 ",%.2f\n",
+            device->controller.index(),
+            address[5],
+            address[4],
+            address[3],
+            address[2],
+            address[1],
+            address[0],
+            device->platform.deviceName(),
+            device->role,
+            device->adv_interval_ms,
+            stats.packets_sent,
+            stats.heard,
+            stats.collided,
+            stats.filtered,
+            stats.reports,
+            scan_s,
+            scan_s > 0 ? stats.reports / scan_s : 0.0,
+            wakeups,
+            wakeups / duration_s
+        );
+
+        if (device->controller.index() < _options.scanners) {
+            scanner_reports += stats.reports;
+            scanner_wakeups += wakeups;
+            scanner_time_s += scan_s;
+        }
+    }
+
+    uint64_t packets = _packets[0] + _packets[1] + _packets[2];
+    uint64_t collided = _collided[0] + _collided[1] + _collided[2];
+    fprintf(
+        stderr,
+        "Simulated %zu devices for %.1f s in %.2f s on %zu threads: %" PRIu64 " packets, %.1f%% collided\n",
+        _devices.size(),
+        duration_s,
+        _wall_time_s,
+        _workers.size(),
+        packets,
+        packets ? collided * 100.0 / packets : 0.0
+    );
+    if (_options.scanners > 0) {
+        fprintf(
+            stderr,
+            "Scanners: %.2f reports/s while scanning, %.2f host wakeups/s on average\n",
+            scanner_time_s > 0 ? scanner_reports / scanner_time_s : 0.0,
+            scanner_wakeups / duration_s / _options.scanners
+        );
+    }
+
+    if (collided * 100 > packets * 99) {
+        fprintf(stderr, "The channels are saturated: use fewer devices or longer advertising intervals\n");
+    }
+}
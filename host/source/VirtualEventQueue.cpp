@@ -0,0 +1,223 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <chrono>
+
+#include <VirtualEventQueue.h>
+
+bool VirtualEventQueue::Key::operator<(const Key &other) const
+{
+    if (latest != other.latest) {
+        return latest < other.latest;
+    }
+
+    // Sequence numbers wrap, so compare their difference rather than their values.
+    return static_cast<int32_t>(sequence - other.sequence) < 0;
+}
+
+VirtualEventQueue::VirtualEventQueue()
+: _now(0)
+, _sequence(0)
+, _next_id(1)
+, _current(0)
+, _current_cancelled(false)
+, _wakeup_stats{}
+#if CONFIG_SCHED_STATS
+, _sched_stats{}
+#endif
+{}
+
+int VirtualEventQueue::call(callback_t fn, void *arg)
+{
+    return call_in(0, 0, fn, arg);
+}
+
+int VirtualEventQueue::call_in(uint32_t millis, callback_t fn, void *arg)
+{
+    return call_in(millis, 0, fn, arg);
+}
+
+int VirtualEventQueue::call_in(uint32_t millis, uint32_t slack, callback_t fn, void *arg)
+{
+    Event event = {};
+    event.fn = fn;
+    event.arg = arg;
+    event.deadline = _now + millis;
+    event.latest = event.deadline + slack;
+    return schedule(event);
+}
+
+int VirtualEventQueue::call_in(uint32_t millis, uint32_t slack, callback_t fn, const void *payload, size_t size)
+{
+    assert(size <= PAYLOAD_SIZE);
+    Event event = {};
+    event.fn = fn;
+    event.deadline = _now + millis;
+    event.latest = event.deadline + slack;
+    event.has_payload = true;
+    memcpy(event.payload, payload, size);
+    return schedule(event);
+}
+
+int VirtualEventQueue::call_every(uint32_t period, callback_t fn, void *arg)
+{
+    if (period == 0) {
+        return 0;
+    }
+
+    Event event = {};
+    event.fn = fn;
+    event.arg = arg;
+    event.deadline = _now + period;
+    event.latest = event.deadline;
+    event.period = period;
+    return schedule(event);
+}
+
+bool VirtualEventQueue::cancel(int id)
+{
+    auto it = _events.find(id);
+    if (it == _events.end()) {
+        return false;
+    }
+
+    // A recurring event which is running is not in _order; dispatch_once() must not put it back.
+    if (id == _current) {
+        _current_cancelled = true;
+    } else {
+        _order.erase(Key{it->second.latest, it->second.sequence, id});
+    }
+
+    _events.erase(it);
+    return true;
+}
+
+uint64_t VirtualEventQueue::now() const
+{
+    return _now;
+}
+
+uint64_t VirtualEventQueue::next() const
+{
+    return _order.empty() ? UINT64_MAX : _order.begin()->latest;
+}
+
+bool VirtualEventQueue::dispatch_once(uint64_t until)
+{
+    if (_order.empty() || _order.begin()->latest > until) {
+        _now = until > _now ? until : _now;
+        return false;
+    }
+
+    // Jump to the wakeup. Events which became due before it share it.
+    if (_order.begin()->latest > _now) {
+        _now = _order.begin()->latest;
+    }
+
+    // Only events pulled forward by their slack share the wakeup: those due at the same time would have run
+    // together anyway.
+    uint32_t early_count = 0;
+    for (bool early; runDue(early);) {
+        early_count += early;
+    }
+
+    if (early_count > 0) {
+        _wakeup_stats.coalesced++;
+        _wakeup_stats.coalesced_events += early_count;
+    } else {
+        _wakeup_stats.uncoalesced++;
+    }
+
+    return true;
+}
+
+VirtualEventQueue::WakeupStats VirtualEventQueue::wakeupStats() const
+{
+    return _wakeup_stats;
+}
+
+#if CONFIG_SCHED_STATS
+const SchedulerStats &VirtualEventQueue::schedulerStats() const
+{
+    return _sched_stats;
+}
+#endif
+
+int VirtualEventQueue::schedule(const Event &event)
+{
+    auto id = _next_id;
+    _next_id = _next_id == INT32_MAX ? 1 : _next_id + 1;
+
+    auto &stored = _events[id];
+    stored = event;
+    stored.sequence = _sequence++;
+    _order.insert(Key{stored.latest, stored.sequence, id});
+    return id;
+}
+
+bool VirtualEventQueue::runDue(bool &early)
+{
+    // The first event in order whose deadline has passed. Events with slack may be behind ones which are not due yet.
+    auto key = _order.begin();
+    while (key != _order.end() && _events[key->id].deadline > _now) {
+        ++key;
+    }
+
+    if (key == _order.end()) {
+        return false;
+    }
+
+    auto id = key->id;
+    _order.erase(key);
+    auto it = _events.find(id);
+    Event event = it->second;
+    early = event.latest > _now;
+    if (event.period == 0) {
+        _events.erase(it);
+    }
+
+    // A one-shot event's payload is copied out of the queue, so it stays valid until the callback returns even if the
+    // callback schedules more events.
+    _current = id;
+    _current_cancelled = false;
+    void *arg = event.has_payload ? event.payload : event.arg;
+#if CONFIG_SCHED_STATS
+    _sched_stats.lateness.record(static_cast<uint32_t>((_now - event.deadline) * 1000));
+    auto start = std::chrono::steady_clock::now();
+#endif
+    event.fn(arg);
+#if CONFIG_SCHED_STATS
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    _sched_stats.duration.record(static_cast<uint32_t>(duration.count()));
+#endif
+    _current = 0;
+
+    // Each deadline of a recurring event is a whole number of periods after the first.
+    if (event.period != 0 && !_current_cancelled) {
+        auto &stored = _events[id];
+        stored.deadline += stored.period;
+        stored.latest = stored.deadline;
+        stored.sequence = _sequence++;
+        _order.insert(Key{stored.latest, stored.sequence, id});
+    }
+
+    return true;
+}
@@ -0,0 +1,82 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <FakeController.h>
+#include <HostBluetoothPlatform.h>
+#include <PowerConsumptionTest.h>
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-u <ms>] <script|->\n", program);
+    fprintf(stderr, "  -u <ms>  stop once the virtual clock reaches <ms>\n");
+    fprintf(stderr, "  script   controller script, or - to read it from stdin\n");
+}
+
+int main(int argc, char **argv)
+{
+    static HostBluetoothPlatform platform;
+    static FakeController controller(platform.eventQueue(), platform);
+    platform.setController(controller);
+    const char *path = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+            char *end;
+            auto limit = strtoull(argv[++i], &end, 10);
+            if (*end != '\0') {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            platform.setTimeLimit(limit);
+        } else if (path == nullptr && (argv[i][0] != '-' || strcmp(argv[i], "-") == 0)) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (path == nullptr) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    bool loaded;
+    if (strcmp(path, "-") == 0) {
+        loaded = controller.load(stdin, "<stdin>");
+    } else {
+        FILE *file = fopen(path, "r");
+        if (file == nullptr) {
+            perror(path);
+            return EXIT_FAILURE;
+        }
+        loaded = controller.load(file, path);
+        fclose(file);
+    }
+
+    if (!loaded) {
+        return EXIT_FAILURE;
+    }
+
+    // Does not return: the event loop exits the process.
+    PowerConsumptionTest app(platform);
+    app.run();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,127 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+
+#include <Simulation.h>
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [options] > stats.csv\n", program);
+    fprintf(stderr, "  -n <count>       devices (default 1000)\n");
+    fprintf(stderr, "  -s <count>       of which scanners, the others advertise (default 1)\n");
+    fprintf(stderr, "  -c <count>       advertisers which the scanners look for and connect to (default 0)\n");
+    fprintf(stderr, "  -i <ms,...>      advertising intervals of the advertisers, in turn (default 100,250,1000)\n");
+    fprintf(stderr, "  -m               scanners match by MAC, so that the controller filters other reports\n");
+    fprintf(stderr, "  -p <name=value>  set a test parameter on every device, e.g. scan_window=5 (repeatable)\n");
+    fprintf(stderr, "  -t <s>           simulated time (default 60)\n");
+    fprintf(stderr, "  -l <ms>          lookahead between synchronisations of the threads (default 10)\n");
+    fprintf(stderr, "  -j <threads>     worker threads (default: one per core)\n");
+    fprintf(stderr, "  -r <seed>        random seed (default 1)\n");
+    fprintf(stderr, "  -v <device>      print the output of a device to stderr\n");
+}
+
+// Parse a decimal number which must fit in 32 bits and be at least min.
+static bool parseNumber(const char *text, uint32_t min, uint32_t &value)
+{
+    char *end;
+    auto parsed = strtoull(text, &end, 10);
+    if (end == text || *end != '\0' || parsed > UINT32_MAX || parsed < min) {
+        return false;
+    }
+
+    value = static_cast<uint32_t>(parsed);
+    return true;
+}
+
+static bool parseIntervals(const char *text, std::vector<uint32_t> &intervals)
+{
+    intervals.clear();
+    std::string list(text);
+    size_t start = 0;
+    while (start <= list.size()) {
+        auto comma = list.find(',', start);
+        auto item = list.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        uint32_t interval;
+        if (!parseNumber(item.c_str(), 20, interval)) {
+            return false;
+        }
+
+        intervals.push_back(interval);
+        if (comma == std::string::npos) {
+            break;
+        }
+        start = comma + 1;
+    }
+
+    return !intervals.empty();
+}
+
+int main(int argc, char **argv)
+{
+    Simulation::Options options;
+    options.threads = std::max(std::thread::hardware_concurrency(), 1U);
+
+    int opt;
+    bool ok = true;
+    uint32_t value = 0;
+    while (ok && (opt = getopt(argc, argv, "n:s:c:i:mp:t:l:j:r:v:")) != -1) {
+        switch (opt) {
+            case 'n': ok = parseNumber(optarg, 1, options.devices); break;
+            case 's': ok = parseNumber(optarg, 0, options.scanners); break;
+            case 'c': ok = parseNumber(optarg, 0, options.peers); break;
+            case 'i': ok = parseIntervals(optarg, options.intervals); break;
+            case 'm': options.filter = true; break;
+            case 'l': ok = parseNumber(optarg, 1, options.lookahead_ms); break;
+            case 'j': ok = parseNumber(optarg, 1, options.threads); break;
+            case 'r': ok = parseNumber(optarg, 0, options.seed); break;
+            case 'v': ok = parseNumber(optarg, 0, value); options.verbose = value; break;
+            case 't':
+                ok = parseNumber(optarg, 1, value) && value <= UINT32_MAX / 1000;
+                options.duration_ms = value * 1000;
+                break;
+            case 'p': {
+                // The t command takes "<name> <value>".
+                std::string parameter(optarg);
+                auto equals = parameter.find('=');
+                ok = equals != std::string::npos;
+                if (ok) {
+                    parameter[equals] = ' ';
+                    options.parameters.push_back(parameter);
+                }
+                break;
+            }
+            default: ok = false; break;
+        }
+    }
+
+    if (!ok || optind != argc || options.scanners + options.peers > options.devices) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Simulation simulation(options);
+    simulation.run();
+    simulation.printStats(stdout);
+    return EXIT_SUCCESS;
+}
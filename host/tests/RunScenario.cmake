@@ -0,0 +1,30 @@
+# Copyright (c) 2021 ARM Limited. All rights reserved.
+# SPDX-License-Identifier: Apache-2.0
+
+# Runs the host program on a script and checks that its output matches each line of the expected file, a regular
+# expression, in order. Usage: cmake -DPROGRAM=<program> -DSCRIPT=<script> -DEXPECTED=<file> -P RunScenario.cmake
+
+execute_process(
+    COMMAND ${PROGRAM} ${SCRIPT}
+    OUTPUT_VARIABLE output
+    ERROR_VARIABLE output
+    RESULT_VARIABLE result
+)
+message("${output}")
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${PROGRAM} ${SCRIPT} exited with ${result}")
+endif()
+
+file(STRINGS ${EXPECTED} expected_lines)
+foreach(expected IN LISTS expected_lines)
+    string(REGEX MATCH "${expected}" match "${output}")
+    if(match STREQUAL "")
+        message(FATAL_ERROR "Missing, or out of order: ${expected}")
+    endif()
+
+    # Carry on after the match, so that the next line must come later.
+    string(FIND "${output}" "${match}" position)
+    string(LENGTH "${match}" length)
+    math(EXPR position "${position} + ${length}")
+    string(SUBSTRING "${output}" ${position} -1 output)
+endforeach()
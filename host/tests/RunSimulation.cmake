@@ -0,0 +1,20 @@
+# Copyright (c) 2021 ARM Limited. All rights reserved.
+# SPDX-License-Identifier: Apache-2.0
+
+# Runs a small simulation on one and on several threads and checks that the statistics are the same, as they must be
+# whatever the number of threads. Usage: cmake -DPROGRAM=<simulation> -P RunSimulation.cmake
+
+set(arguments -n 300 -s 5 -c 2 -t 20)
+execute_process(COMMAND ${PROGRAM} ${arguments} -j 1 OUTPUT_VARIABLE single RESULT_VARIABLE single_result)
+execute_process(COMMAND ${PROGRAM} ${arguments} -j 3 OUTPUT_VARIABLE multiple RESULT_VARIABLE multiple_result)
+if(NOT single_result EQUAL 0 OR NOT multiple_result EQUAL 0)
+    message(FATAL_ERROR "${PROGRAM} failed")
+endif()
+
+if(NOT single MATCHES "^device,address,name,role,")
+    message(FATAL_ERROR "No CSV header in:\n${single}")
+endif()
+
+if(NOT single STREQUAL multiple)
+    message(FATAL_ERROR "The statistics depend on the number of threads")
+endif()
@@ -0,0 +1,186 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Order of the events of the virtual event queue, which follows the Zephyr EventQueue: by latest time, then by the
+// order of scheduling, with wakeups shared by the events whose windows overlap, and recurring calls which stay on a
+// whole number of periods from the first.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <VirtualEventQueue.h>
+
+#include "TestCheck.h"
+
+namespace {
+
+struct Call {
+    char name;
+    uint64_t time;
+};
+
+struct Recorder {
+    VirtualEventQueue queue;
+    std::vector<Call> calls;
+};
+
+struct Tag {
+    Recorder *recorder;
+    char name;
+};
+
+void record(void *arg)
+{
+    auto tag = static_cast<Tag *>(arg);
+    tag->recorder->calls.push_back(Call{tag->name, tag->recorder->queue.now()});
+}
+
+// Run the queue up to until and return the calls as "<name>@<ms>" separated by spaces.
+std::string run(Recorder &recorder, uint64_t until)
+{
+    while (recorder.queue.dispatch_once(until)) {
+    }
+
+    std::string calls;
+    for (auto &call : recorder.calls) {
+        calls += (calls.empty() ? "" : " ") + std::string(1, call.name) + "@" + std::to_string(call.time);
+    }
+    recorder.calls.clear();
+    return calls;
+}
+
+void checkString(const std::string &actual, const char *expected, int line)
+{
+    if (actual != expected) {
+        fprintf(stderr, "%s:%d: got \"%s\", expected \"%s\"\n", __FILE__, line, actual.c_str(), expected);
+        test_failures++;
+    }
+}
+
+#define CHECK_CALLS(recorder, until, expected) checkString(run(recorder, until), expected, __LINE__)
+
+void checkOrdering()
+{
+    Recorder recorder;
+    Tag a = { &recorder, 'a' }, b = { &recorder, 'b' }, c = { &recorder, 'c' }, d = { &recorder, 'd' };
+    recorder.queue.call_in(50, &record, &a);
+    recorder.queue.call_in(10, &record, &b);
+    recorder.queue.call_in(30, &record, &c);
+    recorder.queue.call_in(10, &record, &d);
+    CHECK_CALLS(recorder, 100, "b@10 d@10 c@30 a@50");
+    CHECK(recorder.queue.now() == 100);
+
+    // Events due at the same time share a wakeup without it counting as coalesced.
+    auto stats = recorder.queue.wakeupStats();
+    CHECK(stats.uncoalesced == 3);
+    CHECK(stats.coalesced == 0);
+
+    // call() runs at the current time after what is already due, and a cancelled event never runs.
+    recorder.queue.call_in(0, &record, &a);
+    recorder.queue.call(&record, &b);
+    auto id = recorder.queue.call_in(5, &record, &c);
+    CHECK(recorder.queue.cancel(id));
+    CHECK(!recorder.queue.cancel(id));
+    CHECK(!recorder.queue.cancel(0));
+    CHECK_CALLS(recorder, 200, "a@100 b@100");
+    CHECK(recorder.queue.next() == UINT64_MAX);
+}
+
+void checkSlack()
+{
+    Recorder recorder;
+    Tag a = { &recorder, 'a' }, b = { &recorder, 'b' }, c = { &recorder, 'c' };
+
+    // a may run from 20 to 50, so it shares b's wakeup at 40, after b whose latest time is earlier. c's window starts
+    // after that wakeup, so it runs at the end of its slack.
+    recorder.queue.call_in(20, 30, &record, &a);
+    recorder.queue.call_in(40, 0, &record, &b);
+    recorder.queue.call_in(45, 20, &record, &c);
+    CHECK(recorder.queue.next() == 40);
+    CHECK_CALLS(recorder, 100, "b@40 a@40 c@65");
+
+    auto stats = recorder.queue.wakeupStats();
+    CHECK(stats.coalesced == 1);
+    CHECK(stats.coalesced_events == 1);
+    CHECK(stats.uncoalesced == 1);
+}
+
+void checkPayload()
+{
+    Recorder recorder;
+    Tag tag = { &recorder, 'p' };
+    recorder.queue.call_in(5, 0, &record, &tag, sizeof(tag));
+
+    // The payload was copied, so changing the original doesn't change the call.
+    tag.name = 'x';
+    CHECK_CALLS(recorder, 10, "p@5");
+}
+
+struct Ticker {
+    Recorder *recorder;
+    int id;
+    int remaining;
+};
+
+void tick(void *arg)
+{
+    auto ticker = static_cast<Ticker *>(arg);
+    ticker->recorder->calls.push_back(Call{'t', ticker->recorder->queue.now()});
+    if (--ticker->remaining == 0) {
+        ticker->recorder->queue.cancel(ticker->id);
+    }
+}
+
+void checkEvery()
+{
+    Recorder recorder;
+    CHECK(recorder.queue.call_every(0, &record, nullptr) == 0);
+
+    // Start off the origin, with other events pulling wakeups around, and stop from the callback.
+    CHECK_CALLS(recorder, 7, "");
+    Ticker ticker = { &recorder, 0, 5 };
+    ticker.id = recorder.queue.call_every(30, &tick, &ticker);
+    CHECK(ticker.id != 0);
+    Tag a = { &recorder, 'a' }, b = { &recorder, 'b' };
+    recorder.queue.call_in(25, 20, &record, &a);
+    recorder.queue.call_in(81, 0, &record, &b);
+    CHECK_CALLS(recorder, 1000, "t@37 a@37 t@67 b@88 t@97 t@127 t@157");
+    CHECK(!recorder.queue.cancel(ticker.id));
+
+    // Many periods on, the calls are still a whole number of periods from the first.
+    Ticker long_ticker = { &recorder, 0, 1000 };
+    long_ticker.id = recorder.queue.call_every(7, &tick, &long_ticker);
+    run(recorder, 1000 + 7 * 999);
+    CHECK(recorder.queue.now() == 1000 + 7 * 999);
+    recorder.queue.call_in(0, &record, &a);
+    CHECK_CALLS(recorder, UINT64_MAX - 1, "a@7993 t@8000");
+}
+
+} // namespace
+
+int main()
+{
+    checkOrdering();
+    checkSlack();
+    checkPayload();
+    checkEvery();
+    return test_result("event_queue");
+}
@@ -0,0 +1,114 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Lookup of the local name in advertising data which is well formed, truncated or malformed. The name must never be
+// read from outside the payload.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <BluetoothPlatform.h>
+
+#include "TestCheck.h"
+
+namespace {
+
+const uint8_t ADDRESS[6] = { 1, 2, 3, 4, 5, 6 };
+
+// Look up the name in the first size bytes of a copy of payload placed at the end of a buffer, so that reading past
+// the payload would show up under a sanitiser, and check that any name found lies within it.
+bool findName(const uint8_t *payload, size_t size, const char *&name, size_t &length)
+{
+    static uint8_t buffer[64];
+    auto copy = buffer + sizeof(buffer) - size;
+    if (size > 0) {
+        memcpy(copy, payload, size);
+    }
+
+    BluetoothPlatform::AdvertisingReportEvent event(0, 0, ADDRESS, sizeof(ADDRESS), copy, size, false, 0);
+    if (!event.findLocalName(name, length)) {
+        return false;
+    }
+
+    auto start = reinterpret_cast<const uint8_t *>(name);
+    CHECK(start >= copy && start + length <= copy + size);
+    return true;
+}
+
+bool hasName(const uint8_t *payload, size_t size, const char *expected)
+{
+    const char *name;
+    size_t length;
+    return findName(payload, size, name, length) && length == strlen(expected) && memcmp(name, expected, length) == 0;
+}
+
+bool hasNoName(const uint8_t *payload, size_t size)
+{
+    const char *name;
+    size_t length;
+    return !findName(payload, size, name, length);
+}
+
+} // namespace
+
+int main()
+{
+    // Flags, manufacturer data, then the complete local name.
+    static const uint8_t complete[] = {
+        0x02, 0x01, 0x06,
+        0x04, 0xff, 0x59, 0x00, 0x01,
+        0x06, 0x09, 'P', 'o', 'w', 'e', 'r',
+    };
+    CHECK(hasName(complete, sizeof(complete), "Power"));
+
+    // The name found first wins, whether shortened or complete.
+    static const uint8_t shortened[] = {
+        0x04, 0x08, 'P', 'o', 'w',
+        0x06, 0x09, 'P', 'o', 'w', 'e', 'r',
+    };
+    CHECK(hasName(shortened, sizeof(shortened), "Pow"));
+
+    // An empty name is a name.
+    static const uint8_t empty[] = { 0x02, 0x01, 0x06, 0x01, 0x09 };
+    CHECK(hasName(empty, sizeof(empty), ""));
+
+    // Data cut anywhere inside the name structure, as when extended advertising data is truncated to legacy size.
+    for (size_t size = 0; size < sizeof(complete); size++) {
+        CHECK(hasNoName(complete, size));
+    }
+
+    // Cut just after the name structure, with the start of another following.
+    static const uint8_t trailing[] = { 0x03, 0x09, 'h', 'i', 0x05 };
+    CHECK(hasName(trailing, sizeof(trailing), "hi"));
+
+    // A zero length ends the data, as the spec pads with zeros.
+    static const uint8_t padded[] = { 0x02, 0x01, 0x06, 0x00, 0x03, 0x09, 'h', 'i' };
+    CHECK(hasNoName(padded, sizeof(padded)));
+
+    // A structure longer than the data hides anything after it.
+    static const uint8_t overlong[] = { 0x02, 0x01, 0x06, 0xff, 0xff, 0x03, 0x09, 'h', 'i' };
+    CHECK(hasNoName(overlong, sizeof(overlong)));
+
+    // A length byte with no type after it.
+    static const uint8_t lone_length[] = { 0x02, 0x01, 0x06, 0x03 };
+    CHECK(hasNoName(lone_length, sizeof(lone_length)));
+
+    CHECK(hasNoName(nullptr, 0));
+
+    return test_result("local_name");
+}
@@ -0,0 +1,125 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Round trips of printf() calls through the binary log encoding: every varint, signed or not, at the edges of each
+// encoded length and of each argument type, must print as printf() would have, and a record cut short anywhere must be
+// reported as truncated.
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <LogFormat.h>
+
+#include "TestCheck.h"
+
+namespace {
+
+struct Output {
+    char text[512];
+    size_t length;
+};
+
+void append(void *ctx, const char *fmt, ...)
+{
+    auto output = static_cast<Output *>(ctx);
+    va_list args;
+    va_start(args, fmt);
+    auto n = vsnprintf(output->text + output->length, sizeof(output->text) - output->length, fmt, args);
+    va_end(args);
+    if (n > 0) {
+        output->length += static_cast<size_t>(n);
+    }
+}
+
+size_t encode(uint8_t *record, uint32_t timestamp, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    auto size = log_encode_record(record, timestamp, fmt, args);
+    va_end(args);
+    return size;
+}
+
+// Encode and decode a call, and check that it prints as snprintf() does and that every prefix is truncated.
+#define CHECK_ROUND_TRIP(timestamp, fmt, ...)                                       \
+    do {                                                                            \
+        char expected[512];                                                         \
+        snprintf(expected, sizeof(expected), fmt, __VA_ARGS__);                     \
+        uint8_t record[LOG_MAX_RECORD_SIZE];                                        \
+        auto size = encode(record, timestamp, fmt, __VA_ARGS__);                    \
+        CHECK(size > 0);                                                            \
+        checkRecord(record, size, timestamp, fmt, expected);                        \
+    } while (0)
+
+void checkRecord(const uint8_t *record, size_t size, uint32_t timestamp, const char *fmt, const char *expected)
+{
+    log_record_header_t header;
+    CHECK(log_decode_header(record, size, header));
+    CHECK(header.id == reinterpret_cast<uintptr_t>(fmt));
+    CHECK(header.timestamp == timestamp);
+
+    Output output = {};
+    CHECK(log_print_record(record + header.size, size - header.size, fmt, &append, &output));
+    if (strcmp(output.text, expected) != 0) {
+        fprintf(stderr, "printed \"%s\", expected \"%s\"\n", output.text, expected);
+        test_failures++;
+    }
+
+    for (size_t cut = 0; cut < size; cut++) {
+        Output ignored = {};
+        log_record_header_t cut_header;
+        bool complete = log_decode_header(record, cut, cut_header)
+            && log_print_record(record + cut_header.size, cut - cut_header.size, fmt, &append, &ignored);
+        CHECK(!complete);
+    }
+}
+
+} // namespace
+
+int main()
+{
+    // Varints take one more byte for every 7 bits, so check each side of each boundary.
+    for (int bits = 0; bits < 32; bits++) {
+        uint32_t value = UINT32_C(1) << bits;
+        CHECK_ROUND_TRIP(value, "%u %u %u", value - 1, value, value + 1);
+    }
+
+    for (int bits = 0; bits < 31; bits++) {
+        int32_t value = INT32_C(1) << bits;
+        CHECK_ROUND_TRIP(0, "%d %d %d %d", value - 1, value, -value, -value - 1);
+    }
+
+    for (int bits = 0; bits < 63; bits++) {
+        int64_t value = INT64_C(1) << bits;
+        CHECK_ROUND_TRIP(0, "%" PRIu64 " %" PRId64 " %" PRId64, static_cast<uint64_t>(value) << 1, value, -value);
+    }
+
+    CHECK_ROUND_TRIP(UINT32_MAX, "%d %d %u", INT32_MIN, INT32_MAX, UINT32_MAX);
+    CHECK_ROUND_TRIP(1, "%lld %lld %llu", LLONG_MIN, LLONG_MAX, ULLONG_MAX);
+    CHECK_ROUND_TRIP(2, "%ld %lu %zu %zd", LONG_MIN, ULONG_MAX, SIZE_MAX, PTRDIFF_MIN);
+    CHECK_ROUND_TRIP(3, "%jd %ju %td", INTMAX_MIN, UINTMAX_MAX, PTRDIFF_MAX);
+    CHECK_ROUND_TRIP(4, "%x %X %o %c %hhu %hd", 0xdeadbeefU, 0xcafeU, 0777U, 'z', 255, -32768);
+    CHECK_ROUND_TRIP(5, "[%*d] [%-*.*s] [%.*f]", -6, 42, 8, 3, "abcdef", 2, 3.14159);
+    CHECK_ROUND_TRIP(6, "%s=%g (%e) %p 100%%", "ratio", 0.1, -1e300, static_cast<void *>(&test_failures));
+
+    return test_result("log_format");
+}
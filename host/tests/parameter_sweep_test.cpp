@@ -0,0 +1,119 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Enumeration of the points of a parameter sweep: every combination of the values of the axes, the last axis
+// changing fastest and the repetitions of a combination adjacent, with the parameters off the axes left alone.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <ParameterSweep.h>
+#include <bt_test_params.h>
+
+#include "TestCheck.h"
+
+namespace {
+
+const bt_test_param_info_t *findParam(const char *name)
+{
+    size_t count;
+    auto infos = get_bt_test_param_infos(&count);
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(infos[i].name, name) == 0) {
+            return &infos[i];
+        }
+    }
+
+    return nullptr;
+}
+
+void checkEnumeration()
+{
+    static const uint32_t scan_times[] = { 1000, 2000, 3000 };
+    static const uint32_t phys[] = { 1, 2 };
+    static const uint32_t windows[] = { 10, 20, 30, 40 };
+    ParameterSweep sweep;
+    sweep.repetitions = 2;
+    CHECK(sweep.setAxis(findParam("scan_time"), scan_times, 3));
+    CHECK(sweep.setAxis(findParam("phy"), phys, 2));
+    CHECK(sweep.setAxis(findParam("scan_window"), windows, 4));
+    CHECK(sweep.axisCount() == 3);
+    CHECK(sweep.pointCount() == 3 * 2 * 4 * 2);
+
+    uint32_t point = 0;
+    for (auto scan_time : scan_times) {
+        for (auto phy : phys) {
+            for (auto window : windows) {
+                for (uint32_t repetition = 0; repetition < sweep.repetitions; repetition++, point++) {
+                    bt_test_params_t params;
+                    params.conn_latency = 7;
+                    sweep.apply(point, params);
+                    CHECK(params.scan_time == scan_time);
+                    CHECK(params.phy == phy);
+                    CHECK(params.scan_window == window);
+                    CHECK(params.conn_latency == 7);
+                    CHECK(params.scan_interval == bt_test_params_t().scan_interval);
+                    CHECK(sweep.repetition(point) == repetition);
+                }
+            }
+        }
+    }
+}
+
+void checkAxes()
+{
+    static const uint32_t values[ParameterSweep::MAX_VALUES + 1] = { 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+    static const char *names[] = { "scan_time", "scan_interval", "scan_window", "phy", "conn_latency" };
+    ParameterSweep sweep;
+    for (size_t i = 0; i < ParameterSweep::MAX_AXES; i++) {
+        CHECK(sweep.setAxis(findParam(names[i]), values, 2));
+    }
+
+    // A fifth axis or a ninth value is refused, but an existing axis can still be replaced or removed.
+    CHECK(!sweep.setAxis(findParam(names[4]), values, 2));
+    CHECK(!sweep.setAxis(findParam(names[0]), values, ParameterSweep::MAX_VALUES + 1));
+    CHECK(sweep.setAxis(findParam(names[1]), values, 3));
+    CHECK(sweep.axis(1).param == findParam(names[1]) && sweep.axis(1).count == 3);
+    CHECK(sweep.setAxis(findParam(names[1]), values, 0));
+    CHECK(sweep.axisCount() == 3);
+    CHECK(sweep.axis(0).param == findParam(names[0]));
+    CHECK(sweep.axis(1).param == findParam(names[2]));
+    CHECK(sweep.axis(2).param == findParam(names[3]));
+    CHECK(sweep.pointCount() == 8);
+
+    // No repetitions count as one, and a count which doesn't fit is 0.
+    sweep.repetitions = 0;
+    CHECK(sweep.pointCount() == 8);
+    CHECK(sweep.repetition(5) == 0);
+    sweep.repetitions = UINT32_MAX / 4;
+    CHECK(sweep.pointCount() == 0);
+
+    sweep.clear();
+    sweep.repetitions = 3;
+    CHECK(sweep.axisCount() == 0);
+    CHECK(sweep.pointCount() == 3);
+}
+
+} // namespace
+
+int main()
+{
+    checkEnumeration();
+    checkAxes();
+    return test_result("parameter_sweep");
+}
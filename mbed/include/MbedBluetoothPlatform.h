@@ -28,7 +28,10 @@
 #include "bt_test_state.h"
 #include <BluetoothPlatform.h>
 #include <config.h>
-struct MbedBluetoothPlatform : BluetoothPlatform, protected ble::Gap::EventHandler {
+struct MbedBluetoothPlatform
+: BluetoothPlatform
+, protected ble::Gap::EventHandler
+, protected GattServer::EventHandler {
     MbedBluetoothPlatform(ble::BLE &ble, events::EventQueue &eq);
 
     ~MbedBluetoothPlatform();
@@ -43,13 +46,29 @@ struct MbedBluetoothPlatform : BluetoothPlatform, protected ble::Gap::EventHandl
 
     void call(BluetoothPlatform::callback_t fn, void* arg) override;
 
-    void callIn(uint32_t millis, BluetoothPlatform::callback_t fn, void* arg) override;
+    timer_id_t callIn(uint32_t millis, BluetoothPlatform::callback_t fn, void* arg) override;
 
-    void printError(intmax_t error, const char *msg) override;
+    timer_id_t callIn(uint32_t millis, uint32_t toleranceMs, BluetoothPlatform::callback_t fn, void* arg) override;
+
+    timer_id_t callIn(
+        uint32_t millis,
+        uint32_t toleranceMs,
+        BluetoothPlatform::callback_t fn,
+        const void* payload,
+        size_t size
+    ) override;
+
+    timer_id_t callEvery(uint32_t periodMs, BluetoothPlatform::callback_t fn, void* arg) override;
+
+    bool cancel(timer_id_t id) override;
+
+    WakeupStats getWakeupStats() override;
 
-    void printf(const char *fmt, ...) override;
+    bool getSchedulerStats(SchedulerStats &stats) override;
 
-    int getchar() override;
+    uint32_t uptimeMs() override;
+
+    void printError(intmax_t error, const char *msg) override;
 
     void putchar(int c) override;
 
@@ -59,6 +78,8 @@ struct MbedBluetoothPlatform : BluetoothPlatform, protected ble::Gap::EventHandl
 
     int startPeriodicAdvertising() override;
 
+    int setScanFilter(const uint8_t *peerAddress) override;
+
     int startScan() override;
 
     int startScanForPeriodicAdvertising() override;
@@ -72,10 +93,24 @@ struct MbedBluetoothPlatform : BluetoothPlatform, protected ble::Gap::EventHandl
         uint32_t syncTimeoutMs
     ) override;
 
+    int setPhy(handle_t connection_handle, phy_t phy) override;
+
+    int startThroughput(handle_t connection_handle) override;
+
+    int prepareWorkload(handle_t connection_handle, traffic_t traffic) override;
+
+    int sendWorkload(handle_t connection_handle, size_t size) override;
+
+    bool getTrafficStats(TrafficStats &stats) override;
+
     int disconnect(handle_t connection_handle) override;
 
     int stopSync(handle_t sync_handle) override;
 protected:
+    void vprint(const char *fmt, va_list args) override;
+
+    void write(const uint8_t *data, size_t size) override;
+
     void onAdvertisingStart(const ble::AdvertisingStartEvent &event) override;
 
     void onAdvertisingEnd(const ble::AdvertisingEndEvent &event) override;
@@ -86,19 +121,28 @@ protected:
 
     void onConnectionComplete(const ble::ConnectionCompleteEvent &event) override;
 
+    void onConnectionParametersUpdateComplete(const ble::ConnectionParametersUpdateCompleteEvent &event) override;
+
+    void onPhyUpdateComplete(
+        ble_error_t status,
+        ble::connection_handle_t connectionHandle,
+        ble::phy_t txPhy,
+        ble::phy_t rxPhy
+    ) override;
+
     void onDisconnectionComplete(const ble::DisconnectionCompleteEvent &event) override;
 
     void onPeriodicAdvertisingSyncEstablished(const ble::PeriodicAdvertisingSyncEstablishedEvent &event) override;
 
     void onPeriodicAdvertisingSyncLoss(const ble::PeriodicAdvertisingSyncLoss &event) override;
 
+    void onAttMtuChange(ble::connection_handle_t connectionHandle, uint16_t attMtuSize) override;
+
 private:
     static constexpr uint16_t MAX_ADVERTISING_PAYLOAD_SIZE = 50;
 
-    ble::scan_duration_t _scan_time = ble::scan_duration_t(CONFIG_SCAN_TIME);
-    ble::adv_duration_t _advertise_time = ble::adv_duration_t(CONFIG_ADVERTISE_TIME);
-    events::EventQueue::duration _connect_time = events::EventQueue::duration(CONFIG_CONNECT_TIME);
-    ble::periodic_interval_t _periodic_interval = ble::adv_duration_t(CONFIG_PERIODIC_INTERVAL);
+    // Payload of a throughput write: the largest LL packet less the L2CAP and ATT headers.
+    static constexpr uint16_t MAX_THROUGHPUT_PAYLOAD_SIZE = 251 - 4 - 3;
 
     BLE &_ble;
     events::EventQueue &_event_queue;
@@ -108,10 +152,137 @@ private:
 
     ble::advertising_handle_t _adv_handle = ble::INVALID_ADVERTISING_HANDLE;
 
+    // Handles passed to the event handler; members so that they outlive the events that refer to them.
+    ble::connection_handle_t _connection_handle = 0;
+    ble::periodic_sync_handle_t _sync_handle = 0;
+
     bool _is_periodic = false;
     bool _is_scanner = false;
+    bool _is_scan_filtered = false;
     bool _is_connecting_or_syncing = false;
 
+    // GATT throughput run or workload. The peer writes to the characteristics as peripheral, and main subscribes to
+    // the workload one for notifications and indications. The sender keeps up to CONFIG_THROUGHPUT_WINDOW PDUs (one
+    // for indications) in flight, queuing more as the stack reports them sent. _backlog is the number of bytes left to
+    // queue, unbounded for a throughput run.
+    uint8_t _throughput_value[MAX_THROUGHPUT_PAYLOAD_SIZE] = {};
+    uint8_t _workload_value[MAX_THROUGHPUT_PAYLOAD_SIZE] = {};
+    GattCharacteristic _throughput_characteristic;
+    GattCharacteristic _workload_characteristic;
+    GattAttribute::Handle_t _peer_value_handle = 0;
+    uint16_t _att_mtu = 23;
+    bool _is_workload = false;
+    traffic_t _traffic = traffic_t::notification;
+    uint64_t _backlog = 0;
+    bool _is_streaming = false;
+    bool _has_traffic = false;
+    bool _is_pump_scheduled = false;
+    uint32_t _in_flight = 0;
+    uint32_t _traffic_start_ms = 0;
+    uint32_t _traffic_last_ms = 0;
+    TrafficStats _traffic_stats = {};
+
+    // Exchange the ATT MTU and find the peer's characteristic. Continues in onPeerDiscoveryEnd().
+    int discoverPeerCharacteristic(handle_t connection_handle, const UUID &uuid);
+
+    void onPeerCharacteristicFound(const DiscoveredCharacteristic *characteristic);
+    void onPeerDiscoveryEnd(ble::connection_handle_t connectionHandle);
+    void onDataWritten(const GattWriteCallbackParams *params);
+    void onWriteSent(const GattWriteCallbackParams *params);
+    void onUpdatesSent(unsigned count);
+    void onUpdateReceived(const GattHVXCallbackParams *params);
+    void onUpdatesEnabled(GattAttribute::Handle_t handle);
+    void onUpdatesDisabled(GattAttribute::Handle_t handle);
+
+    // Queue PDUs until the window is full or the backlog is empty.
+    void pumpTraffic();
+
+    // Queue a PDU of the throughput run or workload.
+    ble_error_t sendPdu(uint16_t length);
+
+    // Raise EventHandler::onThroughputStart().
+    void startedThroughput(intmax_t error, connection_role_t role);
+
+    // Raise EventHandler::onWorkloadReady().
+    void workloadReady(intmax_t error, connection_role_t role);
+
+    // Raise the event of a throughput run or workload which main failed to set up.
+    void gattSetupFailed(intmax_t error);
+
+    // Payload copied by value into the event queue's own storage by callIn().
+    struct Payload {
+        alignas(8) uint8_t data[MAX_PAYLOAD_SIZE];
+    };
+
+    // Wakeup accounting. equeue runs every event that is due in a single pass, so timers dispatched at the same tick
+    // share a wakeup, which is coalesced if any of them ran before the end of its tolerance.
+    WakeupStats _wakeup_stats = {};
+    unsigned _wakeup_tick = 0;
+    uint32_t _wakeup_calls = 0;
+    bool _wakeup_coalesced = false;
+
+    // Delay in ms until the tick in [now + millis, now + millis + toleranceMs] that is aligned to the largest power of
+    // two not exceeding toleranceMs, so that timers with overlapping windows tend to be due at the same tick.
+    uint32_t alignedDelay(uint32_t millis, uint32_t toleranceMs);
+
+    // When a call is due, passed by value to the trampolines for the wakeup accounting and scheduler statistics.
+    struct Schedule {
+        // equeue tick at the end of the call's tolerance; it runs early if dispatched before this tick.
+        unsigned latest;
+#if CONFIG_SCHED_STATS
+        // equeue tick of the first deadline, and the period of a recurring call or 0.
+        unsigned first;
+        unsigned period;
+#endif
+    };
+
+    // Schedule of a call due in delay ms which may run up to slack ms later. Recurring calls have no slack, so they
+    // are never early.
+    Schedule schedule(uint32_t delay, uint32_t slack, uint32_t period);
+
+    void recordDispatch(const Schedule &schedule);
+
+#if CONFIG_SCHED_STATS
+    SchedulerStats _sched_stats = {};
+
+    // Lateness in us of a call which is running now. equeue ticks are in ms, so this has ms resolution.
+    uint32_t lateness(const Schedule &schedule);
+
+    // Record a call that started at start_us (us ticker) and has just returned.
+    void recordCall(uint32_t lateness_us, uint32_t start_us);
+
+    // Trampoline for call(); it does not count wakeups.
+    static void dispatchCall(
+        MbedBluetoothPlatform *self,
+        BluetoothPlatform::callback_t fn,
+        void* arg,
+        Schedule schedule
+    );
+#endif
+
+    // Trampolines through which all timers are dispatched.
+    static void dispatchTimer(
+        MbedBluetoothPlatform *self,
+        BluetoothPlatform::callback_t fn,
+        void* arg,
+        Schedule schedule
+    );
+
+    static void dispatchTimerWithPayload(
+        MbedBluetoothPlatform *self,
+        BluetoothPlatform::callback_t fn,
+        Payload payload,
+        Schedule schedule
+    );
+
+    // Console input. stdin signals from interrupt context when it becomes readable, and is then read from the event
+    // queue without blocking. Only one read is queued at a time.
+    mbed::FileHandle *_stdin = nullptr;
+    volatile bool _input_pending = false;
+
+    void onStdinSigio();
+    void readInput();
+
     void scheduleEvents(BLE::OnEventsToProcessCallbackContext *context);
     void onInitComplete(BLE::InitializationCompleteCallbackContext *event);
     int commonStartAdvertising();
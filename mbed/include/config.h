@@ -1,10 +1,19 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
-#define CONFIG_SCAN_TIME         MBED_CONF_APP_SCAN_TIME
-#define CONFIG_ADVERTISE_TIME    MBED_CONF_APP_ADVERTISE_TIME
+// mbed_app.json gives scan_time, advertise_time and periodic_interval in 10 ms units; the shared code uses ms.
+#define CONFIG_SCAN_TIME         (MBED_CONF_APP_SCAN_TIME * 10)
+#define CONFIG_ADVERTISE_TIME    (MBED_CONF_APP_ADVERTISE_TIME * 10)
 #define CONFIG_CONNECT_TIME      MBED_CONF_APP_CONNECT_TIME
-#define CONFIG_PERIODIC_INTERVAL MBED_CONF_APP_PERIODIC_INTERVAL
+#define CONFIG_PERIODIC_INTERVAL (MBED_CONF_APP_PERIODIC_INTERVAL * 10)
 #define CONFIG_USE_PER_ADV_SYNC  MBED_CONF_APP_USE_PER_ADV_SYNC
+#define CONFIG_TIMER_SLACK       MBED_CONF_APP_TIMER_SLACK
+#define CONFIG_SCHED_STATS       MBED_CONF_APP_SCHED_STATS
+#define CONFIG_LOG_BUFFER_SIZE   MBED_CONF_APP_LOG_BUFFER_SIZE
+#define CONFIG_BINARY_LOG        MBED_CONF_APP_BINARY_LOG
+#define CONFIG_THROUGHPUT_WINDOW MBED_CONF_APP_THROUGHPUT_WINDOW
+
+// Scan passively by default, as mbed's default ScanParameters do.
+#define CONFIG_ACTIVE_SCAN       0
 
 #endif // ! CONFIG_H
@@ -14,21 +14,47 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <cassert>
 #include <cstdarg>
 #include <limits>
 
 #include <ble/BLE.h>
+#include <hal/us_ticker_api.h>
+#include <platform/mbed_atomic.h>
+#include <platform/mbed_retarget.h>
 
 #include <BluetoothPlatform.h>
 #include <MbedBluetoothPlatform.h>
 
 using ble::BLE;
 
+// Service with a characteristic which main writes to without response in a throughput run, and one which carries
+// workloads.
+static const UUID THROUGHPUT_SERVICE_UUID("8b4c0001-6f3e-4f2a-9d1b-2a7c5e0f1d30");
+static const UUID THROUGHPUT_CHARACTERISTIC_UUID("8b4c0002-6f3e-4f2a-9d1b-2a7c5e0f1d30");
+static const UUID WORKLOAD_CHARACTERISTIC_UUID("8b4c0003-6f3e-4f2a-9d1b-2a7c5e0f1d30");
+
 MbedBluetoothPlatform::MbedBluetoothPlatform(BLE &ble, events::EventQueue &eq)
 : _ble(ble)
 , _event_queue(eq)
 , _adv_data_builder(_adv_buffer)
+, _throughput_characteristic(
+    THROUGHPUT_CHARACTERISTIC_UUID,
+    _throughput_value,
+    0,
+    sizeof(_throughput_value),
+    GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE
+)
+, _workload_characteristic(
+    WORKLOAD_CHARACTERISTIC_UUID,
+    _workload_value,
+    0,
+    sizeof(_workload_value),
+    GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE
+        | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY
+        | GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_INDICATE
+)
 {}
 
 MbedBluetoothPlatform::~MbedBluetoothPlatform()
@@ -45,6 +71,24 @@ void MbedBluetoothPlatform::onInitComplete(BLE::InitializationCompleteCallbackCo
         return;
     }
 
+    GattCharacteristic *characteristics[] = { &_throughput_characteristic, &_workload_characteristic };
+    GattService throughput_service(THROUGHPUT_SERVICE_UUID, characteristics, 2);
+    auto error = _ble.gattServer().addService(throughput_service);
+    if (error) {
+        printError(error, "GattServer::addService() failed");
+        return;
+    }
+
+    _ble.gattServer().setEventHandler(this);
+    _ble.gattServer().onDataWritten(this, &MbedBluetoothPlatform::onDataWritten);
+    _ble.gattServer().onDataSent(this, &MbedBluetoothPlatform::onUpdatesSent);
+    _ble.gattServer().onUpdatesEnabled(mbed::makeFunctionPointer(this, &MbedBluetoothPlatform::onUpdatesEnabled));
+    _ble.gattServer().onUpdatesDisabled(mbed::makeFunctionPointer(this, &MbedBluetoothPlatform::onUpdatesDisabled));
+    _ble.gattClient().onDataWritten(this, &MbedBluetoothPlatform::onWriteSent);
+    _ble.gattClient().onHVX(mbed::makeFunctionPointer(this, &MbedBluetoothPlatform::onUpdateReceived));
+    _ble.gattClient().onServiceDiscoveryTermination(
+        mbed::makeFunctionPointer(this, &MbedBluetoothPlatform::onPeerDiscoveryEnd)
+    );
     getEventHandler()->onInitComplete();
 }
 
@@ -53,7 +97,25 @@ int MbedBluetoothPlatform::commonStartAdvertising()
     _is_scanner = false;
     _is_connecting_or_syncing = false;
 
-    auto error = _ble.gap().startAdvertising(_adv_handle, _advertise_time);
+    ble::AdvertisingParameters adv_parameters(
+        _is_periodic ? ble::advertising_type_t::NON_CONNECTABLE_UNDIRECTED
+                     : ble::advertising_type_t::CONNECTABLE_UNDIRECTED
+    );
+    adv_parameters.setUseLegacyPDU(!_is_periodic);
+    adv_parameters.setPrimaryInterval(
+        ble::adv_interval_t(ble::millisecond_t(params().adv_interval)),
+        ble::adv_interval_t(ble::millisecond_t(params().adv_interval + params().adv_interval_span))
+    );
+    auto error = _ble.gap().setAdvertisingParameters(_adv_handle, adv_parameters);
+    if (error) {
+        printError(error, "Gap::setAdvertisingParameters() failed");
+        return error;
+    }
+
+    error = _ble.gap().startAdvertising(
+        _adv_handle,
+        ble::adv_duration_t(ble::millisecond_t(params().advertise_time))
+    );
     if (error) {
         printError(error, "Gap::startAdvertising() failed");
     }
@@ -68,6 +130,14 @@ int MbedBluetoothPlatform::commonStartScan()
 
     ble::ScanParameters scan_params;
     scan_params.setOwnAddressType(ble::own_address_type_t::RANDOM);
+    scan_params.set1mPhyConfiguration(
+        ble::scan_interval_t(ble::millisecond_t(params().scan_interval)),
+        ble::scan_window_t(ble::millisecond_t(std::min(params().scan_window, params().scan_interval))),
+        params().active_scan != 0
+    );
+    if (_is_scan_filtered) {
+        scan_params.setFilter(ble::scanning_filter_policy_t::FILTER_ADVERTISING);
+    }
 
     ble_error_t error = _ble.gap().setScanParameters(scan_params);
     if (error) {
@@ -75,7 +145,8 @@ int MbedBluetoothPlatform::commonStartScan()
         return error;
     }
 
-    error = _ble.gap().startScan(_scan_time);
+    auto scan_time = ble::scan_duration_t(ble::millisecond_t(params().scan_time));
+    error = _ble.gap().startScan(scan_time);
     if (error) {
         printError(error, "Gap::startScan failed");
         return error;
@@ -83,7 +154,7 @@ int MbedBluetoothPlatform::commonStartScan()
 
     auto eh = getEventHandler();
     if (eh) {
-        eh->onScanStart(ScanStartEvent(_scan_time.valueInMs()));
+        eh->onScanStart(ScanStartEvent(scan_time.valueInMs()));
     }
 
     return 0;
@@ -108,6 +179,9 @@ void MbedBluetoothPlatform::getLocalAddress(uint8_t buf[6])
 
 int MbedBluetoothPlatform::init()
 {
+    _stdin = mbed::mbed_file_handle(STDIN_FILENO);
+    _stdin->sigio(mbed::callback(this, &MbedBluetoothPlatform::onStdinSigio));
+
     _ble.gap().setEventHandler(this);
     ble_error_t error = _ble.init(this, &MbedBluetoothPlatform::onInitComplete);
     if (error) {
@@ -124,13 +198,265 @@ void MbedBluetoothPlatform::runEventLoop()
 
 void MbedBluetoothPlatform::call(BluetoothPlatform::callback_t fn, void* arg)
 {
+#if CONFIG_SCHED_STATS
+    _event_queue.call(&MbedBluetoothPlatform::dispatchCall, this, fn, arg, schedule(0, 0, 0));
+#else
     _event_queue.call(fn, arg);
+#endif
+}
+
+BluetoothPlatform::timer_id_t MbedBluetoothPlatform::callIn(
+    uint32_t millis,
+    BluetoothPlatform::callback_t fn,
+    void* arg
+)
+{
+    return callIn(millis, 0, fn, arg);
+}
+
+BluetoothPlatform::timer_id_t MbedBluetoothPlatform::callIn(
+    uint32_t millis,
+    uint32_t toleranceMs,
+    BluetoothPlatform::callback_t fn,
+    void* arg
+)
+{
+    auto delay = alignedDelay(millis, toleranceMs);
+    assert(delay < std::numeric_limits<int>::max());
+    return _event_queue.call_in(
+        std::chrono::milliseconds(delay),
+        &MbedBluetoothPlatform::dispatchTimer,
+        this,
+        fn,
+        arg,
+        schedule(delay, millis + toleranceMs - delay, 0)
+    );
+}
+
+BluetoothPlatform::timer_id_t MbedBluetoothPlatform::callIn(
+    uint32_t millis,
+    uint32_t toleranceMs,
+    BluetoothPlatform::callback_t fn,
+    const void* payload,
+    size_t size
+)
+{
+    auto delay = alignedDelay(millis, toleranceMs);
+    assert(delay < std::numeric_limits<int>::max());
+    assert(size <= MAX_PAYLOAD_SIZE);
+    Payload copy;
+    memcpy(copy.data, payload, size);
+    return _event_queue.call_in(
+        std::chrono::milliseconds(delay),
+        &MbedBluetoothPlatform::dispatchTimerWithPayload,
+        this,
+        fn,
+        copy,
+        schedule(delay, millis + toleranceMs - delay, 0)
+    );
+}
+
+BluetoothPlatform::timer_id_t MbedBluetoothPlatform::callEvery(
+    uint32_t periodMs,
+    BluetoothPlatform::callback_t fn,
+    void* arg
+)
+{
+    // equeue re-arms recurring events from their previous target time, so they do not drift.
+    if (periodMs == 0 || periodMs >= static_cast<uint32_t>(std::numeric_limits<int>::max())) {
+        return 0;
+    }
+
+    return _event_queue.call_every(
+        std::chrono::milliseconds(periodMs),
+        &MbedBluetoothPlatform::dispatchTimer,
+        this,
+        fn,
+        arg,
+        schedule(periodMs, 0, periodMs)
+    );
+}
+
+bool MbedBluetoothPlatform::cancel(BluetoothPlatform::timer_id_t id)
+{
+    if (id == 0) {
+        return false;
+    }
+
+    return _event_queue.cancel(id);
+}
+
+BluetoothPlatform::WakeupStats MbedBluetoothPlatform::getWakeupStats()
+{
+    return _wakeup_stats;
+}
+
+uint32_t MbedBluetoothPlatform::uptimeMs()
+{
+    return _event_queue.tick();
+}
+
+bool MbedBluetoothPlatform::getSchedulerStats(SchedulerStats &stats)
+{
+#if CONFIG_SCHED_STATS
+    stats = _sched_stats;
+    return true;
+#else
+    return false;
+#endif
+}
+
+uint32_t MbedBluetoothPlatform::alignedDelay(uint32_t millis, uint32_t toleranceMs)
+{
+    if (toleranceMs == 0) {
+        return millis;
+    }
+
+    uint32_t quantum = 1;
+    while (quantum <= toleranceMs / 2) {
+        quantum *= 2;
+    }
+
+    // Tick arithmetic is modulo 2^32, like equeue's own.
+    uint32_t now = _event_queue.tick();
+    uint32_t target = now + millis;
+    uint32_t aligned = (target + quantum - 1) & ~(quantum - 1);
+    return aligned - now;
+}
+
+void MbedBluetoothPlatform::recordDispatch(const Schedule &schedule)
+{
+    // Ticks wrap, so compare by difference. A call is early when it runs before the end of its tolerance.
+    unsigned now = _event_queue.tick();
+    bool early = static_cast<int>(schedule.latest - now) > 0;
+    if (_wakeup_calls == 0 || now != _wakeup_tick) {
+        _wakeup_tick = now;
+        _wakeup_calls = 1;
+        _wakeup_coalesced = early;
+        if (early) {
+            _wakeup_stats.coalesced++;
+            _wakeup_stats.coalescedCalls++;
+        } else {
+            _wakeup_stats.uncoalesced++;
+        }
+        return;
+    }
+
+    // Shares the wakeup of the previous timer; move that wakeup to the coalesced count on its first early call.
+    _wakeup_calls++;
+    if (early) {
+        if (!_wakeup_coalesced) {
+            _wakeup_stats.uncoalesced--;
+            _wakeup_stats.coalesced++;
+            _wakeup_coalesced = true;
+        }
+
+        _wakeup_stats.coalescedCalls++;
+    }
+}
+
+MbedBluetoothPlatform::Schedule MbedBluetoothPlatform::schedule(uint32_t delay, uint32_t slack, uint32_t period)
+{
+    unsigned now = _event_queue.tick();
+#if CONFIG_SCHED_STATS
+    return Schedule{now + delay + slack, now + delay, period};
+#else
+    (void)period;
+    return Schedule{now + delay + slack};
+#endif
+}
+
+#if CONFIG_SCHED_STATS
+uint32_t MbedBluetoothPlatform::lateness(const Schedule &schedule)
+{
+    // Ticks wrap, so compare by difference. A recurring call is late relative to its latest deadline.
+    auto late = static_cast<int>(_event_queue.tick() - schedule.first);
+    if (late <= 0) {
+        return 0;
+    }
+
+    if (schedule.period > 0) {
+        late %= schedule.period;
+    }
+
+    return static_cast<uint32_t>(late) * 1000;
+}
+
+void MbedBluetoothPlatform::recordCall(uint32_t lateness_us, uint32_t start_us)
+{
+    _sched_stats.lateness.record(lateness_us);
+    _sched_stats.duration.record(us_ticker_read() - start_us);
+}
+
+void MbedBluetoothPlatform::dispatchCall(
+    MbedBluetoothPlatform *self,
+    BluetoothPlatform::callback_t fn,
+    void* arg,
+    Schedule schedule
+)
+{
+    auto late = self->lateness(schedule);
+    auto start = us_ticker_read();
+    fn(arg);
+    self->recordCall(late, start);
+}
+#endif
+
+void MbedBluetoothPlatform::dispatchTimer(
+    MbedBluetoothPlatform *self,
+    BluetoothPlatform::callback_t fn,
+    void* arg,
+    Schedule schedule
+)
+{
+    self->recordDispatch(schedule);
+#if CONFIG_SCHED_STATS
+    auto late = self->lateness(schedule);
+    auto start = us_ticker_read();
+#endif
+    fn(arg);
+#if CONFIG_SCHED_STATS
+    self->recordCall(late, start);
+#endif
+}
+
+void MbedBluetoothPlatform::dispatchTimerWithPayload(
+    MbedBluetoothPlatform *self,
+    BluetoothPlatform::callback_t fn,
+    Payload payload,
+    Schedule schedule
+)
+{
+    self->recordDispatch(schedule);
+#if CONFIG_SCHED_STATS
+    auto late = self->lateness(schedule);
+    auto start = us_ticker_read();
+#endif
+    fn(payload.data);
+#if CONFIG_SCHED_STATS
+    self->recordCall(late, start);
+#endif
+}
+
+void MbedBluetoothPlatform::onStdinSigio()
+{
+    if (!core_util_atomic_exchange_bool(&_input_pending, true)) {
+        _event_queue.call(this, &MbedBluetoothPlatform::readInput);
+    }
 }
 
-void MbedBluetoothPlatform::callIn(uint32_t millis, BluetoothPlatform::callback_t fn, void* arg)
+void MbedBluetoothPlatform::readInput()
 {
-    assert(millis < std::numeric_limits<int>::max());
-    _event_queue.call_in(std::chrono::milliseconds(millis), fn, arg);
+    // Clear the flag first so that input arriving while we read queues another read.
+    core_util_atomic_store_bool(&_input_pending, false);
+
+    char buffer[16];
+    while (_stdin->readable()) {
+        auto length = _stdin->read(buffer, sizeof(buffer));
+        for (ssize_t i = 0; i < length; i++) {
+            getEventHandler()->onInput(buffer[i]);
+        }
+    }
 }
 
 void MbedBluetoothPlatform::printError(intmax_t error, const char *msg)
@@ -138,18 +464,16 @@ void MbedBluetoothPlatform::printError(intmax_t error, const char *msg)
     print_error(static_cast<ble_error_t>(error), msg);
 }
 
-void MbedBluetoothPlatform::printf(const char *fmt, ...)
+void MbedBluetoothPlatform::vprint(const char *fmt, va_list args)
 {
-    va_list args;
-    va_start(args, fmt);
     vprintf(fmt, args);
-    va_end(args);
     fflush(stdout);
 }
 
-int MbedBluetoothPlatform::getchar()
+void MbedBluetoothPlatform::write(const uint8_t *data, size_t size)
 {
-    return ::getchar();
+    fwrite(data, 1, size, stdout);
+    fflush(stdout);
 }
 
 void MbedBluetoothPlatform::putchar(int c)
@@ -194,7 +518,7 @@ int MbedBluetoothPlatform::startPeriodicAdvertising()
 
     // Only perform this setup when we are starting fresh or have previously performed legacy advertising.
     if (_adv_handle == ble::INVALID_ADVERTISING_HANDLE || _adv_handle == ble::LEGACY_ADVERTISING_HANDLE) {
-        // Set parameters and payload with a new advertising set.
+        // Create a new advertising set and set its payload. commonStartAdvertising() sets the interval.
         ble::AdvertisingParameters adv_parameters(ble::advertising_type_t::NON_CONNECTABLE_UNDIRECTED);
         adv_parameters.setUseLegacyPDU(false);
         auto error = _ble.gap().createAdvertisingSet(&_adv_handle, adv_parameters);
@@ -203,12 +527,6 @@ int MbedBluetoothPlatform::startPeriodicAdvertising()
             return error;
         }
 
-        error = _ble.gap().setAdvertisingParameters(_adv_handle, adv_parameters);
-        if (error) {
-            printError(error, "Gap::setAdvertisingParameters() failed");
-            return error;
-        }
-
         _adv_data_builder.setFlags();
         _adv_data_builder.setName(deviceName());
         error = _ble.gap().setAdvertisingPayload(_adv_handle, _adv_data_builder.getAdvertisingData());
@@ -221,6 +539,34 @@ int MbedBluetoothPlatform::startPeriodicAdvertising()
     return commonStartAdvertising();
 }
 
+int MbedBluetoothPlatform::setScanFilter(const uint8_t *peerAddress)
+{
+    // The address type is not known until the peer is seen, so accept both.
+    static const ble::peer_address_type_t types[] = {
+        ble::peer_address_type_t::PUBLIC,
+        ble::peer_address_type_t::RANDOM
+    };
+    ble::whitelist_t::entry_t entries[2];
+    ble::whitelist_t whitelist = { entries, 0, 2 };
+    if (peerAddress != nullptr) {
+        for (auto type : types) {
+            entries[whitelist.size].type = type;
+            entries[whitelist.size].address = ble::address_t(peerAddress);
+            whitelist.size++;
+        }
+    }
+
+    _is_scan_filtered = false;
+    auto error = _ble.gap().setWhitelist(whitelist);
+    if (error) {
+        printError(error, "Gap::setWhitelist failed");
+        return error;
+    }
+
+    _is_scan_filtered = peerAddress != nullptr;
+    return 0;
+}
+
 int MbedBluetoothPlatform::startScan()
 {
     _is_periodic = false;
@@ -235,10 +581,18 @@ int MbedBluetoothPlatform::startScanForPeriodicAdvertising()
 
 int MbedBluetoothPlatform::establishConnection(uint8_t peerAddressType, const uint8_t *peerAddress)
 {
+    ble::ConnectionParameters connection_params;
+    connection_params.setConnectionParameters(
+        ble::conn_interval_t(ble::millisecond_t(params().conn_interval)),
+        ble::conn_interval_t(ble::millisecond_t(params().conn_interval + params().conn_interval_span)),
+        ble::slave_latency_t(params().conn_latency),
+        ble::supervision_timeout_t(ble::millisecond_t(params().supervision_timeout))
+    );
+
     ble_error_t error = _ble.gap().connect(
         static_cast<ble::peer_address_type_t::type>(peerAddressType),
         ble::address_t(peerAddress),
-        ble::ConnectionParameters()
+        connection_params
     );
     if (error) {
         printError(error, "Gap::connect failed");
@@ -268,6 +622,302 @@ int MbedBluetoothPlatform::syncToPeriodicAdvertising(
     return error;
 }
 
+int MbedBluetoothPlatform::setPhy(handle_t connection_handle, phy_t phy)
+{
+    assert(connection_handle != nullptr);
+    const ble::phy_set_t phys(static_cast<ble::phy_t::type>(phy));
+    auto error = _ble.gap().setPhy(
+        *reinterpret_cast<ble::connection_handle_t*>(connection_handle),
+        &phys,
+        &phys,
+        ble::coded_symbol_per_bit_t::UNDEFINED
+    );
+    if (error) {
+        printError(error, "Gap::setPhy failed");
+    }
+
+    return error;
+}
+
+int MbedBluetoothPlatform::startThroughput(handle_t connection_handle)
+{
+    _is_workload = false;
+    return discoverPeerCharacteristic(connection_handle, THROUGHPUT_CHARACTERISTIC_UUID);
+}
+
+int MbedBluetoothPlatform::prepareWorkload(handle_t connection_handle, traffic_t traffic)
+{
+    _is_workload = true;
+    _traffic = traffic;
+    return discoverPeerCharacteristic(connection_handle, WORKLOAD_CHARACTERISTIC_UUID);
+}
+
+int MbedBluetoothPlatform::sendWorkload(handle_t connection_handle, size_t size)
+{
+    // The connection may have been closed by disconnect() since the burst was scheduled.
+    if (!_is_connecting_or_syncing || !_is_workload || !_is_streaming) {
+        return BLE_ERROR_INVALID_STATE;
+    }
+
+    if (_backlog > 0) {
+        return BLE_STACK_BUSY;
+    }
+
+    _backlog = size;
+    pumpTraffic();
+    return 0;
+}
+
+int MbedBluetoothPlatform::discoverPeerCharacteristic(handle_t connection_handle, const UUID &uuid)
+{
+    assert(connection_handle != nullptr);
+    auto handle = *reinterpret_cast<ble::connection_handle_t*>(connection_handle);
+
+    // Cordio also raises the data length to cordio.rx-acl-buffer-size upon connection (see mbed_app.json).
+    auto error = _ble.gattClient().negotiateAttMtu(handle);
+    if (error) {
+        printError(error, "GattClient::negotiateAttMtu failed");
+        return error;
+    }
+
+    // ATT requests are serialised, so discovery ends after the MTU exchange. Continues in onPeerDiscoveryEnd().
+    _peer_value_handle = 0;
+    error = _ble.gattClient().launchServiceDiscovery(
+        handle,
+        nullptr,
+        mbed::makeFunctionPointer(this, &MbedBluetoothPlatform::onPeerCharacteristicFound),
+        THROUGHPUT_SERVICE_UUID,
+        uuid
+    );
+    if (error) {
+        printError(error, "GattClient::launchServiceDiscovery failed");
+    }
+
+    return error;
+}
+
+bool MbedBluetoothPlatform::getTrafficStats(TrafficStats &stats)
+{
+    stats = _traffic_stats;
+    stats.durationMs = 0;
+    if (_has_traffic && !_is_workload && stats.packets > 0) {
+        stats.durationMs = _traffic_last_ms - _traffic_start_ms;
+    }
+
+    return _has_traffic || stats.packets > 0;
+}
+
+void MbedBluetoothPlatform::onPeerCharacteristicFound(const DiscoveredCharacteristic *characteristic)
+{
+    _peer_value_handle = characteristic->getValueHandle();
+}
+
+void MbedBluetoothPlatform::onPeerDiscoveryEnd(ble::connection_handle_t connectionHandle)
+{
+    if (!_is_connecting_or_syncing || connectionHandle != _connection_handle) {
+        return;
+    }
+
+    if (_peer_value_handle == 0) {
+        gattSetupFailed(BLE_ERROR_NOT_FOUND);
+        return;
+    }
+
+    if (!_is_workload) {
+        _is_streaming = true;
+        _backlog = UINT64_MAX;
+        startedThroughput(0, connection_role_t::main);
+        pumpTraffic();
+        return;
+    }
+
+    if (_traffic == traffic_t::write) {
+        _is_streaming = true;
+        workloadReady(0, connection_role_t::main);
+        return;
+    }
+
+    // Subscribe by writing the client configuration descriptor, which Cordio places directly after the value.
+    uint16_t cccd = _traffic == traffic_t::notification ? BLE_HVX_NOTIFICATION : BLE_HVX_INDICATION;
+    auto error = _ble.gattClient().write(
+        GattClient::GATT_OP_WRITE_REQ,
+        _connection_handle,
+        _peer_value_handle + 1,
+        sizeof(cccd),
+        reinterpret_cast<const uint8_t*>(&cccd)
+    );
+    if (error) {
+        printError(error, "GattClient::write failed");
+    }
+
+    workloadReady(error, connection_role_t::main);
+}
+
+void MbedBluetoothPlatform::onDataWritten(const GattWriteCallbackParams *params)
+{
+    if (params->connHandle != _connection_handle) {
+        return;
+    }
+
+    // Only a throughput run starts with the first write; a workload is only counted.
+    if (params->handle == _workload_characteristic.getValueHandle()) {
+        _traffic_stats.packets++;
+        _traffic_stats.bytes += params->len;
+        return;
+    }
+
+    if (params->handle != _throughput_characteristic.getValueHandle()) {
+        return;
+    }
+
+    _traffic_last_ms = uptimeMs();
+    if (_traffic_stats.packets++ == 0) {
+        _traffic_start_ms = _traffic_last_ms;
+        startedThroughput(0, connection_role_t::peripheral);
+    }
+
+    _traffic_stats.bytes += params->len;
+}
+
+void MbedBluetoothPlatform::onWriteSent(const GattWriteCallbackParams *params)
+{
+    // Cordio reports each write command once it has been handed to the controller.
+    if (!_is_streaming || params->writeOp != GattWriteCallbackParams::OP_WRITE_CMD || _in_flight == 0) {
+        return;
+    }
+
+    _in_flight--;
+    _traffic_stats.packets++;
+    _traffic_stats.bytes += params->len;
+    _traffic_last_ms = uptimeMs();
+    pumpTraffic();
+}
+
+void MbedBluetoothPlatform::onUpdatesSent(unsigned count)
+{
+    // Notifications once handed to the controller, indications once confirmed. They are counted when queued.
+    _in_flight -= std::min<uint32_t>(count, _in_flight);
+    pumpTraffic();
+}
+
+void MbedBluetoothPlatform::onUpdateReceived(const GattHVXCallbackParams *params)
+{
+    if (params->connHandle != _connection_handle || params->handle != _peer_value_handle) {
+        return;
+    }
+
+    _traffic_stats.packets++;
+    _traffic_stats.bytes += params->len;
+}
+
+void MbedBluetoothPlatform::onUpdatesEnabled(GattAttribute::Handle_t handle)
+{
+    if (!_is_connecting_or_syncing || handle != _workload_characteristic.getValueHandle()) {
+        return;
+    }
+
+    // The descriptor's value is not reported, so the traffic is taken from the workload_type parameter, which main
+    // also subscribes according to.
+    _is_workload = true;
+    _traffic = static_cast<traffic_t>(params().workload_type);
+    _is_streaming = true;
+    _backlog = 0;
+    _in_flight = 0;
+    workloadReady(0, connection_role_t::peripheral);
+}
+
+void MbedBluetoothPlatform::onUpdatesDisabled(GattAttribute::Handle_t handle)
+{
+    if (handle == _workload_characteristic.getValueHandle()) {
+        _is_streaming = false;
+    }
+}
+
+void MbedBluetoothPlatform::pumpTraffic()
+{
+    _is_pump_scheduled = false;
+    if (!_is_streaming) {
+        return;
+    }
+
+    // Only one indication may await confirmation at a time.
+    uint32_t window = _is_workload && _traffic == traffic_t::indication ? 1 : CONFIG_THROUGHPUT_WINDOW;
+    while (_backlog > 0 && _in_flight < window) {
+        auto length = static_cast<uint16_t>(
+            std::min<uint64_t>(std::min<uint16_t>(_att_mtu - 3, sizeof(_throughput_value)), _backlog)
+        );
+        auto error = sendPdu(length);
+        if (error == BLE_ERROR_NONE) {
+            _in_flight++;
+            _backlog -= length;
+            continue;
+        }
+
+        if (error != BLE_ERROR_NO_MEM) {
+            printError(error, "GATT send failed");
+            _is_streaming = false;
+        } else if (_in_flight == 0 && !_is_pump_scheduled) {
+            // Out of buffers with no completion to come: poll.
+            _is_pump_scheduled = true;
+            _event_queue.call_in(std::chrono::milliseconds(1), this, &MbedBluetoothPlatform::pumpTraffic);
+        }
+
+        break;
+    }
+}
+
+ble_error_t MbedBluetoothPlatform::sendPdu(uint16_t length)
+{
+    if (!_is_workload || _traffic == traffic_t::write) {
+        return _ble.gattClient().write(
+            GattClient::GATT_OP_WRITE_CMD,
+            _connection_handle,
+            _peer_value_handle,
+            length,
+            _throughput_value
+        );
+    }
+
+    // Sent as a notification or indication according to main's subscription.
+    auto error = _ble.gattServer().write(
+        _connection_handle,
+        _workload_characteristic.getValueHandle(),
+        _workload_value,
+        length
+    );
+    if (error == BLE_ERROR_NONE) {
+        _traffic_stats.packets++;
+        _traffic_stats.bytes += length;
+    }
+
+    return error;
+}
+
+void MbedBluetoothPlatform::startedThroughput(intmax_t error, connection_role_t role)
+{
+    _has_traffic = error == 0;
+    if (role == connection_role_t::main) {
+        _traffic_start_ms = uptimeMs();
+    }
+
+    getEventHandler()->onThroughputStart(ThroughputStartEvent(error, role, _att_mtu));
+}
+
+void MbedBluetoothPlatform::workloadReady(intmax_t error, connection_role_t role)
+{
+    _has_traffic = error == 0;
+    getEventHandler()->onWorkloadReady(WorkloadReadyEvent(error, role, _traffic, _att_mtu));
+}
+
+void MbedBluetoothPlatform::gattSetupFailed(intmax_t error)
+{
+    if (_is_workload) {
+        workloadReady(error, connection_role_t::main);
+    } else {
+        startedThroughput(error, connection_role_t::main);
+    }
+}
+
 int MbedBluetoothPlatform::disconnect(handle_t connection_handle)
 {
     assert(connection_handle != nullptr);
@@ -302,8 +952,8 @@ void MbedBluetoothPlatform::onAdvertisingStart(const ble::AdvertisingStartEvent
         // Start periodic advertising.
         auto error = _ble.gap().setPeriodicAdvertisingParameters(
             _adv_handle,
-            ble::periodic_interval_t(_periodic_interval.valueInMs()/2),
-            ble::periodic_interval_t(_periodic_interval.valueInMs()*2)
+            ble::periodic_interval_t(ble::millisecond_t(params().periodic_interval / 2)),
+            ble::periodic_interval_t(ble::millisecond_t(params().periodic_interval * 2))
         );
         if (error) {
             printError(error, "Gap::setPeriodicAdvertisingParameters() failed");
@@ -319,49 +969,33 @@ void MbedBluetoothPlatform::onAdvertisingStart(const ble::AdvertisingStartEvent
 
     getEventHandler()->onAdvertisingStart(
         AdvertisingStartEvent(
-            _advertise_time.valueInMs(),
+            params().advertise_time,
             _is_periodic,
-            _periodic_interval.valueInMs()
+            params().periodic_interval
         )
     );
 }
 
-char *get_name_of_peer(const ble::AdvertisingReportEvent &event)
-{
-    ble::AdvertisingDataParser adv_parser(event.getPayload());
-    while (adv_parser.hasNext()) {
-        ble::AdvertisingDataParser::element_t field = adv_parser.next();
-        if (field.type == ble::adv_data_type_t::COMPLETE_LOCAL_NAME) {
-            char *buffer = new char[field.value.size() + 1];
-            memcpy(buffer, field.value.data(), field.value.size());
-            buffer[field.value.size()] = 0;
-            return buffer;
-        }
-    }
-
-    return nullptr;
-}
-
 void MbedBluetoothPlatform::onAdvertisingReport(const ble::AdvertisingReportEvent &event)
 {
     if (_is_connecting_or_syncing) {
         return;
     }
 
-    auto name = get_name_of_peer(event);
+    // The payload is passed as it is and only parsed by the event handler if it needs the name.
+    auto payload = event.getPayload();
     getEventHandler()->onAdvertisingReport(
         AdvertisingReportEvent(
             static_cast<int32_t>(event.getSID()),
             event.getPeerAddressType().value(),
             event.getPeerAddress().data(),
             event.getPeerAddress().size(),
-            const_cast<const char*>(name),
+            payload.data(),
+            payload.size(),
             event.isPeriodicIntervalPresent(),
             event.isPeriodicIntervalPresent() ? event.getPeriodicInterval().valueInMs() : 0UL
         )
     );
-
-    delete[] name;
 }
 
 void MbedBluetoothPlatform::onAdvertisingEnd(const ble::AdvertisingEndEvent &event)
@@ -387,7 +1021,14 @@ void MbedBluetoothPlatform::onConnectionComplete(const ble::ConnectionCompleteEv
 
     _is_connecting_or_syncing = true;
 
-    auto handle = event.getConnectionHandle();
+    _connection_handle = event.getConnectionHandle();
+    _att_mtu = 23;
+    _is_streaming = false;
+    _has_traffic = false;
+    _in_flight = 0;
+    _is_workload = false;
+    _backlog = 0;
+    _traffic_stats = {};
     eh->onConnection(
         ConnectEvent(
             event.getPeerAddressType().value(),
@@ -395,7 +1036,55 @@ void MbedBluetoothPlatform::onConnectionComplete(const ble::ConnectionCompleteEv
             event.getPeerAddress().size(),
             static_cast<intmax_t>(event.getStatus()),
             _is_scanner ? connection_role_t::main : connection_role_t::peripheral,
-            reinterpret_cast<handle_t>(&handle)
+            reinterpret_cast<handle_t>(&_connection_handle),
+            ConnectionParameters {
+                event.getConnectionInterval().valueInUs(),
+                event.getConnectionLatency().value(),
+                event.getSupervisionTimeout().valueInMs()
+            }
+        )
+    );
+}
+
+void MbedBluetoothPlatform::onConnectionParametersUpdateComplete(
+    const ble::ConnectionParametersUpdateCompleteEvent &event
+)
+{
+    if (!_is_connecting_or_syncing || event.getConnectionHandle() != _connection_handle) {
+        return;
+    }
+
+    getEventHandler()->onConnectionParametersUpdate(
+        ConnectionParametersUpdateEvent(
+            static_cast<intmax_t>(event.getStatus()),
+            reinterpret_cast<handle_t>(&_connection_handle),
+            ConnectionParameters {
+                event.getConnectionInterval().valueInUs(),
+                event.getSlaveLatency().value(),
+                event.getSupervisionTimeout().valueInMs()
+            }
+        )
+    );
+}
+
+void MbedBluetoothPlatform::onPhyUpdateComplete(
+    ble_error_t status,
+    ble::connection_handle_t connectionHandle,
+    ble::phy_t txPhy,
+    ble::phy_t rxPhy
+)
+{
+    if (!_is_connecting_or_syncing || connectionHandle != _connection_handle) {
+        return;
+    }
+
+    // ble::phy_t uses the same values as phy_t.
+    getEventHandler()->onPhyUpdate(
+        PhyUpdateEvent(
+            static_cast<intmax_t>(status),
+            reinterpret_cast<handle_t>(&_connection_handle),
+            static_cast<phy_t>(txPhy.value()),
+            static_cast<phy_t>(rxPhy.value())
         )
     );
 }
@@ -408,10 +1097,18 @@ void MbedBluetoothPlatform::onDisconnectionComplete(const ble::DisconnectionComp
     }
 
     _is_connecting_or_syncing = false;
+    _is_streaming = false;
 
     getEventHandler()->onDisconnect();
 }
 
+void MbedBluetoothPlatform::onAttMtuChange(ble::connection_handle_t connectionHandle, uint16_t attMtuSize)
+{
+    if (connectionHandle == _connection_handle) {
+        _att_mtu = attMtuSize;
+    }
+}
+
 void MbedBluetoothPlatform::onPeriodicAdvertisingSyncEstablished(const ble::PeriodicAdvertisingSyncEstablishedEvent &event)
 {
     auto eh = getEventHandler();
@@ -421,7 +1118,7 @@ void MbedBluetoothPlatform::onPeriodicAdvertisingSyncEstablished(const ble::Peri
 
     _is_connecting_or_syncing = true;
 
-    auto handle = event.getSyncHandle();
+    _sync_handle = event.getSyncHandle();
     eh->onPeriodicSync(
         PeriodicSyncEvent(
             static_cast<int32_t>(event.getSid()),
@@ -430,7 +1127,7 @@ void MbedBluetoothPlatform::onPeriodicAdvertisingSyncEstablished(const ble::Peri
             event.getPeerAddress().size(),
             static_cast<intmax_t>(event.getStatus()),
             _is_scanner ? connection_role_t::main : connection_role_t::peripheral,
-            reinterpret_cast<handle_t>(&handle)
+            reinterpret_cast<handle_t>(&_sync_handle)
         )
     );
 }
@@ -17,9 +17,14 @@
 #ifndef BLUETOOTHPLATFORM_H
 #define BLUETOOTHPLATFORM_H
 
+#include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
 
+#include "LogBuffer.h"
+#include "SchedulerStats.h"
+#include "bt_test_params.h"
+
 struct BluetoothPlatform {
     /// Connection role, main or peripheral.
     enum class connection_role_t {
@@ -27,6 +32,13 @@ struct BluetoothPlatform {
         main
     };
 
+    /// LE PHY. The values match the PHY numbers in HCI commands.
+    enum class phy_t : uint8_t {
+        le_1m = 1,
+        le_2m = 2,
+        le_coded = 3
+    };
+
     /// Handle type. May be casted to the platform's handle type and dereferenced if the platform uses value typed
     /// handles.
     using handle_t = void*;
@@ -34,6 +46,40 @@ struct BluetoothPlatform {
     /// Callback for the init, call and callIn methods.
     using callback_t = void(*)(void*);
 
+    /// Identifies a callback scheduled with callIn() so that it can be cancelled. 0 is never a valid id.
+    using timer_id_t = int;
+
+    /// Maximum size of a payload copied by callIn().
+    static constexpr size_t MAX_PAYLOAD_SIZE = 4 * sizeof(void*);
+
+    /// What printf() does during a measurement window.
+    enum class log_mode_t {
+        /// Print straight away, as outside the window.
+        immediate,
+
+        /// Record into a RAM buffer and print when the window ends.
+        deferred,
+
+        /// Discard, counting the discarded messages.
+        quiet
+    };
+
+    /// Counts of scheduler wakeups that ran timed calls.
+    struct WakeupStats {
+        /// Wakeups that ran no call before the end of its slack.
+        uint32_t uncoalesced;
+
+        /// Wakeups that also ran calls before the end of their slack, which would otherwise have needed wakeups of
+        /// their own.
+        uint32_t coalesced;
+
+        /// Calls run before the end of their slack by coalesced wakeups, i.e. wakeups saved.
+        uint32_t coalescedCalls;
+
+        /// Calls posted from interrupts or other threads, which run at whichever wakeup comes next.
+        uint32_t posts;
+    };
+
     /// Event raised when advertising starts.
     struct AdvertisingStartEvent {
         AdvertisingStartEvent(uint32_t durationMs_, bool isPeriodic_, uint32_t periodicIntervalMs_);
@@ -55,11 +101,16 @@ struct BluetoothPlatform {
             uint8_t peerAddressType_,
             const uint8_t *peerAddressData_,
             size_t peerAddressSize_,
-            const char *localName_,
+            const uint8_t *payload_,
+            size_t payloadSize_,
             bool isPeriodic_,
             uint32_t periodicIntervalMs_
         );
 
+        /// Find the shortened or complete local name in the payload, without copying it. name is not null
+        /// terminated. Returns false if there is none.
+        bool findLocalName(const char *&name, size_t &length) const;
+
         /// The SID.
         uint8_t sid;
 
@@ -72,8 +123,11 @@ struct BluetoothPlatform {
         /// The peer address size.
         size_t peerAddressSize;
 
-        /// The local device name.
-        const char *localName;
+        /// The advertising data, as AD structures. Only valid during the call to the event handler.
+        const uint8_t *payload;
+
+        /// The size of the advertising data.
+        size_t payloadSize;
 
         /// Indicates whether periodic advertising is present.
         bool isPeriodic;
@@ -88,6 +142,18 @@ struct BluetoothPlatform {
         uint32_t scanDurationMs;
     };
 
+    /// Parameters of a connection as negotiated by the controllers.
+    struct ConnectionParameters {
+        /// The connection interval in µs.
+        uint32_t intervalUs;
+
+        /// The number of connection events the peripheral may skip.
+        uint16_t latency;
+
+        /// The supervision timeout in ms.
+        uint32_t supervisionTimeoutMs;
+    };
+
     /// Event raised when connected.
     struct ConnectEvent {
         ConnectEvent(
@@ -96,7 +162,8 @@ struct BluetoothPlatform {
             size_t peerAddressSize_,
             intmax_t error_,
             connection_role_t role_,
-            handle_t connectionHandle_
+            handle_t connectionHandle_,
+            const ConnectionParameters &parameters_
         );
         ConnectEvent(intmax_t error_);
 
@@ -117,6 +184,102 @@ struct BluetoothPlatform {
 
         /// The paltform-defined connection handle.
         handle_t connectionHandle;
+
+        /// The parameters the connection was established with.
+        ConnectionParameters parameters;
+    };
+
+    /// Event raised when the parameters of a connection change, at the request of either side.
+    struct ConnectionParametersUpdateEvent {
+        ConnectionParametersUpdateEvent(
+            intmax_t error_,
+            handle_t connectionHandle_,
+            const ConnectionParameters &parameters_
+        );
+
+        /// The platform-defined error code. The parameters are unchanged upon error.
+        intmax_t error;
+
+        /// The platform-defined connection handle.
+        handle_t connectionHandle;
+
+        /// The parameters now in use.
+        ConnectionParameters parameters;
+    };
+
+    /// Event raised when the PHY of a connection has been updated, or an update has failed.
+    struct PhyUpdateEvent {
+        PhyUpdateEvent(intmax_t error_, handle_t connectionHandle_, phy_t txPhy_, phy_t rxPhy_);
+
+        /// The platform-defined error code.
+        intmax_t error;
+
+        /// The platform-defined connection handle.
+        handle_t connectionHandle;
+
+        /// The PHY used to transmit.
+        phy_t txPhy;
+
+        /// The PHY used to receive.
+        phy_t rxPhy;
+    };
+
+    /// Event raised when a GATT throughput run starts: on main once the ATT MTU has been exchanged and the peer's
+    /// throughput characteristic found, on the peripheral when the first write arrives.
+    struct ThroughputStartEvent {
+        ThroughputStartEvent(intmax_t error_, connection_role_t role_, uint16_t attMtu_);
+
+        /// The platform-defined error code. Nothing is streamed upon error.
+        intmax_t error;
+
+        /// The connection role.
+        connection_role_t role;
+
+        /// The ATT MTU in bytes. Each write carries attMtu - 3 bytes of payload.
+        uint16_t attMtu;
+    };
+
+    /// GATT traffic of a workload, with the values of the workload_type parameter.
+    enum class traffic_t : uint8_t {
+        /// Notifications from the peripheral.
+        notification = 1,
+
+        /// Indications from the peripheral, each confirmed by main before the next is sent.
+        indication = 2,
+
+        /// Writes without response from main.
+        write = 3
+    };
+
+    /// Event raised when a workload can start: on main once the ATT MTU has been exchanged, the peer's workload
+    /// characteristic found and, for notifications and indications, subscribed to; on the peripheral when main
+    /// subscribes.
+    struct WorkloadReadyEvent {
+        WorkloadReadyEvent(intmax_t error_, connection_role_t role_, traffic_t traffic_, uint16_t attMtu_);
+
+        /// The platform-defined error code. Nothing can be sent upon error.
+        intmax_t error;
+
+        /// The connection role.
+        connection_role_t role;
+
+        /// The traffic of the workload.
+        traffic_t traffic;
+
+        /// The ATT MTU in bytes. Bursts are split into PDUs of up to attMtu - 3 bytes.
+        uint16_t attMtu;
+    };
+
+    /// Counts of the GATT traffic of a throughput run or workload.
+    struct TrafficStats {
+        /// Payload bytes sent or received.
+        uint64_t bytes;
+
+        /// PDUs sent or received.
+        uint32_t packets;
+
+        /// Time from the start of a throughput run to the last PDU sent or received in ms. 0 for a workload.
+        uint32_t durationMs;
     };
 
     /// Event raised when synced with periodic advertising.
@@ -176,6 +339,18 @@ struct BluetoothPlatform {
         /// Called when connection is established.
         virtual void onConnection(const ConnectEvent &event) {}
 
+        /// Called when the parameters of the connection have been updated.
+        virtual void onConnectionParametersUpdate(const ConnectionParametersUpdateEvent &event) {}
+
+        /// Called when the PHY of the connection has been updated, at the request of either side.
+        virtual void onPhyUpdate(const PhyUpdateEvent &event) {}
+
+        /// Called when a GATT throughput run starts.
+        virtual void onThroughputStart(const ThroughputStartEvent &event) {}
+
+        /// Called when a workload can start.
+        virtual void onWorkloadReady(const WorkloadReadyEvent &event) {}
+
         /// Called upon disconnect.
         virtual void onDisconnect() {}
 
@@ -184,6 +359,9 @@ struct BluetoothPlatform {
 
         /// Called upon loss of periodic sync.
         virtual void onSyncLoss() {}
+
+        /// Called for each character received from the operator, in the order received.
+        virtual void onInput(int c) {}
     };
 
     virtual ~BluetoothPlatform() {}
@@ -194,6 +372,9 @@ struct BluetoothPlatform {
     /// Sets the event handler. nullptr unsets.
     void setEventHandler(EventHandler *eh);
 
+    /// Gets the timings used by the start*() methods. Changes take effect when the next state starts.
+    bt_test_params_t &params();
+
     /// Perform any needed initialisation, then call EventHandler::onInitComplete() if successful.
     /// Returns non-zero status code without calling onInitComplete() upon error.
     virtual int init() = 0;
@@ -210,17 +391,65 @@ struct BluetoothPlatform {
     /// Call a function e.g. using an event queue to avoid stack overflow.
     virtual void call(callback_t fn, void* arg) { fn(arg); }
 
-    /// Call a function after interval elapses.
-    virtual void callIn(uint32_t millis, callback_t fn, void* arg) = 0;
+    /// Call a function after interval elapses. Returns an id for cancel(), or 0 if the call could not be scheduled.
+    virtual timer_id_t callIn(uint32_t millis, callback_t fn, void* arg) = 0;
+
+    /// Call a function once at least `millis` and at most `millis + toleranceMs` have elapsed. The platform picks the
+    /// time within that window so that calls with overlapping windows can share a wakeup. Returns an id for cancel(),
+    /// or 0 if the call could not be scheduled.
+    virtual timer_id_t callIn(uint32_t millis, uint32_t toleranceMs, callback_t fn, void* arg) = 0;
+
+    /// As callIn(millis, toleranceMs, fn, arg), but `fn` gets a pointer to a copy of `size` bytes of `payload`. The
+    /// copy is stored by the platform without heap allocation and is only valid until `fn` returns. `size` must not
+    /// exceed MAX_PAYLOAD_SIZE.
+    virtual timer_id_t callIn(
+        uint32_t millis,
+        uint32_t toleranceMs,
+        callback_t fn,
+        const void* payload,
+        size_t size
+    ) = 0;
+
+    /// Call a function every `periodMs`, starting `periodMs` from now. Calls stay in phase with the first one rather
+    /// than drifting by the dispatch latency. Returns an id for cancel(), or 0 if the call could not be scheduled or
+    /// `periodMs` is 0.
+    virtual timer_id_t callEvery(uint32_t periodMs, callback_t fn, void* arg) = 0;
+
+    /// Cancel a call scheduled with callIn() or callEvery(). Returns false if it has already run, has been cancelled or
+    /// `id` is 0.
+    virtual bool cancel(timer_id_t id) = 0;
+
+    /// Gets counts of scheduler wakeups that ran one or several calls, to verify the effect of toleranceMs.
+    virtual WakeupStats getWakeupStats() = 0;
+
+    /// Gets histograms of how late scheduled calls started and how long they ran. Returns false if they are not
+    /// recorded because CONFIG_SCHED_STATS is not set.
+    virtual bool getSchedulerStats(SchedulerStats &stats) = 0;
+
+    /// Gets the time since boot in ms, for timestamping markers. Wraps after about 49 days.
+    virtual uint32_t uptimeMs() = 0;
 
     /// Print a platform-defined error code.
     virtual void printError(intmax_t error, const char *msg) = 0;
 
-    /// Behaves like cstdio printf().
-    virtual void printf(const char *fmt, ...) = 0;
+    /// Behaves like cstdio printf(), except that during a measurement window output is deferred or discarded according
+    /// to the log mode. Deferred messages are formatted when printed, so fmt must be static and any "%s" arguments are
+    /// copied, truncated if very long. If CONFIG_BINARY_LOG is set, messages are written as binary log records (see
+    /// LogFormat.h) for the host to decode instead of being formatted at all.
+    void printf(const char *fmt, ...);
+
+    /// Gets the log mode, deferred by default.
+    log_mode_t logMode() const;
 
-    /// Behaves like cstdio getchar().
-    virtual int getchar() = 0;
+    /// Sets the log mode. Takes effect at the start of the next measurement window.
+    void setLogMode(log_mode_t mode);
+
+    /// Start or end a measurement window. Ending it prints any deferred messages, followed by the number of messages
+    /// which were dropped because the buffer was full or discarded in quiet mode.
+    void setMeasuring(bool measuring);
+
+    /// Print deferred messages now.
+    void flushLog();
 
     /// Behaves like cstdio putchar().
     virtual void putchar(int c) = 0;
@@ -237,13 +466,18 @@ struct BluetoothPlatform {
     /// Initiates periodic advertising.
     virtual int startPeriodicAdvertising() = 0;
 
+    /// Have the controller report only the advertising of peerAddress (6 bytes, least significant first), public or
+    /// random, when scanning, or of every advertiser if it is nullptr. Must not be called while scanning.
+    virtual int setScanFilter(const uint8_t *peerAddress) = 0;
+
     /// Initiates scanning.
     virtual int startScan() = 0;
 
     /// Initiates scanning for periodic advertising.
     virtual int startScanForPeriodicAdvertising() = 0;
 
-    /// Establish a connection with the given peer.
+    /// Establish a connection with the given peer, requesting the conn_interval range, conn_latency and
+    /// supervision_timeout from params().
     virtual int establishConnection(uint8_t peerAddressType, const uint8_t *peerAddress) = 0;
 
     /// Sync to peer's periodic advertising.
@@ -254,6 +488,28 @@ struct BluetoothPlatform {
         uint32_t syncTimeoutMs
     ) = 0;
 
+    /// Request that a connection use a PHY in both directions. EventHandler::onPhyUpdate() is called when the peer
+    /// and the controller have agreed on the PHYs to use.
+    virtual int setPhy(handle_t connection_handle, phy_t phy) = 0;
+
+    /// Write to the peer's throughput characteristic without response as fast as flow control allows, with the largest
+    /// payload the ATT MTU allows, until disconnection. The ATT MTU and the data length are raised to their maximum
+    /// first, then EventHandler::onThroughputStart() is called. Main only; the peripheral always accepts the writes.
+    virtual int startThroughput(handle_t connection_handle) = 0;
+
+    /// Prepare a workload of the given traffic on the peer's workload characteristic. Main only.
+    /// EventHandler::onWorkloadReady() is called on both boards when the sender, main for writes and the peripheral
+    /// for notifications and indications, may call sendWorkload().
+    virtual int prepareWorkload(handle_t connection_handle, traffic_t traffic) = 0;
+
+    /// Queue a burst of `size` bytes of workload traffic, sent as PDUs of up to the ATT MTU as fast as flow control
+    /// allows. Returns non-zero without queuing anything upon error or if the previous burst is still being queued.
+    virtual int sendWorkload(handle_t connection_handle, size_t size) = 0;
+
+    /// Gets the counts of the throughput run or workload on the current or last connection. Returns false if there
+    /// was none.
+    virtual bool getTrafficStats(TrafficStats &stats) = 0;
+
     /// Trigger disconnection.
     virtual int disconnect(handle_t connection_handle) = 0;
 
@@ -261,11 +517,35 @@ struct BluetoothPlatform {
     virtual int stopSync(handle_t sync_handle) = 0;
 
 protected:
-    BluetoothPlatform() {}
+    BluetoothPlatform();
+
+    /// Writes formatted output to the console straight away. Behaves like cstdio vprintf().
+    virtual void vprint(const char *fmt, va_list args) = 0;
+
+    /// Writes raw bytes to the console straight away, for binary log records.
+    virtual void write(const uint8_t *data, size_t size) = 0;
 
 private:
     static EventHandler _default_handler;
     EventHandler *_event_handler;
+    bt_test_params_t _params;
+
+    // Logging.
+    LogBuffer _log;
+    log_mode_t _log_mode;
+    log_mode_t _window_log_mode;
+    bool _measuring;
+    uint32_t _suppressed;
+
+    // Print as a binary log record if CONFIG_BINARY_LOG is set, otherwise as text.
+    void printImmediate(const char *fmt, ...);
+    void vprintImmediate(const char *fmt, va_list args);
+
+    // Print a log record as a binary frame if CONFIG_BINARY_LOG is set, otherwise as text.
+    void writeRecord(const uint8_t *record, size_t size);
+
+    // Text output for log_print_record().
+    static void printLogged(void *self, const char *fmt, ...);
 };
 
 #endif // ! BLUETOOTHPLATFORM_H
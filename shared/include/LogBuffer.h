@@ -0,0 +1,65 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LOGBUFFER_H
+#define LOGBUFFER_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <config.h>
+
+#include "LogFormat.h"
+
+/// Ring buffer of printf() calls which have not been formatted yet, encoded as log records (see LogFormat.h).
+/// Recording costs a scan of the format string and a copy of the arguments, with strings copied (and truncated if
+/// needed) since they may not outlive the call. Format strings must be string literals or otherwise static.
+/// Not thread safe; all calls must come from the event loop.
+struct LogBuffer {
+    /// Capacity in bytes (CONFIG_LOG_BUFFER_SIZE).
+    static constexpr size_t SIZE = CONFIG_LOG_BUFFER_SIZE;
+
+    LogBuffer();
+
+    LogBuffer(const LogBuffer &) = delete;
+
+    /// Record a call to printf(fmt, ...) made at timestamp (ms). Returns false, and counts the message as dropped, if
+    /// the buffer is full.
+    bool record(uint32_t timestamp, const char *fmt, va_list args);
+
+    /// Remove the oldest record and copy it to record, which holds LOG_MAX_RECORD_SIZE bytes. Returns its size, or 0 if
+    /// the buffer is empty.
+    size_t pop(uint8_t *record);
+
+    /// Number of messages dropped since the last call, which resets it.
+    uint32_t takeDropped();
+
+    /// Whether there are no records.
+    bool empty() const;
+
+private:
+    uint8_t _data[SIZE];
+    size_t _head;
+    size_t _used;
+    uint32_t _dropped;
+
+    // Copy into or out of the ring, wrapping at its end.
+    void write(const uint8_t *data, size_t size);
+    void read(uint8_t *data, size_t size);
+};
+
+#endif // ! LOGBUFFER_H
@@ -0,0 +1,98 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LOGFORMAT_H
+#define LOGFORMAT_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Encoding of a printf() call as a log record, shared by the firmware and the host decoder. A record is:
+//
+//  * the format string id, which is its address, as a varint;
+//  * the timestamp in ms as a varint;
+//  * for each conversion, its '*' width and precision as signed varints, then its argument: a signed varint for %d and
+//    %i, a varint for other integers and pointers, 8 little endian IEEE 754 bytes for floating point, and a length
+//    byte followed by the characters for strings.
+//
+// Varints are LEB128, with signed values zigzag encoded. On the wire, binary log records are framed as LOG_FRAME_SYNC,
+// a length byte and the record. The sync byte never occurs in text, so text and records can share a stream.
+
+/// Byte which starts a binary log frame.
+static constexpr uint8_t LOG_FRAME_SYNC = 0x00;
+
+/// Largest record. Strings are truncated to fit.
+static constexpr size_t LOG_MAX_RECORD_SIZE = 160;
+
+/// Receives formatted output. Behaves like printf().
+using log_print_t = void (*)(void *ctx, const char *fmt, ...);
+
+/// Type of the argument taken by a conversion.
+enum class log_arg_kind_t {
+    NONE, // %% or an unsupported conversion
+    INT,
+    LONG,
+    LONG_LONG,
+    SIZE,
+    INTMAX,
+    PTRDIFF,
+    DOUBLE,
+    POINTER,
+    STRING,
+};
+
+/// A conversion specification in a format string.
+struct log_conversion_t {
+    /// The '%'.
+    const char *start;
+
+    /// Just past the conversion specifier.
+    const char *end;
+
+    log_arg_kind_t kind;
+
+    /// Whether an integer conversion is signed (%d or %i).
+    bool is_signed;
+
+    /// Number of '*' widths and precisions, each taking an int argument.
+    int stars;
+};
+
+/// Parse the conversion specification starting at the '%' at fmt.
+log_conversion_t log_parse_conversion(const char *fmt);
+
+/// Encode a call to printf(fmt, ...) into record, which holds LOG_MAX_RECORD_SIZE bytes. Returns the size of the
+/// record, or 0 if the arguments don't fit even with strings truncated.
+size_t log_encode_record(uint8_t *record, uint32_t timestamp, const char *fmt, va_list args);
+
+/// Decoded id and timestamp of a record.
+struct log_record_header_t {
+    uint64_t id;
+    uint32_t timestamp;
+
+    /// Size of the id and timestamp, after which the arguments start.
+    size_t size;
+};
+
+/// Decode the id and timestamp of a record. Returns false if the record is truncated.
+bool log_decode_header(const uint8_t *record, size_t size, log_record_header_t &header);
+
+/// Print the arguments of a record (starting after its header) with its format string. Returns false if the record
+/// is truncated, in which case output stops at the missing argument.
+bool log_print_record(const uint8_t *args, size_t size, const char *fmt, log_print_t print, void *ctx);
+
+#endif // ! LOGFORMAT_H
@@ -0,0 +1,68 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PARAMETERSWEEP_H
+#define PARAMETERSWEEP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bt_test_params.h"
+
+/// Matrix of test parameter values. Each axis is a parameter with a list of values, and the points of the sweep are
+/// every combination of them, each repeated a number of times. Points are numbered so that the last axis changes
+/// fastest and repetitions of the same combination are adjacent.
+struct ParameterSweep {
+    static constexpr size_t MAX_AXES = 4;
+    static constexpr size_t MAX_VALUES = 8;
+
+    struct Axis {
+        const bt_test_param_info_t *param;
+        uint32_t values[MAX_VALUES];
+        size_t count;
+    };
+
+    ParameterSweep();
+
+    /// Number of times each combination is run, at least 1.
+    uint32_t repetitions;
+
+    /// Set the values of the axis for a parameter, replacing any existing axis for it. A count of 0 removes the axis.
+    /// Returns false if there are already MAX_AXES other axes or count exceeds MAX_VALUES.
+    bool setAxis(const bt_test_param_info_t *param, const uint32_t *values, size_t count);
+
+    /// Remove all axes.
+    void clear();
+
+    size_t axisCount() const;
+
+    const Axis &axis(size_t index) const;
+
+    /// Number of points including repetitions. 0 if the count would overflow.
+    uint32_t pointCount() const;
+
+    /// Store the values of a point in params, leaving parameters without an axis unchanged.
+    void apply(uint32_t point, bt_test_params_t &params) const;
+
+    /// Gets the repetition (from 0) of a point.
+    uint32_t repetition(uint32_t point) const;
+
+private:
+    Axis _axes[MAX_AXES];
+    size_t _axis_count;
+};
+
+#endif // ! PARAMETERSWEEP_H
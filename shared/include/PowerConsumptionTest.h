@@ -18,12 +18,24 @@
 #define TEST_BASE_H 1
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "bt_test_state.h"
 #include "BluetoothPlatform.h"
+#include "ParameterSweep.h"
 
 struct PowerConsumptionTest : protected BluetoothPlatform::EventHandler {
     static constexpr size_t MAC_ADDRESS_LENGTH = 2*6; // Six 2-digit bytes.
+    static constexpr size_t DEVICE_NAME_LENGTH = 29; // Longest name which fits in legacy advertising data.
+    static constexpr size_t PARAM_LINE_LENGTH = 32;
+    static constexpr size_t SWEEP_LINE_LENGTH = 128;
+    static constexpr size_t SCRIPT_LENGTH = 256;
+
+    /// Characters typed ahead while no input is expected, which are kept until a prompt takes them.
+    static constexpr size_t INPUT_QUEUE_SIZE = 16;
+
+    /// Idle time between the steps of a sweep, so that each step is framed by a baseline in the power trace.
+    static constexpr uint32_t SWEEP_SETTLE_TIME = 1000;
 
     PowerConsumptionTest(BluetoothPlatform &platform);
 
@@ -31,8 +43,13 @@ struct PowerConsumptionTest : protected BluetoothPlatform::EventHandler {
 
     ~PowerConsumptionTest();
 
+    /// Initialise the platform and run the event loop. Does not return on the boards.
     void run();
 
+    /// Initialise the platform without running the event loop, for hosts which dispatch the platform's events
+    /// themselves, such as a simulation running many programs.
+    void start();
+
 protected:
     void onInitComplete() override;
 
@@ -44,27 +61,159 @@ protected:
     void onScanTimeout() override;
 
     void onConnection(const BluetoothPlatform::ConnectEvent &event) override;
+    void onConnectionParametersUpdate(const BluetoothPlatform::ConnectionParametersUpdateEvent &event) override;
+    void onPhyUpdate(const BluetoothPlatform::PhyUpdateEvent &event) override;
+    void onThroughputStart(const BluetoothPlatform::ThroughputStartEvent &event) override;
+    void onWorkloadReady(const BluetoothPlatform::WorkloadReadyEvent &event) override;
     void onDisconnect() override;
 
     void onPeriodicSync(const BluetoothPlatform::PeriodicSyncEvent &event) override;
     void onSyncLoss() override;
 
+    void onInput(int c) override;
+
 private:
+    /// What onInput() does with the next character.
+    enum class input_mode_t {
+        /// No input is expected. A key stops a running sweep or script, or is queued for the next prompt otherwise.
+        NONE,
+
+        /// A menu command.
+        COMMAND,
+
+        /// Digits of the target MAC.
+        MAC,
+
+        /// A line for _line_handler.
+        LINE,
+    };
+
+    using line_handler_t = void (PowerConsumptionTest::*)(char *line);
+
     /// Enter next state according to operator input.
     void nextState();
 
-    /// Start advertising.
-    void advertise();
+    /// Wait for a menu command.
+    void promptCommand();
+
+    /// Pass the next characters to the handler of `mode`, starting with any that were typed ahead.
+    void expectInput(input_mode_t mode);
+
+    /// Pass a character to the handler of the current input mode.
+    void handleInput(int c);
+
+    /// Run a menu command.
+    void onCommandInput(int c);
 
-    /// Start scanning.
-    void scan();
+    /// Start advertising. Returns non-zero upon error.
+    int advertise();
+
+    /// Start scanning. Returns non-zero upon error.
+    int scan();
 
     /// Handles the `p` command to toggle the period flag.
     void togglePeriodic();
 
+    /// Handles the `g` command to toggle GATT throughput streaming.
+    void toggleThroughput();
+
+    /// Handles the `o` command to cycle the log mode used during measurements.
+    void cycleLogMode();
+
+    /// Gets the name of a log mode for printing.
+    static const char *logModeName(BluetoothPlatform::log_mode_t mode);
+
     /// Handles the `m` command to set/unset target MAC address.
     void readTargetMac();
 
+    /// Handles input to the `m` command.
+    void onMacInput(int c);
+
+    /// Set the target MAC from its hex digits, or unset it if there are none.
+    void setTargetMac(const char *mac);
+
+    /// Whether a report is from the target, by MAC or, if none is set, by name.
+    bool isTarget(const BluetoothPlatform::AdvertisingReportEvent &event) const;
+
+    /// Format the name and MAC of a report's peer for printing. name holds DEVICE_NAME_LENGTH + 1 characters and mac
+    /// MAC_ADDRESS_LENGTH + 1.
+    static void formatPeer(const BluetoothPlatform::AdvertisingReportEvent &event, char *name, char *mac);
+
+    /// Handles the `w` command to print scheduler wakeup statistics.
+    void printWakeupStats();
+
+    /// Handles the `l` command to print scheduler lateness and callback duration histograms.
+    void printSchedulerStats();
+
+    /// Handles the `v` command to print the timing parameters.
+    void printParams();
+
+    /// Handles the `t` command to set a timing parameter.
+    void readParam();
+
+    /// Set a timing parameter from "<name> <ms>".
+    void setParam(char *line);
+
+    /// Read a line of input of up to size - 1 characters, echoing it, and pass it to handler.
+    void readLine(size_t size, line_handler_t handler);
+
+    /// Handles input to readLine().
+    void onLineInput(int c);
+
+    /// Handles the `x` command to configure or start a parameter sweep.
+    void readSweep();
+
+    /// Run a line of input to the `x` command.
+    void runSweepCommand(char *line);
+
+    /// Set the sweep values of a parameter from a list separated by spaces or commas.
+    void readSweepAxis(const char *name, char *values);
+
+    /// Print the swept parameters and their values.
+    void printSweep();
+
+    /// Run every point of the sweep, advertising or scanning at each.
+    void startSweep(bool scanner, uint32_t repetitions);
+
+    /// Start the next point of the sweep, or end the sweep after the last one.
+    void runSweepStep();
+
+    /// Handles the `b` command to read and run a script.
+    void readScript();
+
+    /// Check and run a script.
+    void startScript(char *line);
+
+    /// Copy the script command at position into command and move position to the next one. Returns false at the end.
+    bool nextScriptCommand(size_t &position, char *command, size_t size);
+
+    /// Whether a command is valid in a script. Arguments other than those of wait and repeat are checked when run.
+    bool isScriptCommand(const char *command);
+
+    /// Run the next command of the script, or end the script after the last one.
+    void runScriptStep();
+
+    /// Run a script command as if it had been entered at the menu.
+    void runScriptCommand(char *command);
+
+    /// Gets the name of a PHY for printing.
+    static const char *phyName(BluetoothPlatform::phy_t phy);
+
+    /// Prints the negotiated parameters of a connection.
+    void printConnectionParameters(const BluetoothPlatform::ConnectionParameters &parameters);
+
+    /// Prints goodput and packets per connection event at the end of a throughput run.
+    void printThroughputStats();
+
+    /// Queue a workload burst.
+    void sendWorkloadBurst();
+
+    /// Prints the burst and traffic counts at the end of a workload.
+    void printWorkloadStats();
+
+    /// Gets the name of workload traffic for printing.
+    static const char *trafficName(BluetoothPlatform::traffic_t traffic);
+
     /// Called when state transitions.
     void updateState(bt_test_state_t state);
 
@@ -72,10 +221,66 @@ private:
     bool isPeriodic() const;
 private:
     BluetoothPlatform &_platform;
-    char _target_mac[MAC_ADDRESS_LENGTH + 1];
-    size_t _target_mac_len = 0;
+    uint8_t _target_address[MAC_ADDRESS_LENGTH/2];
+    bool _has_target_address = false;
+    size_t _device_name_length;
     bt_test_state_t _state;
     bool _is_periodic = false;
+    bool _is_throughput = false;
+
+    // Connection interval in use, to count the connection events of a throughput run.
+    uint32_t _conn_interval_us = 0;
+
+    // Set once a throughput run has started on the current connection. Main is back in START by the time it is told
+    // of a disconnect which it triggered, so the state cannot tell which stats to print.
+    bool _has_throughput_run = false;
+
+    // Workload sent every workload_period while connected, and counts of the bursts queued and of those skipped
+    // because the previous one was still being queued.
+    BluetoothPlatform::handle_t _workload_connection = nullptr;
+    BluetoothPlatform::timer_id_t _workload_timer = 0;
+    uint32_t _workload_bursts = 0;
+    uint32_t _workload_skipped = 0;
+
+    // Pending triggerDisconnect/triggerDesync call, cancelled if the link is lost first.
+    BluetoothPlatform::timer_id_t _disconnect_timer = 0;
+
+    // Parameter sweep. While it runs, nextState() starts the next point instead of waiting for a command, and the
+    // parameters from before the sweep are restored when it ends.
+    ParameterSweep _sweep;
+    bt_test_params_t _sweep_saved_params;
+    bool _sweep_running = false;
+    bool _sweep_step_running = false;
+    bool _sweep_scanner = false;
+    uint32_t _sweep_point = 0;
+    uint32_t _sweep_points = 0;
+
+    // Script read by the `b` command. While it runs, nextState() runs the next command instead of waiting for one.
+    // Commands from _script_segment up to the repeat at _script_repeat_position have run _script_repeats times.
+    char _script[SCRIPT_LENGTH];
+    size_t _script_position = 0;
+    size_t _script_segment = 0;
+    size_t _script_repeat_position = SIZE_MAX;
+    uint32_t _script_repeats = 0;
+    bool _script_running = false;
+    bool _script_step_running = false;
+
+    // Set by a key press during a sweep or script, which then stops when the current step ends.
+    bool _stop_requested = false;
+
+    // Input state; see onInput().
+    input_mode_t _input_mode = input_mode_t::NONE;
+    char _line[SCRIPT_LENGTH];
+    size_t _line_length = 0;
+    size_t _line_limit = 0;
+    line_handler_t _line_handler = nullptr;
+    int _previous_input = 0;
+
+    // Ring of characters typed while the input mode was NONE, outside sweeps and scripts, replayed by expectInput().
+    char _input_queue[INPUT_QUEUE_SIZE];
+    size_t _input_queue_start = 0;
+    size_t _input_queue_count = 0;
+    bool _is_replaying_input = false;
 
     // Trigger disconnection/de-sync. arg is a pointer to DisconnectContext (see PowerConsumptionTest.cpp).
     static void triggerDisconnect(void* arg);
@@ -84,6 +289,15 @@ private:
     // Call BluetoothPlatform::nextState. arg is a pointer to this.
     static void callNextState(void* arg);
 
+    // Call runSweepStep. arg is a pointer to this.
+    static void callRunSweepStep(void* arg);
+
+    // Call runScriptStep. arg is a pointer to this.
+    static void callRunScriptStep(void* arg);
+
+    // Call sendWorkloadBurst. arg is a pointer to this.
+    static void callSendWorkloadBurst(void* arg);
+
     // Call BluetoothPlatform::printf. arg is a pointer to this.
     static void callPrintf(void* arg, const char* s);
 };
@@ -0,0 +1,64 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SCHEDULERSTATS_H
+#define SCHEDULERSTATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Histogram of durations in microseconds with power-of-two buckets.
+/// Bucket 0 counts 0 us, bucket i counts [2^(i-1), 2^i) us and the last bucket counts everything from
+/// 2^(BUCKETS-2) us (about 4 s) upwards. Recording is constant time and never allocates.
+struct DurationHistogram {
+    static constexpr size_t BUCKETS = 24;
+
+    uint32_t counts[BUCKETS];
+
+    /// Largest value recorded.
+    uint32_t max;
+
+    void record(uint32_t us)
+    {
+        size_t bucket = 0;
+        while (us >> bucket && bucket < BUCKETS - 1) {
+            bucket++;
+        }
+
+        counts[bucket]++;
+        if (us > max) {
+            max = us;
+        }
+    }
+
+    /// Lower bound in us of the given bucket.
+    static uint32_t lowerBound(size_t bucket)
+    {
+        return bucket == 0 ? 0 : uint32_t(1) << (bucket - 1);
+    }
+};
+
+/// Scheduler instrumentation, recorded for each dispatched call when CONFIG_SCHED_STATS is set.
+struct SchedulerStats {
+    /// Time from when a call was due (its deadline, or when it was posted) until it started. This includes any
+    /// tolerance used to share a wakeup and any time spent waiting behind other calls.
+    DurationHistogram lateness;
+
+    /// Time the callback ran for.
+    DurationHistogram duration;
+};
+
+#endif // ! SCHEDULERSTATS_H
@@ -0,0 +1,79 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef BT_PARAMS_H
+#define BT_PARAMS_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <config.h>
+
+/// Test parameters which can be changed at runtime, as F(NAME, DEFAULT, MIN, MAX, UNIT, DESCRIPTION). The limits of
+/// Bluetooth parameters are the widest that the Bluetooth spec allows for the corresponding HCI parameter.
+#define BT_TEST_PARAM_LIST(F)                                                                                          \
+    F(scan_time,           CONFIG_SCAN_TIME,         10,  655350,    "ms",     "How long to scan for a peer")          \
+    F(scan_interval,       10,                       3,   10240,     "ms",     "Scan interval")                        \
+    F(scan_window,         10,                       3,   10240,     "ms",     "Scan window, at most scan_interval")   \
+    F(active_scan,         CONFIG_ACTIVE_SCAN,       0,   1,         "",       "1 = active scan, 0 = passive")         \
+    F(advertise_time,      CONFIG_ADVERTISE_TIME,    10,  655350,    "ms",     "How long to advertise")                \
+    F(adv_interval,        100,                      20,  10240,     "ms",     "Minimum advertising interval")         \
+    F(adv_interval_span,   50,                       0,   10240,     "ms",     "Range allowed above adv_interval")     \
+    F(connect_time,        CONFIG_CONNECT_TIME,      1,   INT32_MAX, "ms",     "How long main stays connected/synced") \
+    F(periodic_interval,   CONFIG_PERIODIC_INTERVAL, 8,   81918,     "ms",     "Periodic advertising interval")        \
+    F(sync_timeout,        5000,                     100, 163840,    "ms",     "Periodic sync supervision timeout")    \
+    F(conn_interval,       30,                       8,   4000,      "ms",     "Minimum connection interval")          \
+    F(conn_interval_span,  20,                       0,   3992,      "ms",     "Range allowed above conn_interval")    \
+    F(conn_latency,        0,                        0,   499,       "events", "Peripheral latency")                   \
+    F(supervision_timeout, 4000,                     100, 32000,     "ms",     "Connection supervision timeout")       \
+    F(phy,                 1,                        1,   3,         "",       "PHY: 1 = 1M, 2 = 2M, 3 = Coded")       \
+    F(workload_period,     0,                        0,   3600000,   "ms",     "Workload burst period, 0 for none")    \
+    F(workload_size,       20,                       1,   65535,     "bytes",  "Bytes per workload burst")             \
+    F(workload_type,       1,                        1,   3,         "",       "1 = notify, 2 = indicate, 3 = write")
+
+/// Values of the parameters in BT_TEST_PARAM_LIST, initialised to their defaults.
+struct bt_test_params_t {
+#define BT_PARAM_DEFINE_FIELD(NAME, DEFAULT, MIN, MAX, UNIT, DESCRIPTION) uint32_t NAME = DEFAULT;
+    BT_TEST_PARAM_LIST(BT_PARAM_DEFINE_FIELD)
+#undef BT_PARAM_DEFINE_FIELD
+};
+
+/// Description of a parameter for listing and setting it by name.
+struct bt_test_param_info_t {
+    const char *name;
+    const char *description;
+    const char *unit;
+    uint32_t min;
+    uint32_t max;
+    uint32_t bt_test_params_t::*field;
+};
+
+/// Gets the descriptions of all parameters, in the order of BT_TEST_PARAM_LIST.
+inline const bt_test_param_info_t *get_bt_test_param_infos(size_t *count)
+{
+    static const bt_test_param_info_t infos[] = {
+#define BT_PARAM_DEFINE_INFO(NAME, DEFAULT, MIN, MAX, UNIT, DESCRIPTION) \
+        { #NAME, DESCRIPTION, UNIT, MIN, MAX, &bt_test_params_t::NAME },
+        BT_TEST_PARAM_LIST(BT_PARAM_DEFINE_INFO)
+#undef BT_PARAM_DEFINE_INFO
+    };
+
+    *count = sizeof(infos) / sizeof(infos[0]);
+    return infos;
+}
+
+#undef BT_TEST_PARAM_LIST
+
+#endif // ! BT_PARAMS_H
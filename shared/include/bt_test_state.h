@@ -21,7 +21,9 @@
     F(SCAN)                 \
     F(ADVERTISE)            \
     F(CONNECT_PERIPHERAL) \
-    F(CONNECT_MAIN)
+    F(CONNECT_MAIN)         \
+    F(THROUGHPUT_PERIPHERAL) \
+    F(THROUGHPUT_MAIN)
 
 enum class bt_test_state_t {
 #define BT_STATE_DEFINE_ENUM(NAME) NAME,
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -21,6 +22,13 @@
 
 BluetoothPlatform::EventHandler BluetoothPlatform::_default_handler;
 
+BluetoothPlatform::BluetoothPlatform()
+: _log_mode(log_mode_t::deferred)
+, _window_log_mode(log_mode_t::immediate)
+, _measuring(false)
+, _suppressed(0)
+{}
+
 BluetoothPlatform::EventHandler *BluetoothPlatform::getEventHandler()
 {
     return _event_handler;
@@ -35,6 +43,123 @@ void BluetoothPlatform::setEventHandler(BluetoothPlatform::EventHandler *eh)
     }
 }
 
+bt_test_params_t &BluetoothPlatform::params()
+{
+    return _params;
+}
+
+void BluetoothPlatform::printf(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    switch (_measuring ? _window_log_mode : log_mode_t::immediate) {
+        case log_mode_t::immediate:
+            vprintImmediate(fmt, args);
+            break;
+        case log_mode_t::deferred:
+            _log.record(uptimeMs(), fmt, args);
+            break;
+        case log_mode_t::quiet:
+            _suppressed++;
+            break;
+    }
+    va_end(args);
+}
+
+BluetoothPlatform::log_mode_t BluetoothPlatform::logMode() const
+{
+    return _log_mode;
+}
+
+void BluetoothPlatform::setLogMode(log_mode_t mode)
+{
+    _log_mode = mode;
+}
+
+void BluetoothPlatform::setMeasuring(bool measuring)
+{
+    if (measuring == _measuring) {
+        return;
+    }
+
+    // The mode is latched for the whole window so that changing it can't strand deferred messages.
+    _measuring = measuring;
+    if (measuring) {
+        _window_log_mode = _log_mode;
+    } else {
+        flushLog();
+    }
+}
+
+void BluetoothPlatform::flushLog()
+{
+    uint8_t record[LOG_MAX_RECORD_SIZE];
+    for (size_t size = _log.pop(record); size > 0; size = _log.pop(record)) {
+        writeRecord(record, size);
+    }
+
+    auto dropped = _log.takeDropped();
+    if (dropped > 0) {
+        printImmediate("[%lu log messages dropped, buffer full]\n", static_cast<unsigned long>(dropped));
+    }
+
+    if (_suppressed > 0) {
+        printImmediate("[%lu log messages suppressed]\n", static_cast<unsigned long>(_suppressed));
+        _suppressed = 0;
+    }
+}
+
+void BluetoothPlatform::printImmediate(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vprintImmediate(fmt, args);
+    va_end(args);
+}
+
+void BluetoothPlatform::vprintImmediate(const char *fmt, va_list args)
+{
+#if CONFIG_BINARY_LOG
+    // Messages too long for a record fall back to text.
+    va_list text_args;
+    va_copy(text_args, args);
+    uint8_t record[LOG_MAX_RECORD_SIZE];
+    auto size = log_encode_record(record, uptimeMs(), fmt, args);
+    if (size > 0) {
+        writeRecord(record, size);
+    } else {
+        vprint(fmt, text_args);
+    }
+    va_end(text_args);
+#else
+    vprint(fmt, args);
+#endif
+}
+
+void BluetoothPlatform::writeRecord(const uint8_t *record, size_t size)
+{
+#if CONFIG_BINARY_LOG
+    const uint8_t frame[] = { LOG_FRAME_SYNC, static_cast<uint8_t>(size) };
+    write(frame, sizeof(frame));
+    write(record, size);
+#else
+    // Records made by this image refer to its format strings by address.
+    log_record_header_t header;
+    if (log_decode_header(record, size, header)) {
+        auto fmt = reinterpret_cast<const char *>(static_cast<uintptr_t>(header.id));
+        log_print_record(record + header.size, size - header.size, fmt, &printLogged, this);
+    }
+#endif
+}
+
+void BluetoothPlatform::printLogged(void *self, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    static_cast<BluetoothPlatform *>(self)->vprint(fmt, args);
+    va_end(args);
+}
+
 BluetoothPlatform::AdvertisingStartEvent::AdvertisingStartEvent(
     uint32_t durationMs_,
     bool isPeriodic_,
@@ -50,7 +175,8 @@ BluetoothPlatform::AdvertisingReportEvent::AdvertisingReportEvent(
     uint8_t peerAddressType_,
     const uint8_t *peerAddressData_,
     size_t peerAddressSize_,
-    const char *localName_,
+    const uint8_t *payload_,
+    size_t payloadSize_,
     bool isPeriodic_,
     uint32_t periodicIntervalMs_
 )
@@ -58,11 +184,37 @@ BluetoothPlatform::AdvertisingReportEvent::AdvertisingReportEvent(
 , peerAddressType(peerAddressType_)
 , peerAddressData(peerAddressData_)
 , peerAddressSize(peerAddressSize_)
-, localName(localName_)
+, payload(payload_)
+, payloadSize(payloadSize_)
 , isPeriodic(isPeriodic_)
 , periodicIntervalMs(periodicIntervalMs_)
 {}
 
+bool BluetoothPlatform::AdvertisingReportEvent::findLocalName(const char *&name, size_t &length) const
+{
+    // Each AD structure is a length byte, covering the type byte and the data, then the type and the data.
+    static constexpr uint8_t SHORTENED_LOCAL_NAME = 0x08;
+    static constexpr uint8_t COMPLETE_LOCAL_NAME = 0x09;
+    size_t position = 0;
+    while (position + 1 < payloadSize) {
+        size_t size = payload[position];
+        if (size == 0 || position + 1 + size > payloadSize) {
+            break;
+        }
+
+        auto type = payload[position + 1];
+        if (type == SHORTENED_LOCAL_NAME || type == COMPLETE_LOCAL_NAME) {
+            name = reinterpret_cast<const char *>(&payload[position + 2]);
+            length = size - 1;
+            return true;
+        }
+
+        position += 1 + size;
+    }
+
+    return false;
+}
+
 BluetoothPlatform::ScanStartEvent::ScanStartEvent(uint32_t scanDurationMs_)
 : scanDurationMs(scanDurationMs_)
 {}
@@ -91,7 +243,8 @@ BluetoothPlatform::ConnectEvent::ConnectEvent(
     size_t peerAddressSize_,
     intmax_t error_,
     BluetoothPlatform::connection_role_t role_,
-    BluetoothPlatform::handle_t connectionHandle_
+    BluetoothPlatform::handle_t connectionHandle_,
+    const BluetoothPlatform::ConnectionParameters &parameters_
 )
 : peerAddressType(peerAddressType_)
 , peerAddressData(peerAddressData_)
@@ -99,8 +252,52 @@ BluetoothPlatform::ConnectEvent::ConnectEvent(
 , error(error_)
 , role(role_)
 , connectionHandle(connectionHandle_)
+, parameters(parameters_)
+{}
+
+BluetoothPlatform::ConnectEvent::ConnectEvent(intmax_t error_) : error(error_), parameters()
+{}
+
+BluetoothPlatform::PhyUpdateEvent::PhyUpdateEvent(
+    intmax_t error_,
+    BluetoothPlatform::handle_t connectionHandle_,
+    BluetoothPlatform::phy_t txPhy_,
+    BluetoothPlatform::phy_t rxPhy_
+)
+: error(error_)
+, connectionHandle(connectionHandle_)
+, txPhy(txPhy_)
+, rxPhy(rxPhy_)
+{}
+
+BluetoothPlatform::ThroughputStartEvent::ThroughputStartEvent(
+    intmax_t error_,
+    BluetoothPlatform::connection_role_t role_,
+    uint16_t attMtu_
+)
+: error(error_)
+, role(role_)
+, attMtu(attMtu_)
 {}
 
+BluetoothPlatform::WorkloadReadyEvent::WorkloadReadyEvent(
+    intmax_t error_,
+    BluetoothPlatform::connection_role_t role_,
+    BluetoothPlatform::traffic_t traffic_,
+    uint16_t attMtu_
+)
+: error(error_)
+, role(role_)
+, traffic(traffic_)
+, attMtu(attMtu_)
+{}
 
-BluetoothPlatform::ConnectEvent::ConnectEvent(intmax_t error_) : error(error_)
+BluetoothPlatform::ConnectionParametersUpdateEvent::ConnectionParametersUpdateEvent(
+    intmax_t error_,
+    BluetoothPlatform::handle_t connectionHandle_,
+    const BluetoothPlatform::ConnectionParameters &parameters_
+)
+: error(error_)
+, connectionHandle(connectionHandle_)
+, parameters(parameters_)
 {}
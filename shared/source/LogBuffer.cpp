@@ -0,0 +1,86 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <LogBuffer.h>
+
+// Each record is stored after a byte holding its size.
+static_assert(LOG_MAX_RECORD_SIZE <= UINT8_MAX, "record size must fit in a byte");
+
+LogBuffer::LogBuffer() : _head(0), _used(0), _dropped(0)
+{}
+
+bool LogBuffer::record(uint32_t timestamp, const char *fmt, va_list args)
+{
+    uint8_t record[LOG_MAX_RECORD_SIZE];
+    auto size = log_encode_record(record, timestamp, fmt, args);
+    if (size == 0 || size + 1 > SIZE - _used) {
+        _dropped++;
+        return false;
+    }
+
+    auto size_byte = static_cast<uint8_t>(size);
+    write(&size_byte, 1);
+    write(record, size);
+    return true;
+}
+
+size_t LogBuffer::pop(uint8_t *record)
+{
+    if (_used == 0) {
+        return 0;
+    }
+
+    uint8_t size;
+    read(&size, 1);
+    read(record, size);
+    return size;
+}
+
+uint32_t LogBuffer::takeDropped()
+{
+    auto dropped = _dropped;
+    _dropped = 0;
+    return dropped;
+}
+
+bool LogBuffer::empty() const
+{
+    return _used == 0;
+}
+
+void LogBuffer::write(const uint8_t *data, size_t size)
+{
+    auto tail = (_head + _used) % SIZE;
+    for (size_t i = 0; i < size; i++) {
+        _data[(tail + i) % SIZE] = data[i];
+    }
+
+    _used += size;
+}
+
+void LogBuffer::read(uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        data[i] = _data[(_head + i) % SIZE];
+    }
+
+    _head = (_head + size) % SIZE;
+    _used -= size;
+}
@@ -0,0 +1,377 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <LogFormat.h>
+
+namespace {
+
+// Appends fields to a record, failing once it is full.
+struct Encoder {
+    uint8_t *data;
+    size_t size;
+    bool full;
+
+    void putByte(uint8_t byte)
+    {
+        if (size == LOG_MAX_RECORD_SIZE) {
+            full = true;
+            return;
+        }
+
+        data[size++] = byte;
+    }
+
+    void putVarint(uint64_t value)
+    {
+        while (value >= 0x80) {
+            putByte(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+
+        putByte(static_cast<uint8_t>(value));
+    }
+
+    void putSignedVarint(int64_t value)
+    {
+        putVarint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+    }
+
+    void putDouble(double value)
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        for (int i = 0; i < 8; i++) {
+            putByte(static_cast<uint8_t>(bits >> (8 * i)));
+        }
+    }
+
+    void putString(const char *s)
+    {
+        // Truncate to whatever room is left after the length byte.
+        size_t length = s == nullptr ? 0 : strlen(s);
+        size_t room = size < LOG_MAX_RECORD_SIZE ? LOG_MAX_RECORD_SIZE - size - 1 : 0;
+        length = length < room ? length : room;
+        length = length < UINT8_MAX ? length : UINT8_MAX;
+        putByte(static_cast<uint8_t>(length));
+        if (!full) {
+            memcpy(&data[size], s, length);
+            size += length;
+        }
+    }
+};
+
+// Reads fields from a record, failing at its end.
+struct Decoder {
+    const uint8_t *data;
+    size_t size;
+    bool truncated;
+
+    uint8_t getByte()
+    {
+        if (size == 0) {
+            truncated = true;
+            return 0;
+        }
+
+        size--;
+        return *data++;
+    }
+
+    uint64_t getVarint()
+    {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            auto byte = getByte();
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                break;
+            }
+        }
+
+        return value;
+    }
+
+    int64_t getSignedVarint()
+    {
+        auto value = getVarint();
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    double getDouble()
+    {
+        uint64_t bits = 0;
+        for (int i = 0; i < 8; i++) {
+            bits |= static_cast<uint64_t>(getByte()) << (8 * i);
+        }
+
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+};
+
+// Integer argument with the type its conversion expects on this machine.
+template<typename T>
+void printConversion(log_print_t print, void *ctx, const char *spec, int stars, const int *star_values, T value)
+{
+    switch (stars) {
+        case 0: print(ctx, spec, value); break;
+        case 1: print(ctx, spec, star_values[0], value); break;
+        default: print(ctx, spec, star_values[0], star_values[1], value); break;
+    }
+}
+
+template<typename SIGNED, typename UNSIGNED>
+void printInteger(
+    log_print_t print,
+    void *ctx,
+    const char *spec,
+    const log_conversion_t &conversion,
+    const int *star_values,
+    Decoder &decoder
+)
+{
+    if (conversion.is_signed) {
+        auto value = static_cast<SIGNED>(decoder.getSignedVarint());
+        printConversion(print, ctx, spec, conversion.stars, star_values, value);
+    } else {
+        auto value = static_cast<UNSIGNED>(decoder.getVarint());
+        printConversion(print, ctx, spec, conversion.stars, star_values, value);
+    }
+}
+
+} // namespace
+
+log_conversion_t log_parse_conversion(const char *fmt)
+{
+    log_conversion_t conversion = {fmt, fmt + 1, log_arg_kind_t::NONE, false, 0};
+    auto c = conversion.end;
+    while (*c != '\0' && strchr("-+ #0", *c) != nullptr) {
+        c++;
+    }
+
+    // Width and precision.
+    for (int part = 0; part < 2; part++) {
+        if (part == 1) {
+            if (*c != '.') {
+                break;
+            }
+
+            c++;
+        }
+
+        if (*c == '*') {
+            conversion.stars++;
+            c++;
+        } else {
+            while (*c >= '0' && *c <= '9') {
+                c++;
+            }
+        }
+    }
+
+    // Length modifier.
+    auto kind = log_arg_kind_t::INT;
+    if (c[0] == 'h') {
+        c += c[1] == 'h' ? 2 : 1;
+    } else if (c[0] == 'l') {
+        kind = c[1] == 'l' ? log_arg_kind_t::LONG_LONG : log_arg_kind_t::LONG;
+        c += c[1] == 'l' ? 2 : 1;
+    } else if (c[0] == 'z') {
+        kind = log_arg_kind_t::SIZE;
+        c++;
+    } else if (c[0] == 'j') {
+        kind = log_arg_kind_t::INTMAX;
+        c++;
+    } else if (c[0] == 't') {
+        kind = log_arg_kind_t::PTRDIFF;
+        c++;
+    }
+
+    switch (*c) {
+        case 'd': case 'i':
+            conversion.kind = kind;
+            conversion.is_signed = true;
+            break;
+        case 'u': case 'o': case 'x': case 'X': case 'c':
+            conversion.kind = kind;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            conversion.kind = log_arg_kind_t::DOUBLE;
+            break;
+        case 'p':
+            conversion.kind = log_arg_kind_t::POINTER;
+            break;
+        case 's':
+            conversion.kind = log_arg_kind_t::STRING;
+            break;
+        default:
+            // %% and anything unsupported take no argument; an unsupported conversion prints nothing.
+            conversion.stars = 0;
+            break;
+    }
+
+    conversion.end = *c == '\0' ? c : c + 1;
+    return conversion;
+}
+
+size_t log_encode_record(uint8_t *record, uint32_t timestamp, const char *fmt, va_list args)
+{
+    Encoder encoder = {record, 0, false};
+    encoder.putVarint(reinterpret_cast<uintptr_t>(fmt));
+    encoder.putVarint(timestamp);
+
+    for (auto c = strchr(fmt, '%'); c != nullptr; c = strchr(c, '%')) {
+        auto conversion = log_parse_conversion(c);
+        c = conversion.end;
+        for (int i = 0; i < conversion.stars; i++) {
+            encoder.putSignedVarint(va_arg(args, int));
+        }
+
+        if (conversion.is_signed) {
+            switch (conversion.kind) {
+                case log_arg_kind_t::INT:       encoder.putSignedVarint(va_arg(args, int));       break;
+                case log_arg_kind_t::LONG:      encoder.putSignedVarint(va_arg(args, long));      break;
+                case log_arg_kind_t::LONG_LONG: encoder.putSignedVarint(va_arg(args, long long)); break;
+                case log_arg_kind_t::SIZE:      encoder.putSignedVarint(va_arg(args, ptrdiff_t)); break;
+                case log_arg_kind_t::INTMAX:    encoder.putSignedVarint(va_arg(args, intmax_t));  break;
+                case log_arg_kind_t::PTRDIFF:   encoder.putSignedVarint(va_arg(args, ptrdiff_t)); break;
+                default:                                                                          break;
+            }
+
+            continue;
+        }
+
+        switch (conversion.kind) {
+            case log_arg_kind_t::NONE:                                                             break;
+            case log_arg_kind_t::INT:       encoder.putVarint(va_arg(args, unsigned int));         break;
+            case log_arg_kind_t::LONG:      encoder.putVarint(va_arg(args, unsigned long));        break;
+            case log_arg_kind_t::LONG_LONG: encoder.putVarint(va_arg(args, unsigned long long));   break;
+            case log_arg_kind_t::SIZE:      encoder.putVarint(va_arg(args, size_t));               break;
+            case log_arg_kind_t::INTMAX:    encoder.putVarint(va_arg(args, uintmax_t));            break;
+            case log_arg_kind_t::PTRDIFF:   encoder.putVarint(va_arg(args, size_t));               break;
+            case log_arg_kind_t::DOUBLE:    encoder.putDouble(va_arg(args, double));               break;
+            case log_arg_kind_t::POINTER:   encoder.putVarint(reinterpret_cast<uintptr_t>(va_arg(args, void *))); break;
+            case log_arg_kind_t::STRING:    encoder.putString(va_arg(args, const char *));         break;
+        }
+    }
+
+    return encoder.full ? 0 : encoder.size;
+}
+
+bool log_decode_header(const uint8_t *record, size_t size, log_record_header_t &header)
+{
+    Decoder decoder = {record, size, false};
+    header.id = decoder.getVarint();
+    header.timestamp = static_cast<uint32_t>(decoder.getVarint());
+    header.size = size - decoder.size;
+    return !decoder.truncated;
+}
+
+bool log_print_record(const uint8_t *args, size_t size, const char *fmt, log_print_t print, void *ctx)
+{
+    Decoder decoder = {args, size, false};
+
+    // Print literal text in chunks and each conversion on its own, with the format that was used to record it.
+    char chunk[32];
+    auto c = fmt;
+    while (*c != '\0' && !decoder.truncated) {
+        if (*c != '%') {
+            size_t length = 0;
+            while (c[length] != '\0' && c[length] != '%' && length < sizeof(chunk) - 1) {
+                length++;
+            }
+
+            memcpy(chunk, c, length);
+            chunk[length] = '\0';
+            print(ctx, "%s", chunk);
+            c += length;
+            continue;
+        }
+
+        auto conversion = log_parse_conversion(c);
+        c = conversion.end;
+
+        int star_values[2] = {0, 0};
+        for (int i = 0; i < conversion.stars; i++) {
+            star_values[i] = static_cast<int>(decoder.getSignedVarint());
+        }
+
+        // Arguments are always consumed so that an overlong specification does not misalign the ones after it.
+        auto length = static_cast<size_t>(conversion.end - conversion.start);
+        char spec[sizeof(chunk)] = "";
+        if (length < sizeof(spec)) {
+            memcpy(spec, conversion.start, length);
+            spec[length] = '\0';
+        }
+
+        char text[LOG_MAX_RECORD_SIZE];
+        switch (conversion.kind) {
+            case log_arg_kind_t::NONE:
+                if (strcmp(spec, "%%") == 0) {
+                    print(ctx, "%%");
+                }
+                continue;
+            case log_arg_kind_t::INT:
+                printInteger<int, unsigned int>(print, ctx, spec, conversion, star_values, decoder);
+                continue;
+            case log_arg_kind_t::LONG:
+                printInteger<long, unsigned long>(print, ctx, spec, conversion, star_values, decoder);
+                continue;
+            case log_arg_kind_t::LONG_LONG:
+                printInteger<long long, unsigned long long>(print, ctx, spec, conversion, star_values, decoder);
+                continue;
+            case log_arg_kind_t::SIZE:
+                printInteger<ptrdiff_t, size_t>(print, ctx, spec, conversion, star_values, decoder);
+                continue;
+            case log_arg_kind_t::INTMAX:
+                printInteger<intmax_t, uintmax_t>(print, ctx, spec, conversion, star_values, decoder);
+                continue;
+            case log_arg_kind_t::PTRDIFF:
+                printInteger<ptrdiff_t, size_t>(print, ctx, spec, conversion, star_values, decoder);
+                continue;
+            case log_arg_kind_t::DOUBLE:
+                printConversion(print, ctx, spec, conversion.stars, star_values, decoder.getDouble());
+                continue;
+            case log_arg_kind_t::POINTER: {
+                auto value = reinterpret_cast<void *>(static_cast<uintptr_t>(decoder.getVarint()));
+                printConversion(print, ctx, spec, conversion.stars, star_values, value);
+                continue;
+            }
+            case log_arg_kind_t::STRING: {
+                size_t text_length = decoder.getByte();
+                if (text_length > decoder.size) {
+                    decoder.truncated = true;
+                    continue;
+                }
+
+                memcpy(text, decoder.data, text_length);
+                text[text_length] = '\0';
+                decoder.data += text_length;
+                decoder.size -= text_length;
+                printConversion(print, ctx, spec, conversion.stars, star_values, static_cast<const char *>(text));
+                continue;
+            }
+        }
+    }
+
+    return !decoder.truncated;
+}
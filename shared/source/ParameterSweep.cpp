@@ -0,0 +1,105 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <ParameterSweep.h>
+
+ParameterSweep::ParameterSweep() : repetitions(1), _axis_count(0)
+{}
+
+bool ParameterSweep::setAxis(const bt_test_param_info_t *param, const uint32_t *values, size_t count)
+{
+    if (count > MAX_VALUES) {
+        return false;
+    }
+
+    size_t index = 0;
+    while (index < _axis_count && _axes[index].param != param) {
+        index++;
+    }
+
+    if (count == 0) {
+        // Remove the axis if present, keeping the order of the others.
+        if (index < _axis_count) {
+            memmove(&_axes[index], &_axes[index + 1], (_axis_count - index - 1) * sizeof(Axis));
+            _axis_count--;
+        }
+
+        return true;
+    }
+
+    if (index == _axis_count) {
+        if (_axis_count == MAX_AXES) {
+            return false;
+        }
+
+        _axis_count++;
+    }
+
+    _axes[index].param = param;
+    memcpy(_axes[index].values, values, count * sizeof(values[0]));
+    _axes[index].count = count;
+    return true;
+}
+
+void ParameterSweep::clear()
+{
+    _axis_count = 0;
+}
+
+size_t ParameterSweep::axisCount() const
+{
+    return _axis_count;
+}
+
+const ParameterSweep::Axis &ParameterSweep::axis(size_t index) const
+{
+    assert(index < _axis_count);
+    return _axes[index];
+}
+
+uint32_t ParameterSweep::pointCount() const
+{
+    uint64_t count = repetitions > 0 ? repetitions : 1;
+    for (size_t i = 0; i < _axis_count; i++) {
+        count *= _axes[i].count;
+        if (count > UINT32_MAX) {
+            return 0;
+        }
+    }
+
+    return static_cast<uint32_t>(count);
+}
+
+void ParameterSweep::apply(uint32_t point, bt_test_params_t &params) const
+{
+    // Mixed radix: repetitions are the least significant digit, then the axes from last to first.
+    point /= repetitions > 0 ? repetitions : 1;
+    for (size_t i = _axis_count; i > 0; i--) {
+        auto &axis = _axes[i - 1];
+        params.*axis.param->field = axis.values[point % axis.count];
+        point /= axis.count;
+    }
+}
+
+uint32_t ParameterSweep::repetition(uint32_t point) const
+{
+    return point % (repetitions > 0 ? repetitions : 1);
+}
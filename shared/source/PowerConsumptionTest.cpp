@@ -19,13 +19,16 @@
 #include <inttypes.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <bt_test_state.h>
 #include <config.h>
 #include <PowerConsumptionTest.h>
 
-PowerConsumptionTest::PowerConsumptionTest(BluetoothPlatform &platform) : _platform(platform)
+PowerConsumptionTest::PowerConsumptionTest(BluetoothPlatform &platform)
+: _platform(platform)
+, _device_name_length(strlen(platform.deviceName()))
 {}
 
 PowerConsumptionTest::~PowerConsumptionTest()
@@ -40,54 +43,128 @@ void PowerConsumptionTest::callNextState(void* arg)
 
 void PowerConsumptionTest::run()
 {
-    _platform.init(this);
+    start();
     _platform.runEventLoop();
 }
 
+void PowerConsumptionTest::start()
+{
+    _platform.init(this);
+}
+
 void PowerConsumptionTest::nextState()
 {
+    if (_sweep_running) {
+        // Several events may end a step, e.g. triggerDisconnect() and then onDisconnect(); only the first counts.
+        if (_sweep_step_running) {
+            _sweep_step_running = false;
+            updateState(bt_test_state_t::START);
+            _platform.callIn(SWEEP_SETTLE_TIME, &callRunSweepStep, this);
+        }
+
+        return;
+    }
+
+    if (_script_running) {
+        // As for sweeps, only the first event to end a step counts.
+        if (_script_step_running) {
+            _script_step_running = false;
+            updateState(bt_test_state_t::START);
+            _platform.call(&callRunScriptStep, this);
+        }
+
+        return;
+    }
+
     updateState(bt_test_state_t::START);
     _platform.printf(
         "Enter one of the following commands:\n"
         " * a - Advertise\n"
         " * s - Scan\n"
         " * p - Toggle periodic adv/scan flag (currently %s)\n"
-        " * m - Set/unset peer MAC address to connect by MAC instead of name\n",
-        _is_periodic ? "ON" : "OFF"
+        " * g - Toggle GATT throughput streaming when connected (currently %s)\n"
+        " * o - Cycle output mode during measurements (currently %s)\n"
+        " * m - Set/unset peer MAC address to connect by MAC instead of name\n"
+        " * w - Print scheduler wakeup statistics\n"
+        " * l - Print scheduler lateness and callback duration histograms\n"
+        " * v - View timing parameters\n"
+        " * t - Set a timing parameter\n"
+        " * x - Configure or run a parameter sweep\n"
+        " * b - Run a script of commands separated by ;\n",
+        _is_periodic ? "ON" : "OFF",
+        _is_throughput ? "ON" : "OFF",
+        logModeName(_platform.logMode())
     );
-    while (true) {
-        _platform.printf("Enter command: ");
-        int c = _platform.getchar();
-        _platform.putchar(c);
-        switch (tolower(c)) {
-            case 'a': advertise();      return;
-            case 's': scan();           return;
-            case 'p': togglePeriodic(); return;
-            case 'm': readTargetMac();  return;
-            default:
-                if (isprint(c)) {
-                    _platform.printf("Invalid choice \'%c\'. ", c);
-                }
-                break;
-        }
+    _stop_requested = false;
+    promptCommand();
+}
+
+void PowerConsumptionTest::promptCommand()
+{
+    _platform.printf("Enter command: ");
+    expectInput(input_mode_t::COMMAND);
+}
+
+void PowerConsumptionTest::expectInput(input_mode_t mode)
+{
+    _input_mode = mode;
+
+    // A handler run below may expect more input, in which case the loop carries on with the new mode.
+    if (_is_replaying_input) {
+        return;
+    }
+
+    _is_replaying_input = true;
+    while (_input_mode != input_mode_t::NONE && _input_queue_count > 0) {
+        int c = _input_queue[_input_queue_start];
+        _input_queue_start = (_input_queue_start + 1) % INPUT_QUEUE_SIZE;
+        _input_queue_count--;
+        handleInput(c);
+    }
+    _is_replaying_input = false;
+}
+
+void PowerConsumptionTest::onCommandInput(int c)
+{
+    _platform.putchar(c);
+    _input_mode = input_mode_t::NONE;
+    switch (tolower(c)) {
+        case 'a': advertise();           return;
+        case 's': scan();                return;
+        case 'p': togglePeriodic();      return;
+        case 'g': toggleThroughput();    return;
+        case 'o': cycleLogMode();        return;
+        case 'm': readTargetMac();       return;
+        case 'w': printWakeupStats();    return;
+        case 'l': printSchedulerStats(); return;
+        case 'v': printParams();         return;
+        case 't': readParam();           return;
+        case 'x': readSweep();           return;
+        case 'b': readScript();          return;
+        default:
+            if (isprint(c)) {
+                _platform.printf("Invalid choice \'%c\'. ", c);
+            }
+            promptCommand();
+            break;
     }
 }
 
-void PowerConsumptionTest::advertise()
+int PowerConsumptionTest::advertise()
 {
     if (_is_periodic) {
-        _platform.startPeriodicAdvertising();
+        return _platform.startPeriodicAdvertising();
     } else {
-        _platform.startAdvertising();
+        return _platform.startAdvertising();
     }
 }
 
-void PowerConsumptionTest::scan()
+int PowerConsumptionTest::scan()
 {
     if (_is_periodic) {
-        _platform.startScanForPeriodicAdvertising();
+        return _platform.startScanForPeriodicAdvertising();
     } else {
-        _platform.startScan();
+        return _platform.startScan();
     }
 }
 
@@ -103,46 +180,578 @@ void PowerConsumptionTest::togglePeriodic()
     _platform.call(&callNextState, this);
 }
 
-void PowerConsumptionTest::readTargetMac()
+void PowerConsumptionTest::toggleThroughput()
 {
-    char buffer[MAC_ADDRESS_LENGTH + 1];
-    size_t length = 0;
-    memset(buffer, 0, sizeof(buffer));
+    _is_throughput = !_is_throughput;
+    _platform.printf("\nThroughput mode toggled %s\n", _is_throughput ? "ON" : "OFF");
+    _platform.call(&callNextState, this);
+}
+
+void PowerConsumptionTest::cycleLogMode()
+{
+    switch (_platform.logMode()) {
+        case BluetoothPlatform::log_mode_t::immediate:
+            _platform.setLogMode(BluetoothPlatform::log_mode_t::deferred);
+            break;
+        case BluetoothPlatform::log_mode_t::deferred:
+            _platform.setLogMode(BluetoothPlatform::log_mode_t::quiet);
+            break;
+        case BluetoothPlatform::log_mode_t::quiet:
+            _platform.setLogMode(BluetoothPlatform::log_mode_t::immediate);
+            break;
+    }
+
+    _platform.printf("\nOutput during measurements is now %s\n", logModeName(_platform.logMode()));
+    _platform.call(&callNextState, this);
+}
 
+const char *PowerConsumptionTest::logModeName(BluetoothPlatform::log_mode_t mode)
+{
+    switch (mode) {
+        case BluetoothPlatform::log_mode_t::immediate: return "immediate";
+        case BluetoothPlatform::log_mode_t::deferred:  return "deferred";
+        case BluetoothPlatform::log_mode_t::quiet:     return "quiet";
+    }
+
+    return "";
+}
+
+void PowerConsumptionTest::printSchedulerStats()
+{
+    SchedulerStats stats;
+    if (!_platform.getSchedulerStats(stats)) {
+        _platform.printf("\nScheduler statistics are disabled, enable CONFIG_SCHED_STATS\n");
+        _platform.call(&callNextState, this);
+        return;
+    }
+
+    _platform.printf("\n%12s %10s %10s\n", "from (us)", "lateness", "duration");
+    for (size_t i = 0; i < DurationHistogram::BUCKETS; i++) {
+        if (stats.lateness.counts[i] == 0 && stats.duration.counts[i] == 0) {
+            continue;
+        }
+
+        _platform.printf(
+            "%12" PRIu32 " %10" PRIu32 " %10" PRIu32 "\n",
+            DurationHistogram::lowerBound(i),
+            stats.lateness.counts[i],
+            stats.duration.counts[i]
+        );
+    }
+
+    _platform.printf("%12s %10" PRIu32 " %10" PRIu32 "\n", "max", stats.lateness.max, stats.duration.max);
+    _platform.call(&callNextState, this);
+}
+
+void PowerConsumptionTest::readTargetMac()
+{
     _platform.printf(
         "\n * Set target MAC by inputting 6 hex bytes (12 digits) with optional : separators"
         "\n * Unset target MAC and use name to match by pressing ENTER with no input"
         "\nTarget MAC: "
     );
-    int xdigits = 0;
-    do {
-        // Break on '\n', append hex digit, ignore other chars.
-        int c = tolower(_platform.getchar());
-        if (c == '\n') {
-            break;
-        } else if (isxdigit(c)) {
-            buffer[length] = c;
-            length++;
-            xdigits++;
-            _platform.putchar(c);
+    _line_length = 0;
+    expectInput(input_mode_t::MAC);
+}
+
+void PowerConsumptionTest::onMacInput(int c)
+{
+    // Break on newline, append hex digit, ignore other chars.
+    c = tolower(c);
+    if (c != '\n' && c != '\r') {
+        if (!isxdigit(c)) {
+            return;
         }
 
+        _line[_line_length] = c;
+        _line_length++;
+        _platform.putchar(c);
+
         // Insert a colon when needed.
-        if (xdigits == 2 && length < MAC_ADDRESS_LENGTH) {
-            _platform.putchar(':');
-            xdigits = 0;
+        if (_line_length < MAC_ADDRESS_LENGTH) {
+            if (_line_length % 2 == 0) {
+                _platform.putchar(':');
+            }
+
+            return;
         }
-    } while (length < MAC_ADDRESS_LENGTH);
+    }
+
+    _line[_line_length] = '\0';
+    _input_mode = input_mode_t::NONE;
+    _platform.putchar('\n');
+    setTargetMac(_line);
+}
+
+void PowerConsumptionTest::setTargetMac(const char *mac)
+{
+    // Keep the hex digits, ignoring separators. One digit too many is enough to reject the input.
+    char buffer[MAC_ADDRESS_LENGTH + 2];
+    size_t length = 0;
+    for (auto c = mac; *c != '\0' && length <= MAC_ADDRESS_LENGTH; c++) {
+        if (isxdigit(*c)) {
+            buffer[length] = tolower(*c);
+            length++;
+        }
+    }
 
     if (length == 0) {
         _platform.printf("Will look for peer with name \"%s\"\n", _platform.deviceName());
+        _has_target_address = false;
+        _platform.setScanFilter(nullptr);
     } else if (length == MAC_ADDRESS_LENGTH) {
-        _platform.printf("\nWill look for peer with MAC \"%s\"\n", buffer);
-        _target_mac_len = length;
-        memcpy(_target_mac, buffer, length);
+        buffer[length] = '\0';
+        _platform.printf("Will look for peer with MAC \"%s\"\n", buffer);
+
+        // Keep the address as it is reported, least significant byte first.
+        for (size_t i = 0; i < sizeof(_target_address); i++) {
+            char byte[3] = { buffer[2*i], buffer[2*i + 1], '\0' };
+            _target_address[sizeof(_target_address) - 1 - i] = static_cast<uint8_t>(strtoul(byte, nullptr, 16));
+        }
+
+        _has_target_address = true;
+
+        // Have the controller drop the reports of other advertisers, so that they don't wake the host.
+        // onAdvertisingReport() still matches the MAC if the filter can't be set, but every report then wakes the
+        // host, which skews the measurement.
+        auto error = _platform.setScanFilter(_target_address);
+        if (error != 0) {
+            _platform.printError(error, "Scan filter not set, the reports of every advertiser will wake the host");
+        }
     } else {
-        _platform.printf("\nInvalid MAC \"%s\"\n", buffer);
+        _platform.printf("Invalid MAC \"%s\"\n", mac);
+    }
+
+    _platform.call(&callNextState, this);
+}
+
+void PowerConsumptionTest::printParams()
+{
+    size_t count;
+    auto infos = get_bt_test_param_infos(&count);
+    auto &params = _platform.params();
+    _platform.printf("\n");
+    for (size_t i = 0; i < count; i++) {
+        _platform.printf(
+            " * %-19s %10" PRIu32 " %-6s  %s\n",
+            infos[i].name,
+            params.*infos[i].field,
+            infos[i].unit,
+            infos[i].description
+        );
+    }
+
+    _platform.call(&callNextState, this);
+}
+
+void PowerConsumptionTest::readParam()
+{
+    _platform.printf("\nEnter <name> <value>: ");
+    readLine(PARAM_LINE_LENGTH, &PowerConsumptionTest::setParam);
+}
+
+void PowerConsumptionTest::setParam(char *line)
+{
+    // Split at the first space.
+    char *value = strchr(line, ' ');
+    if (value != nullptr) {
+        *value = '\0';
+        value++;
+    }
+
+    size_t count;
+    auto infos = get_bt_test_param_infos(&count);
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(line, infos[i].name) != 0) {
+            continue;
+        }
+
+        char *end = nullptr;
+        auto number = value == nullptr ? 0 : strtoul(value, &end, 10);
+        if (end == value || *end != '\0' || number < infos[i].min || number > infos[i].max) {
+            _platform.printf(
+                "Invalid value, %s must be %" PRIu32 " to %" PRIu32 " %s\n",
+                infos[i].name,
+                infos[i].min,
+                infos[i].max,
+                infos[i].unit
+            );
+        } else {
+            _platform.params().*infos[i].field = static_cast<uint32_t>(number);
+            _platform.printf(
+                "%s set to %" PRIu32 " %s\n",
+                infos[i].name,
+                static_cast<uint32_t>(number),
+                infos[i].unit
+            );
+        }
+
+        _platform.call(&callNextState, this);
+        return;
+    }
+
+    _platform.printf("Unknown parameter \"%s\", enter v to list them\n", line);
+    _platform.call(&callNextState, this);
+}
+
+void PowerConsumptionTest::readLine(size_t size, line_handler_t handler)
+{
+    _line_length = 0;
+    _line_limit = size < sizeof(_line) ? size : sizeof(_line);
+    _line_handler = handler;
+    expectInput(input_mode_t::LINE);
+}
+
+void PowerConsumptionTest::onLineInput(int c)
+{
+    if (c == '\n' || c == '\r') {
+        _platform.putchar('\n');
+        _line[_line_length] = '\0';
+        _input_mode = input_mode_t::NONE;
+        (this->*_line_handler)(_line);
+    } else if ((c == '\b' || c == 0x7f) && _line_length > 0) {
+        _line_length--;
+        _platform.printf("\b \b");
+    } else if (isprint(c) && _line_length + 1 < _line_limit) {
+        _line[_line_length] = c;
+        _line_length++;
+        _platform.putchar(c);
+    }
+}
+
+void PowerConsumptionTest::readSweep()
+{
+    _platform.printf(
+        "\n * <name> <value> [<value>...] - Sweep a parameter (see v) over up to %u values, or stop sweeping it if none"
+        "\n * clear - Stop sweeping all parameters"
+        "\n * run a|s [<repetitions>] - Advertise or scan at every combination of values"
+        "\n * Show the sweep by pressing ENTER with no input"
+        "\nSweep: ",
+        static_cast<unsigned>(ParameterSweep::MAX_VALUES)
+    );
+    readLine(SWEEP_LINE_LENGTH, &PowerConsumptionTest::runSweepCommand);
+}
+
+void PowerConsumptionTest::runSweepCommand(char *line)
+{
+    char *rest = strchr(line, ' ');
+    if (rest != nullptr) {
+        *rest = '\0';
+        rest++;
+    }
+
+    if (line[0] == '\0') {
+        printSweep();
+    } else if (strcmp(line, "clear") == 0) {
+        _sweep.clear();
+        _platform.printf("Sweep cleared\n");
+    } else if (strcmp(line, "run") == 0) {
+        char role = rest == nullptr ? '\0' : tolower(rest[0]);
+        auto repetitions = rest == nullptr || rest[1] == '\0' ? 1 : strtoul(rest + 1, nullptr, 10);
+        if ((role != 'a' && role != 's') || repetitions == 0) {
+            _platform.printf("Invalid sweep, enter run a or run s followed by an optional repetition count\n");
+        } else {
+            startSweep(role == 's', static_cast<uint32_t>(repetitions));
+            return;
+        }
+    } else {
+        readSweepAxis(line, rest);
+    }
+
+    _platform.call(&callNextState, this);
+}
+
+void PowerConsumptionTest::readSweepAxis(const char *name, char *values)
+{
+    size_t count;
+    auto infos = get_bt_test_param_infos(&count);
+    const bt_test_param_info_t *info = nullptr;
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(name, infos[i].name) == 0) {
+            info = &infos[i];
+        }
+    }
+
+    if (info == nullptr) {
+        _platform.printf("Unknown parameter \"%s\", enter v to list them\n", name);
+        return;
+    }
+
+    uint32_t parsed[ParameterSweep::MAX_VALUES];
+    size_t parsed_count = 0;
+    while (values != nullptr && *values != '\0') {
+        char *end;
+        auto number = strtoul(values, &end, 10);
+        if (end == values || number < info->min || number > info->max || parsed_count == ParameterSweep::MAX_VALUES) {
+            _platform.printf(
+                "Invalid values, enter up to %u values of %" PRIu32 " to %" PRIu32 " %s\n",
+                static_cast<unsigned>(ParameterSweep::MAX_VALUES),
+                info->min,
+                info->max,
+                info->unit
+            );
+            return;
+        }
+
+        parsed[parsed_count] = static_cast<uint32_t>(number);
+        parsed_count++;
+        values = end;
+        while (*values == ' ' || *values == ',') {
+            values++;
+        }
+    }
+
+    if (!_sweep.setAxis(info, parsed, parsed_count)) {
+        _platform.printf(
+            "Too many parameters, at most %u can be swept\n",
+            static_cast<unsigned>(ParameterSweep::MAX_AXES)
+        );
+        return;
+    }
+
+    printSweep();
+}
+
+void PowerConsumptionTest::printSweep()
+{
+    if (_sweep.axisCount() == 0) {
+        _platform.printf("No parameters are swept\n");
+        return;
+    }
+
+    for (size_t i = 0; i < _sweep.axisCount(); i++) {
+        auto &axis = _sweep.axis(i);
+        _platform.printf(" * %-19s", axis.param->name);
+        for (size_t j = 0; j < axis.count; j++) {
+            _platform.printf(" %" PRIu32, axis.values[j]);
+        }
+
+        _platform.printf(" %s\n", axis.param->unit);
+    }
+}
+
+void PowerConsumptionTest::startSweep(bool scanner, uint32_t repetitions)
+{
+    _sweep.repetitions = repetitions;
+    _sweep_points = _sweep.pointCount();
+    if (_sweep_points == 0) {
+        _platform.printf("Too many sweep steps\n");
+        _platform.call(&callNextState, this);
+        return;
+    }
+
+    _sweep_saved_params = _platform.params();
+    _sweep_scanner = scanner;
+    _sweep_point = 0;
+    _sweep_running = true;
+    runSweepStep();
+}
+
+void PowerConsumptionTest::runSweepStep()
+{
+    if (_sweep_point == _sweep_points || _stop_requested) {
+        _platform.printf("#SWEEP END t=%" PRIu32 "\n", _platform.uptimeMs());
+        _platform.params() = _sweep_saved_params;
+        _sweep_running = false;
+        nextState();
+        return;
+    }
+
+    // The marker lists the values of the step so that the trace can be sliced without knowing the sweep.
+    _sweep.apply(_sweep_point, _platform.params());
+    _platform.printf(
+        "#SWEEP %" PRIu32 "/%" PRIu32 " rep=%" PRIu32,
+        _sweep_point + 1,
+        _sweep_points,
+        _sweep.repetition(_sweep_point) + 1
+    );
+    for (size_t i = 0; i < _sweep.axisCount(); i++) {
+        auto &axis = _sweep.axis(i);
+        _platform.printf(" %s=%" PRIu32, axis.param->name, _platform.params().*axis.param->field);
+    }
+
+    _platform.printf(" t=%" PRIu32 "\n", _platform.uptimeMs());
+    _sweep_point++;
+    _sweep_step_running = true;
+
+    auto error = _sweep_scanner ? scan() : advertise();
+    if (error) {
+        // Move on rather than stall the sweep.
+        _platform.printf("Sweep step failed\n");
+        nextState();
     }
+}
+
+void PowerConsumptionTest::callRunSweepStep(void* arg)
+{
+    reinterpret_cast<PowerConsumptionTest*>(arg)->runSweepStep();
+}
+
+void PowerConsumptionTest::readScript()
+{
+    _platform.printf(
+        "\n * Commands are separated by ; and take their input after a space, e.g. t scan_time 30000"
+        "\n * wait <ms> - Stay idle"
+        "\n * repeat <n> - Run the commands since the previous repeat or the start n times in total"
+        "\nScript: "
+    );
+    readLine(SCRIPT_LENGTH, &PowerConsumptionTest::startScript);
+}
+
+void PowerConsumptionTest::startScript(char *line)
+{
+    strcpy(_script, line);
+
+    // Reject the whole script up front rather than stopping halfway through a measurement.
+    size_t position = 0;
+    char command[SCRIPT_LENGTH];
+    while (nextScriptCommand(position, command, sizeof(command))) {
+        if (!isScriptCommand(command)) {
+            _platform.printf("Invalid script command \"%s\"\n", command);
+            _platform.call(&callNextState, this);
+            return;
+        }
+    }
+
+    _script_position = 0;
+    _script_segment = 0;
+    _script_repeat_position = SIZE_MAX;
+    _script_running = true;
+    runScriptStep();
+}
+
+bool PowerConsumptionTest::nextScriptCommand(size_t &position, char *command, size_t size)
+{
+    if (_script[position] == '\0') {
+        return false;
+    }
+
+    auto end = strchr(&_script[position], ';');
+    auto length = end == nullptr ? strlen(&_script[position]) : static_cast<size_t>(end - &_script[position]);
+    auto start = position;
+    position += end == nullptr ? length : length + 1;
+
+    // Trim spaces.
+    while (length > 0 && _script[start] == ' ') {
+        start++;
+        length--;
+    }
+
+    while (length > 0 && _script[start + length - 1] == ' ') {
+        length--;
+    }
+
+    length = length < size ? length : size - 1;
+    memcpy(command, &_script[start], length);
+    command[length] = '\0';
+    return true;
+}
+
+bool PowerConsumptionTest::isScriptCommand(const char *command)
+{
+    if (command[0] == '\0') {
+        return true;
+    } else if (strncmp(command, "wait ", 5) == 0 || strncmp(command, "repeat ", 7) == 0) {
+        char *end;
+        auto value = strtoul(strchr(command, ' ') + 1, &end, 10);
+        return *end == '\0' && value > 0;
+    } else if (command[1] != '\0' && command[1] != ' ') {
+        return false;
+    }
+
+    return strchr("aspgomwlvtx", tolower(command[0])) != nullptr;
+}
+
+void PowerConsumptionTest::runScriptStep()
+{
+    char command[SCRIPT_LENGTH];
+    while (true) {
+        auto start = _script_position;
+        if (_stop_requested || !nextScriptCommand(_script_position, command, sizeof(command))) {
+            _script_running = false;
+            _platform.printf(_stop_requested ? "Script stopped\n" : "Script finished\n");
+            nextState();
+            return;
+        }
+
+        if (strncmp(command, "repeat ", 7) == 0) {
+            // Count the runs of the segment that ends here, going back to its start until it has run enough times.
+            auto count = strtoul(command + 7, nullptr, 10);
+            if (_script_repeat_position != start) {
+                _script_repeat_position = start;
+                _script_repeats = 1;
+            }
+
+            if (_script_repeats < count) {
+                _script_repeats++;
+                _script_position = _script_segment;
+            } else {
+                _script_repeat_position = SIZE_MAX;
+                _script_segment = _script_position;
+            }
+        } else if (command[0] != '\0') {
+            break;
+        }
+    }
+
+    _platform.printf("> %s\n", command);
+    _script_step_running = true;
+    runScriptCommand(command);
+}
+
+void PowerConsumptionTest::runScriptCommand(char *command)
+{
+    char *args = strchr(command, ' ');
+    args = args == nullptr ? &command[strlen(command)] : args + 1;
+
+    if (strncmp(command, "wait ", 5) == 0) {
+        updateState(bt_test_state_t::START);
+        _platform.callIn(strtoul(args, nullptr, 10), &callNextState, this);
+        return;
+    }
+
+    switch (tolower(command[0])) {
+        case 'a':
+            if (advertise()) {
+                nextState();
+            }
+            break;
+        case 's':
+            if (scan()) {
+                nextState();
+            }
+            break;
+        case 'p': togglePeriodic();        break;
+        case 'g': toggleThroughput();      break;
+        case 'o': cycleLogMode();          break;
+        case 'm': setTargetMac(args);      break;
+        case 'w': printWakeupStats();      break;
+        case 'l': printSchedulerStats();   break;
+        case 'v': printParams();           break;
+        case 't': setParam(args);          break;
+        case 'x': runSweepCommand(args);   break;
+        default:
+            // Rejected by isScriptCommand().
+            assert(false);
+            break;
+    }
+}
+
+void PowerConsumptionTest::callRunScriptStep(void* arg)
+{
+    reinterpret_cast<PowerConsumptionTest*>(arg)->runScriptStep();
+}
+
+void PowerConsumptionTest::printWakeupStats()
+{
+    auto stats = _platform.getWakeupStats();
+    _platform.printf(
+        "\nWakeups: %" PRIu32 " single, %" PRIu32 " coalesced (saving %" PRIu32 "), %" PRIu32 " posted calls\n",
+        stats.uncoalesced,
+        stats.coalesced,
+        stats.coalescedCalls,
+        stats.posts
+    );
 
     _platform.call(&callNextState, this);
 }
@@ -152,12 +761,38 @@ void PowerConsumptionTest::callPrintf(void* arg, const char* s)
     reinterpret_cast<PowerConsumptionTest*>(arg)->_platform.printf(s);
 }
 
+const char *PowerConsumptionTest::phyName(BluetoothPlatform::phy_t phy)
+{
+    switch (phy) {
+        case BluetoothPlatform::phy_t::le_1m:    return "1M";
+        case BluetoothPlatform::phy_t::le_2m:    return "2M";
+        case BluetoothPlatform::phy_t::le_coded: return "Coded";
+    }
+
+    return "unknown";
+}
+
+void PowerConsumptionTest::printConnectionParameters(const BluetoothPlatform::ConnectionParameters &parameters)
+{
+    _platform.printf(
+        "interval %" PRIu32 ".%02" PRIu32 " ms, latency %u, supervision timeout %" PRIu32 " ms\n",
+        parameters.intervalUs / 1000,
+        parameters.intervalUs % 1000 / 10,
+        static_cast<unsigned>(parameters.latency),
+        parameters.supervisionTimeoutMs
+    );
+}
+
 void PowerConsumptionTest::updateState(bt_test_state_t state)
 {
     if (state != _state) {
+        // Output deferred during the previous state is printed before the marker, which is never deferred, and a new
+        // measurement window starts unless the test is idle.
+        _platform.setMeasuring(false);
         _platform.printf("\n#");
         print_bt_test_state(state, &callPrintf, this);
-        _platform.printf("\n");
+        _platform.printf(" t=%" PRIu32 "\n", _platform.uptimeMs());
+        _platform.setMeasuring(state != bt_test_state_t::START);
     }
 
     _state = state;
@@ -205,37 +840,68 @@ void PowerConsumptionTest::onAdvertisingStart(const BluetoothPlatform::Advertisi
 void PowerConsumptionTest::onScanStart(const BluetoothPlatform::ScanStartEvent &event)
 {
     updateState(bt_test_state_t::SCAN);
-    printf("Scanning started for %" PRIu32 "ms\n", event.scanDurationMs);
+    _platform.printf("Scanning started for %" PRIu32 "ms\n", event.scanDurationMs);
 }
 
-void PowerConsumptionTest::onAdvertisingReport(const BluetoothPlatform::AdvertisingReportEvent &event)
+bool PowerConsumptionTest::isTarget(const BluetoothPlatform::AdvertisingReportEvent &event) const
+{
+    assert(event.peerAddressSize == sizeof(_target_address));
+    if (_has_target_address) {
+        return memcmp(event.peerAddressData, _target_address, sizeof(_target_address)) == 0;
+    }
+
+    // Most names differ in length, so the characters are rarely compared.
+    const char *name;
+    size_t length;
+    return event.findLocalName(name, length)
+        && length == _device_name_length
+        && memcmp(name, _platform.deviceName(), length) == 0;
+}
+
+void PowerConsumptionTest::formatPeer(const BluetoothPlatform::AdvertisingReportEvent &event, char *name, char *mac)
 {
-    // Format MAC as a string.
     const uint8_t *mac_raw = event.peerAddressData;
-    assert(event.peerAddressSize == MAC_ADDRESS_LENGTH/2);
-    char mac[MAC_ADDRESS_LENGTH + 1];
     sprintf(mac, "%02x%02x%02x%02x%02x%02x", mac_raw[5], mac_raw[4], mac_raw[3], mac_raw[2], mac_raw[1], mac_raw[0]);
 
+    // The name is copied since it is not null terminated.
+    const char *local_name;
+    size_t length;
+    if (!event.findLocalName(local_name, length)) {
+        local_name = "(unknown name)";
+        length = strlen(local_name);
+    }
+
+    length = length < DEVICE_NAME_LENGTH ? length : DEVICE_NAME_LENGTH;
+    memcpy(name, local_name, length);
+    name[length] = '\0';
+}
+
+void PowerConsumptionTest::onAdvertisingReport(const BluetoothPlatform::AdvertisingReportEvent &event)
+{
+    // Reports come at a high rate when scanning in a crowded environment, so nothing is formatted or copied unless the
+    // report is listed or matches.
+    char name[DEVICE_NAME_LENGTH + 1];
+    char mac[MAC_ADDRESS_LENGTH + 1];
+
     // Log the discovered peer if configured to do so.
 #if CONFIG_LIST_SCAN_DEVS
-    const char *name = event.localName[0] == 0 ? "(unknown name)" : event.localName;
+    formatPeer(event, name, mac);
     _platform.printf("Discovered \"%s\" (%s)\n", name, mac);
 #endif
 
     // Match by MAC or by name.
-    if (_target_mac_len > 0 && memcmp(mac, _target_mac, _target_mac_len) == 0) {
-        _platform.printf("Peer matched by MAC\n");
-    } else if (_target_mac_len == 0 && strcmp(_platform.deviceName(), event.localName) == 0) {
-        _platform.printf("Peer matched by name\n");
-    } else {
+    if (!isTarget(event)) {
         return;
     }
 
+    _platform.printf(_has_target_address ? "Peer matched by MAC\n" : "Peer matched by name\n");
+    formatPeer(event, name, mac);
+
     // Connect or sync to the peer.
     if (event.isPeriodic) {
-        printf(
+        _platform.printf(
             "Syncing with peer \"%s\" (%s) with SID %d and periodic interval %" PRIu32 " ms\n",
-            event.localName,
+            name,
             mac,
             event.sid,
             event.periodicIntervalMs
@@ -245,10 +911,10 @@ void PowerConsumptionTest::onAdvertisingReport(const BluetoothPlatform::Advertis
             event.sid,
             event.peerAddressType,
             event.peerAddressData,
-            5000
+            _platform.params().sync_timeout
         );
     } else {
-        printf("Connecting to peer \"%s\" (%s)\n", event.localName, mac);
+        _platform.printf("Connecting to peer \"%s\" (%s)\n", name, mac);
         _platform.establishConnection(
             event.peerAddressType,
             event.peerAddressData
@@ -283,25 +949,26 @@ struct DisconnectContext {
 void PowerConsumptionTest::triggerDisconnect(void* arg)
 {
     auto ctx = reinterpret_cast<DisconnectContext*>(arg);
+    ctx->this_ptr->_disconnect_timer = 0;
     ctx->this_ptr->_platform.printf("Triggering disconnect...\n");
     ctx->this_ptr->_platform.disconnect(ctx->handle);
     ctx->this_ptr->nextState();
-    delete ctx;
 }
 
 void PowerConsumptionTest::triggerDesync(void* arg)
 {
     auto ctx = reinterpret_cast<DisconnectContext*>(arg);
+    ctx->this_ptr->_disconnect_timer = 0;
     ctx->this_ptr->_platform.printf("Stopping sync...\n");
     ctx->this_ptr->_platform.stopSync(ctx->handle);
     ctx->this_ptr->nextState();
-    delete ctx;
 }
 
 void PowerConsumptionTest::onConnection(const BluetoothPlatform::ConnectEvent &event)
 {
     if (event.error) {
         _platform.printError(event.error, "Connection failed");
+        _platform.call(&callNextState, this);
         return;
     }
 
@@ -310,21 +977,208 @@ void PowerConsumptionTest::onConnection(const BluetoothPlatform::ConnectEvent &e
         _platform.printf("main\n");
         updateState(bt_test_state_t::CONNECT_MAIN);
         // Trigger disconnect after timeout when connected as main.
-        auto ctx = new DisconnectContext(this, event.connectionHandle); // Deleted by handler.
-        _platform.callIn(CONFIG_CONNECT_TIME, &triggerDisconnect, ctx);
+        DisconnectContext ctx(this, event.connectionHandle); // Copied by the platform.
+        _disconnect_timer = _platform.callIn(
+            _platform.params().connect_time,
+            CONFIG_TIMER_SLACK,
+            &triggerDisconnect,
+            &ctx,
+            sizeof(ctx)
+        );
+
+        // The connection is always established on the 1M PHY.
+        auto phy = static_cast<BluetoothPlatform::phy_t>(_platform.params().phy);
+        if (phy != BluetoothPlatform::phy_t::le_1m) {
+            _platform.printf("Requesting %s PHY\n", phyName(phy));
+            _platform.setPhy(event.connectionHandle, phy);
+        }
+
+        // The run or workload ends with the connection, after connect_time.
+        auto traffic = static_cast<BluetoothPlatform::traffic_t>(_platform.params().workload_type);
+        if (_is_throughput) {
+            _platform.printf("Starting GATT throughput run\n");
+            _platform.startThroughput(event.connectionHandle);
+        } else if (_platform.params().workload_period != 0) {
+            _platform.printf("Preparing workload of %s\n", trafficName(traffic));
+            _platform.prepareWorkload(event.connectionHandle, traffic);
+        }
     } else {
         // Wait for disconnect when peripheral.
         _platform.printf("peripheral\n");
         updateState(bt_test_state_t::CONNECT_PERIPHERAL);
     }
+
+    _conn_interval_us = event.parameters.intervalUs;
+    _has_throughput_run = false;
+    _workload_connection = event.connectionHandle;
+    _workload_bursts = 0;
+    _workload_skipped = 0;
+    printConnectionParameters(event.parameters);
+}
+
+void PowerConsumptionTest::onConnectionParametersUpdate(
+    const BluetoothPlatform::ConnectionParametersUpdateEvent &event
+)
+{
+    if (event.error) {
+        _platform.printError(event.error, "Connection parameter update failed");
+        return;
+    }
+
+    _conn_interval_us = event.parameters.intervalUs;
+    _platform.printf("Connection parameters updated: ");
+    printConnectionParameters(event.parameters);
+}
+
+void PowerConsumptionTest::onPhyUpdate(const BluetoothPlatform::PhyUpdateEvent &event)
+{
+    if (event.error) {
+        _platform.printError(event.error, "PHY update failed");
+        return;
+    }
+
+    _platform.printf("PHY updated: TX %s, RX %s\n", phyName(event.txPhy), phyName(event.rxPhy));
 }
 
 void PowerConsumptionTest::onDisconnect()
 {
+    // The peer may have disconnected before the timeout.
+    _platform.cancel(_disconnect_timer);
+    _disconnect_timer = 0;
+    _platform.cancel(_workload_timer);
+    _workload_timer = 0;
+
     _platform.printf("Disconnected\n");
+    if (_has_throughput_run) {
+        printThroughputStats();
+    } else {
+        printWorkloadStats();
+    }
+
     _platform.call(&callNextState, this);
 }
 
+void PowerConsumptionTest::onThroughputStart(const BluetoothPlatform::ThroughputStartEvent &event)
+{
+    if (event.error) {
+        // Stay connected in the CONNECT_* state until connect_time.
+        _platform.printError(event.error, "Throughput run failed");
+        return;
+    }
+
+    _has_throughput_run = true;
+    updateState(
+        event.role == BluetoothPlatform::connection_role_t::main ? bt_test_state_t::THROUGHPUT_MAIN
+                                                                 : bt_test_state_t::THROUGHPUT_PERIPHERAL
+    );
+    _platform.printf("Streaming %u byte writes (ATT MTU %u)\n", event.attMtu - 3U, unsigned(event.attMtu));
+}
+
+void PowerConsumptionTest::printThroughputStats()
+{
+    BluetoothPlatform::TrafficStats stats;
+    if (!_platform.getTrafficStats(stats)) {
+        return;
+    }
+
+    // Energy per byte is the energy of the THROUGHPUT_* state in the power trace divided by the byte count. Link layer
+    // retransmissions are not reported to the host by either stack, so they cannot be counted here.
+    uint64_t goodput = stats.durationMs ? stats.bytes * 8 * 1000 / stats.durationMs : 0;
+    uint64_t events = _conn_interval_us ? static_cast<uint64_t>(stats.durationMs) * 1000 / _conn_interval_us : 0;
+    uint64_t packets_per_event = events ? static_cast<uint64_t>(stats.packets) * 100 / events : 0;
+    _platform.printf(
+        "Throughput: %" PRIu64 " bytes in %" PRIu32 " packets over %" PRIu32 " ms, goodput %" PRIu64 " bit/s, "
+        "%" PRIu64 ".%02" PRIu64 " packets per connection event\n",
+        stats.bytes,
+        stats.packets,
+        stats.durationMs,
+        goodput,
+        packets_per_event / 100,
+        packets_per_event % 100
+    );
+}
+
+void PowerConsumptionTest::onWorkloadReady(const BluetoothPlatform::WorkloadReadyEvent &event)
+{
+    if (event.error) {
+        _platform.printError(event.error, "Workload failed");
+        return;
+    }
+
+    // Main sends writes and the peripheral sends notifications and indications.
+    bool is_main = event.role == BluetoothPlatform::connection_role_t::main;
+    if (is_main != (event.traffic == BluetoothPlatform::traffic_t::write)) {
+        _platform.printf("Receiving workload of %s\n", trafficName(event.traffic));
+        return;
+    }
+
+    // Only the traffic type reaches the peer, so the sender uses its own period, which may not have been set.
+    if (_platform.params().workload_period == 0) {
+        _platform.printf(
+            "Not sending %s: workload_period is 0 on this board, set it as on main\n",
+            trafficName(event.traffic)
+        );
+        return;
+    }
+
+    // The bursts run on the scheduler, so their wakeups show in the power trace as they would in a product.
+    _workload_timer = _platform.callEvery(_platform.params().workload_period, &callSendWorkloadBurst, this);
+    if (_workload_timer == 0) {
+        _platform.printf("Failed to schedule the workload\n");
+        return;
+    }
+
+    _platform.printf(
+        "Sending %" PRIu32 " bytes of %s every %" PRIu32 " ms (ATT MTU %u)\n",
+        _platform.params().workload_size,
+        trafficName(event.traffic),
+        _platform.params().workload_period,
+        unsigned(event.attMtu)
+    );
+}
+
+void PowerConsumptionTest::sendWorkloadBurst()
+{
+    if (_platform.sendWorkload(_workload_connection, _platform.params().workload_size) == 0) {
+        _workload_bursts++;
+    } else {
+        _workload_skipped++;
+    }
+}
+
+void PowerConsumptionTest::callSendWorkloadBurst(void* arg)
+{
+    reinterpret_cast<PowerConsumptionTest*>(arg)->sendWorkloadBurst();
+}
+
+void PowerConsumptionTest::printWorkloadStats()
+{
+    BluetoothPlatform::TrafficStats stats;
+    if (!_platform.getTrafficStats(stats)) {
+        return;
+    }
+
+    // The receiver queues no bursts, and its counts are those of the PDUs it received.
+    _platform.printf(
+        "Workload: %" PRIu32 " bursts queued, %" PRIu32 " skipped, %" PRIu64 " bytes in %" PRIu32 " packets\n",
+        _workload_bursts,
+        _workload_skipped,
+        stats.bytes,
+        stats.packets
+    );
+}
+
+const char *PowerConsumptionTest::trafficName(BluetoothPlatform::traffic_t traffic)
+{
+    switch (traffic) {
+        case BluetoothPlatform::traffic_t::notification: return "notifications";
+        case BluetoothPlatform::traffic_t::indication:   return "indications";
+        case BluetoothPlatform::traffic_t::write:        return "writes";
+    }
+
+    return "unknown";
+}
+
 void PowerConsumptionTest::onPeriodicSync(const BluetoothPlatform::PeriodicSyncEvent &event)
 {
     if (event.error) {
@@ -333,12 +1187,55 @@ void PowerConsumptionTest::onPeriodicSync(const BluetoothPlatform::PeriodicSyncE
        _platform.printf("Synced with periodic advertising\n");
     }
 
-    auto ctx = new DisconnectContext(this, event.syncHandle); // Deleted by handler.
-    _platform.callIn(CONFIG_CONNECT_TIME, &triggerDesync, ctx);
+    DisconnectContext ctx(this, event.syncHandle); // Copied by the platform.
+    _disconnect_timer = _platform.callIn(
+        _platform.params().connect_time,
+        CONFIG_TIMER_SLACK,
+        &triggerDesync,
+        &ctx,
+        sizeof(ctx)
+    );
 }
 
 void PowerConsumptionTest::onSyncLoss()
 {
+    _platform.cancel(_disconnect_timer);
+    _disconnect_timer = 0;
+
     _platform.printf("Periodic sync lost\n");
     _platform.call(&callNextState, this);
 }
+
+void PowerConsumptionTest::onInput(int c)
+{
+    // Treat CR LF as a single newline.
+    auto previous = _previous_input;
+    _previous_input = c;
+    if (c == '\n' && previous == '\r') {
+        return;
+    }
+
+    if (_input_mode != input_mode_t::NONE) {
+        handleInput(c);
+    } else if (_sweep_running || _script_running) {
+        // Any key stops a sweep or script once the current step has ended.
+        if (!_stop_requested) {
+            _stop_requested = true;
+            _platform.printf("Stopping after this step\n");
+        }
+    } else if (_input_queue_count < INPUT_QUEUE_SIZE) {
+        // Typed during a measurement or before a prompt: keep it for the next one. Any excess is lost.
+        _input_queue[(_input_queue_start + _input_queue_count) % INPUT_QUEUE_SIZE] = static_cast<char>(c);
+        _input_queue_count++;
+    }
+}
+
+void PowerConsumptionTest::handleInput(int c)
+{
+    switch (_input_mode) {
+        case input_mode_t::COMMAND: onCommandInput(c); break;
+        case input_mode_t::MAC:     onMacInput(c);     break;
+        case input_mode_t::LINE:    onLineInput(c);    break;
+        case input_mode_t::NONE:                       break;
+    }
+}
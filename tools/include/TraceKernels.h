@@ -0,0 +1,83 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TRACEKERNELS_H
+#define TRACEKERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Reductions of runs of float samples of a power trace: sum, sum of squares, minimum, maximum and upward crossings of
+// a threshold. Sample i of a reduction is accumulated in double into lane i % TRACE_LANES, in order, and the lanes are
+// combined in a fixed order at the end. Every kernel follows this order, so the scalar and vector kernels give
+// bit-identical totals, whatever the sizes of the runs passed to them. NaN samples make the sums NaN and are ignored by
+// the minimum, the maximum and the crossings.
+
+/// Number of partial sums of a reduction, the width of the widest kernel.
+static constexpr size_t TRACE_LANES = 8;
+
+/// Implementations of trace_reduce().
+enum class trace_kernel_t {
+    SCALAR,
+    SSE2,
+    AVX2,
+    NEON,
+};
+
+/// State of a reduction, which runs of samples are added to.
+struct trace_reduction_t {
+    double sum[TRACE_LANES];
+    double sum_squares[TRACE_LANES];
+    float min[TRACE_LANES];
+    float max[TRACE_LANES];
+
+    /// Samples added so far.
+    uint64_t count;
+
+    /// Samples at or above the threshold whose predecessor is below it.
+    uint64_t crossings;
+
+    float threshold;
+
+    /// Last sample added, or the one before the reduction, for crossings.
+    float previous;
+};
+
+/// Start a reduction. previous is the sample before the first one, or NAN if there is none.
+void trace_reduction_init(trace_reduction_t &reduction, float threshold, float previous);
+
+/// Totals of a reduction. The minimum is INFINITY and the maximum -INFINITY if no samples were added.
+double trace_reduction_sum(const trace_reduction_t &reduction);
+double trace_reduction_sum_squares(const trace_reduction_t &reduction);
+float trace_reduction_min(const trace_reduction_t &reduction);
+float trace_reduction_max(const trace_reduction_t &reduction);
+
+/// Whether a kernel was built in and the CPU supports it.
+bool trace_kernel_supported(trace_kernel_t kernel);
+
+/// Fastest supported kernel.
+trace_kernel_t trace_best_kernel();
+
+/// Name of a kernel, as accepted by trace_parse_kernel().
+const char *trace_kernel_name(trace_kernel_t kernel);
+
+/// Parse the name of a kernel. Returns false if there is none of that name.
+bool trace_parse_kernel(const char *name, trace_kernel_t &kernel);
+
+/// Add count samples to a reduction with a supported kernel.
+void trace_reduce(trace_kernel_t kernel, trace_reduction_t &reduction, const float *samples, size_t count);
+
+#endif // ! TRACEKERNELS_H
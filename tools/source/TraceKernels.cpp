@@ -0,0 +1,374 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// The vector kernels keep the lanes of the reduction in registers: lane k of the accumulators holds the samples whose
+// index in the reduction is k modulo TRACE_LANES, as in the scalar kernel. Each block of TRACE_LANES samples must
+// start at lane 0 and have its predecessor in the same buffer for crossings, so the scalar kernel does the samples up
+// to the first such block and those after the last one.
+//
+// Squares of floats are exact in double, so whether the compiler fuses a multiply and an add does not change the sums
+// of squares. Minimum and maximum keep the accumulator when the comparison is false, as minps and maxps do, so that
+// signed zeros and NaNs end up the same in every kernel.
+
+#include <math.h>
+#include <string.h>
+
+#include <initializer_list>
+
+#include <TraceKernels.h>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define TRACE_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define TRACE_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+const struct {
+    const char *name;
+    trace_kernel_t kernel;
+} KERNELS[] = {
+    { "scalar", trace_kernel_t::SCALAR },
+    { "sse2", trace_kernel_t::SSE2 },
+    { "avx2", trace_kernel_t::AVX2 },
+    { "neon", trace_kernel_t::NEON },
+};
+
+inline void reduceSample(trace_reduction_t &reduction, float sample)
+{
+    auto lane = reduction.count % TRACE_LANES;
+    double value = sample;
+    reduction.sum[lane] += value;
+    reduction.sum_squares[lane] += value * value;
+    reduction.min[lane] = sample < reduction.min[lane] ? sample : reduction.min[lane];
+    reduction.max[lane] = sample > reduction.max[lane] ? sample : reduction.max[lane];
+    reduction.crossings += reduction.previous < reduction.threshold && sample >= reduction.threshold;
+    reduction.previous = sample;
+    reduction.count++;
+}
+
+void reduceScalar(trace_reduction_t &reduction, const float *samples, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        reduceSample(reduction, samples[i]);
+    }
+}
+
+// Reduce the samples before the first block of a vector kernel. Returns the index of that block.
+size_t reduceHead(trace_reduction_t &reduction, const float *samples, size_t count)
+{
+    size_t i = 0;
+    while (i < count && (i == 0 || reduction.count % TRACE_LANES != 0)) {
+        reduceSample(reduction, samples[i++]);
+    }
+
+    return i;
+}
+
+// The sign of a NaN from adding NaNs depends on the order of the operands, which the compiler may swap, so NaNs are
+// returned as NAN.
+double combine(const double lanes[TRACE_LANES])
+{
+    auto total = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    return isnan(total) ? NAN : total;
+}
+
+#if TRACE_KERNELS_X86
+void reduceSse2(trace_reduction_t &reduction, const float *samples, size_t count)
+{
+    auto i = reduceHead(reduction, samples, count);
+    if (count - i < TRACE_LANES) {
+        reduceScalar(reduction, samples + i, count - i);
+        return;
+    }
+
+    __m128d sum[4], sum_squares[4];
+    for (size_t k = 0; k < 4; k++) {
+        sum[k] = _mm_loadu_pd(reduction.sum + 2 * k);
+        sum_squares[k] = _mm_loadu_pd(reduction.sum_squares + 2 * k);
+    }
+    __m128 min[2] = { _mm_loadu_ps(reduction.min), _mm_loadu_ps(reduction.min + 4) };
+    __m128 max[2] = { _mm_loadu_ps(reduction.max), _mm_loadu_ps(reduction.max + 4) };
+    auto threshold = _mm_set1_ps(reduction.threshold);
+    uint64_t crossings = 0;
+    auto start = i;
+    for (; count - i >= TRACE_LANES; i += TRACE_LANES) {
+        for (size_t half = 0; half < 2; half++) {
+            auto p = samples + i + 4 * half;
+            auto x = _mm_loadu_ps(p);
+            auto low = _mm_cvtps_pd(x);
+            auto high = _mm_cvtps_pd(_mm_movehl_ps(x, x));
+            sum[2 * half] = _mm_add_pd(sum[2 * half], low);
+            sum[2 * half + 1] = _mm_add_pd(sum[2 * half + 1], high);
+            sum_squares[2 * half] = _mm_add_pd(sum_squares[2 * half], _mm_mul_pd(low, low));
+            sum_squares[2 * half + 1] = _mm_add_pd(sum_squares[2 * half + 1], _mm_mul_pd(high, high));
+            min[half] = _mm_min_ps(x, min[half]);
+            max[half] = _mm_max_ps(x, max[half]);
+            auto crossed = _mm_and_ps(_mm_cmplt_ps(_mm_loadu_ps(p - 1), threshold), _mm_cmpge_ps(x, threshold));
+            crossings += __builtin_popcount(_mm_movemask_ps(crossed));
+        }
+    }
+
+    for (size_t k = 0; k < 4; k++) {
+        _mm_storeu_pd(reduction.sum + 2 * k, sum[k]);
+        _mm_storeu_pd(reduction.sum_squares + 2 * k, sum_squares[k]);
+    }
+    _mm_storeu_ps(reduction.min, min[0]);
+    _mm_storeu_ps(reduction.min + 4, min[1]);
+    _mm_storeu_ps(reduction.max, max[0]);
+    _mm_storeu_ps(reduction.max + 4, max[1]);
+    reduction.count += i - start;
+    reduction.crossings += crossings;
+    reduction.previous = samples[i - 1];
+    reduceScalar(reduction, samples + i, count - i);
+}
+
+__attribute__((target("avx2,popcnt"))) void reduceAvx2(
+    trace_reduction_t &reduction,
+    const float *samples,
+    size_t count
+)
+{
+    auto i = reduceHead(reduction, samples, count);
+    if (count - i < TRACE_LANES) {
+        reduceScalar(reduction, samples + i, count - i);
+        return;
+    }
+
+    __m256d sum[2] = { _mm256_loadu_pd(reduction.sum), _mm256_loadu_pd(reduction.sum + 4) };
+    __m256d sum_squares[2] = { _mm256_loadu_pd(reduction.sum_squares), _mm256_loadu_pd(reduction.sum_squares + 4) };
+    auto min = _mm256_loadu_ps(reduction.min);
+    auto max = _mm256_loadu_ps(reduction.max);
+    auto threshold = _mm256_set1_ps(reduction.threshold);
+    uint64_t crossings = 0;
+    auto start = i;
+    for (; count - i >= TRACE_LANES; i += TRACE_LANES) {
+        auto x = _mm256_loadu_ps(samples + i);
+        auto low = _mm256_cvtps_pd(_mm256_castps256_ps128(x));
+        auto high = _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1));
+        sum[0] = _mm256_add_pd(sum[0], low);
+        sum[1] = _mm256_add_pd(sum[1], high);
+        sum_squares[0] = _mm256_add_pd(sum_squares[0], _mm256_mul_pd(low, low));
+        sum_squares[1] = _mm256_add_pd(sum_squares[1], _mm256_mul_pd(high, high));
+        min = _mm256_min_ps(x, min);
+        max = _mm256_max_ps(x, max);
+        auto below = _mm256_cmp_ps(_mm256_loadu_ps(samples + i - 1), threshold, _CMP_LT_OQ);
+        auto crossed = _mm256_and_ps(below, _mm256_cmp_ps(x, threshold, _CMP_GE_OQ));
+        crossings += _mm_popcnt_u32(_mm256_movemask_ps(crossed));
+    }
+
+    _mm256_storeu_pd(reduction.sum, sum[0]);
+    _mm256_storeu_pd(reduction.sum + 4, sum[1]);
+    _mm256_storeu_pd(reduction.sum_squares, sum_squares[0]);
+    _mm256_storeu_pd(reduction.sum_squares + 4, sum_squares[1]);
+    _mm256_storeu_ps(reduction.min, min);
+    _mm256_storeu_ps(reduction.max, max);
+    reduction.count += i - start;
+    reduction.crossings += crossings;
+    reduction.previous = samples[i - 1];
+    reduceScalar(reduction, samples + i, count - i);
+}
+#endif // TRACE_KERNELS_X86
+
+#if TRACE_KERNELS_NEON
+void reduceNeon(trace_reduction_t &reduction, const float *samples, size_t count)
+{
+    auto i = reduceHead(reduction, samples, count);
+    if (count - i < TRACE_LANES) {
+        reduceScalar(reduction, samples + i, count - i);
+        return;
+    }
+
+    float64x2_t sum[4], sum_squares[4];
+    for (size_t k = 0; k < 4; k++) {
+        sum[k] = vld1q_f64(reduction.sum + 2 * k);
+        sum_squares[k] = vld1q_f64(reduction.sum_squares + 2 * k);
+    }
+    float32x4_t min[2] = { vld1q_f32(reduction.min), vld1q_f32(reduction.min + 4) };
+    float32x4_t max[2] = { vld1q_f32(reduction.max), vld1q_f32(reduction.max + 4) };
+    auto threshold = vdupq_n_f32(reduction.threshold);
+    uint64_t crossings = 0;
+    auto start = i;
+    for (; count - i >= TRACE_LANES; i += TRACE_LANES) {
+        uint32x4_t crossed = vdupq_n_u32(0);
+        for (size_t half = 0; half < 2; half++) {
+            auto p = samples + i + 4 * half;
+            auto x = vld1q_f32(p);
+            auto low = vcvt_f64_f32(vget_low_f32(x));
+            auto high = vcvt_high_f64_f32(x);
+            sum[2 * half] = vaddq_f64(sum[2 * half], low);
+            sum[2 * half + 1] = vaddq_f64(sum[2 * half + 1], high);
+            sum_squares[2 * half] = vaddq_f64(sum_squares[2 * half], vmulq_f64(low, low));
+            sum_squares[2 * half + 1] = vaddq_f64(sum_squares[2 * half + 1], vmulq_f64(high, high));
+
+            // vminq_f32() and vmaxq_f32() order signed zeros and propagate NaNs, unlike the scalar kernel.
+            min[half] = vbslq_f32(vcltq_f32(x, min[half]), x, min[half]);
+            max[half] = vbslq_f32(vcgtq_f32(x, max[half]), x, max[half]);
+            auto mask = vandq_u32(vcltq_f32(vld1q_f32(p - 1), threshold), vcgeq_f32(x, threshold));
+            crossed = vaddq_u32(crossed, vshrq_n_u32(mask, 31));
+        }
+        crossings += vaddvq_u32(crossed);
+    }
+
+    for (size_t k = 0; k < 4; k++) {
+        vst1q_f64(reduction.sum + 2 * k, sum[k]);
+        vst1q_f64(reduction.sum_squares + 2 * k, sum_squares[k]);
+    }
+    vst1q_f32(reduction.min, min[0]);
+    vst1q_f32(reduction.min + 4, min[1]);
+    vst1q_f32(reduction.max, max[0]);
+    vst1q_f32(reduction.max + 4, max[1]);
+    reduction.count += i - start;
+    reduction.crossings += crossings;
+    reduction.previous = samples[i - 1];
+    reduceScalar(reduction, samples + i, count - i);
+}
+#endif // TRACE_KERNELS_NEON
+
+} // namespace
+
+void trace_reduction_init(trace_reduction_t &reduction, float threshold, float previous)
+{
+    for (size_t lane = 0; lane < TRACE_LANES; lane++) {
+        reduction.sum[lane] = 0;
+        reduction.sum_squares[lane] = 0;
+        reduction.min[lane] = INFINITY;
+        reduction.max[lane] = -INFINITY;
+    }
+
+    reduction.count = 0;
+    reduction.crossings = 0;
+    reduction.threshold = threshold;
+    reduction.previous = previous;
+}
+
+double trace_reduction_sum(const trace_reduction_t &reduction)
+{
+    return combine(reduction.sum);
+}
+
+double trace_reduction_sum_squares(const trace_reduction_t &reduction)
+{
+    return combine(reduction.sum_squares);
+}
+
+float trace_reduction_min(const trace_reduction_t &reduction)
+{
+    auto min = reduction.min[0];
+    for (size_t lane = 1; lane < TRACE_LANES; lane++) {
+        min = reduction.min[lane] < min ? reduction.min[lane] : min;
+    }
+
+    return min;
+}
+
+float trace_reduction_max(const trace_reduction_t &reduction)
+{
+    auto max = reduction.max[0];
+    for (size_t lane = 1; lane < TRACE_LANES; lane++) {
+        max = reduction.max[lane] > max ? reduction.max[lane] : max;
+    }
+
+    return max;
+}
+
+bool trace_kernel_supported(trace_kernel_t kernel)
+{
+    switch (kernel) {
+        case trace_kernel_t::SCALAR:
+            return true;
+
+#if TRACE_KERNELS_X86
+        case trace_kernel_t::SSE2:
+            return true;
+
+        case trace_kernel_t::AVX2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+#endif
+
+#if TRACE_KERNELS_NEON
+        case trace_kernel_t::NEON:
+            return true;
+#endif
+
+        default:
+            return false;
+    }
+}
+
+trace_kernel_t trace_best_kernel()
+{
+    for (auto kernel : { trace_kernel_t::AVX2, trace_kernel_t::SSE2, trace_kernel_t::NEON }) {
+        if (trace_kernel_supported(kernel)) {
+            return kernel;
+        }
+    }
+
+    return trace_kernel_t::SCALAR;
+}
+
+const char *trace_kernel_name(trace_kernel_t kernel)
+{
+    for (auto &entry : KERNELS) {
+        if (entry.kernel == kernel) {
+            return entry.name;
+        }
+    }
+
+    return "unknown";
+}
+
+bool trace_parse_kernel(const char *name, trace_kernel_t &kernel)
+{
+    for (auto &entry : KERNELS) {
+        if (strcmp(name, entry.name) == 0) {
+            kernel = entry.kernel;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void trace_reduce(trace_kernel_t kernel, trace_reduction_t &reduction, const float *samples, size_t count)
+{
+    switch (kernel) {
+#if TRACE_KERNELS_X86
+        case trace_kernel_t::SSE2:
+            reduceSse2(reduction, samples, count);
+            return;
+
+        case trace_kernel_t::AVX2:
+            reduceAvx2(reduction, samples, count);
+            return;
+#endif
+
+#if TRACE_KERNELS_NEON
+        case trace_kernel_t::NEON:
+            reduceNeon(reduction, samples, count);
+            return;
+#endif
+
+        default:
+            reduceScalar(reduction, samples, count);
+            return;
+    }
+}
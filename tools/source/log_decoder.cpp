@@ -0,0 +1,210 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Decodes the output of firmware built with binary logging. Binary log records refer to their format strings by
+// address, so the firmware's ELF file is the dictionary: its loaded sections are read and each record's format string
+// is looked up in them. Text in the stream, such as errors printed by the platform, is passed through unchanged.
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include <LogFormat.h>
+
+namespace {
+
+// An ELF section which is loaded into the target's memory.
+struct Section {
+    uint64_t address;
+    std::vector<char> data;
+};
+
+uint64_t readLittleEndian(const std::vector<char> &file, size_t offset, size_t size)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < size && offset + i < file.size(); i++) {
+        value |= static_cast<uint64_t>(static_cast<uint8_t>(file[offset + i])) << (8 * i);
+    }
+
+    return value;
+}
+
+// Load the allocated sections of a little endian ELF32 or ELF64 file. Returns false if it isn't one.
+bool loadElf(const char *path, std::vector<Section> &sections)
+{
+    auto f = fopen(path, "rb");
+    if (f == nullptr) {
+        return false;
+    }
+
+    std::vector<char> file;
+    char buffer[4096];
+    for (size_t n; (n = fread(buffer, 1, sizeof(buffer), f)) > 0;) {
+        file.insert(file.end(), buffer, buffer + n);
+    }
+    fclose(f);
+
+    static const uint8_t ELF_MAGIC[] = { 0x7f, 'E', 'L', 'F' };
+    static const int ELFCLASS64 = 2;
+    static const int ELFDATA2LSB = 1;
+    if (file.size() < 64 || memcmp(file.data(), ELF_MAGIC, sizeof(ELF_MAGIC)) != 0 || file[5] != ELFDATA2LSB) {
+        return false;
+    }
+
+    // Offsets of the fields needed from the file and section headers.
+    bool is64 = file[4] == ELFCLASS64;
+    size_t word = is64 ? 8 : 4;
+    auto section_offset = readLittleEndian(file, is64 ? 0x28 : 0x20, word);
+    auto section_size = readLittleEndian(file, is64 ? 0x3a : 0x2e, 2);
+    auto section_count = readLittleEndian(file, is64 ? 0x3c : 0x30, 2);
+
+    static const uint64_t SHT_NOBITS = 8;
+    static const uint64_t SHF_ALLOC = 2;
+    for (uint64_t i = 0; i < section_count; i++) {
+        size_t header = section_offset + i * section_size;
+        auto type = readLittleEndian(file, header + 4, 4);
+        auto flags = readLittleEndian(file, header + 8, word);
+        auto address = readLittleEndian(file, header + 8 + word, word);
+        auto offset = readLittleEndian(file, header + 8 + 2 * word, word);
+        auto size = readLittleEndian(file, header + 8 + 3 * word, word);
+        if (type == SHT_NOBITS || (flags & SHF_ALLOC) == 0 || offset + size > file.size()) {
+            continue;
+        }
+
+        sections.push_back({ address, std::vector<char>(file.begin() + offset, file.begin() + offset + size) });
+    }
+
+    return true;
+}
+
+// Gets the NUL terminated string at address in the target's memory, or nullptr.
+const char *lookUp(const std::vector<Section> &sections, uint64_t address)
+{
+    for (auto &section : sections) {
+        if (address < section.address || address - section.address >= section.data.size()) {
+            continue;
+        }
+
+        auto s = &section.data[address - section.address];
+        auto end = section.data.data() + section.data.size();
+        return memchr(s, '\0', end - s) != nullptr ? s : nullptr;
+    }
+
+    return nullptr;
+}
+
+bool at_line_start = true;
+
+void print(void *, const char *fmt, ...)
+{
+    char text[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+
+    fputs(text, stdout);
+    if (text[0] != '\0') {
+        at_line_start = text[strlen(text) - 1] == '\n';
+    }
+}
+
+void printUsage()
+{
+    fprintf(stderr,
+        "Usage: log_decoder [-t] <firmware.elf> [log]\n"
+        "Decodes binary log records in the log (default: stdin) using the format strings in the firmware.\n"
+        " -t  Prefix lines which start with a record with its timestamp in ms\n"
+    );
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    bool timestamps = false;
+    int arg = 1;
+    if (arg < argc && strcmp(argv[arg], "-t") == 0) {
+        timestamps = true;
+        arg++;
+    }
+
+    if (arg >= argc || argc - arg > 2) {
+        printUsage();
+        return 2;
+    }
+
+    std::vector<Section> sections;
+    if (!loadElf(argv[arg], sections)) {
+        fprintf(stderr, "Cannot read ELF file %s\n", argv[arg]);
+        return 1;
+    }
+
+    auto in = stdin;
+    if (arg + 1 < argc) {
+        in = fopen(argv[arg + 1], "rb");
+        if (in == nullptr) {
+            fprintf(stderr, "Cannot open %s\n", argv[arg + 1]);
+            return 1;
+        }
+    }
+
+    int c;
+    while ((c = fgetc(in)) != EOF) {
+        if (c != LOG_FRAME_SYNC) {
+            fputc(c, stdout);
+            at_line_start = c == '\n';
+            continue;
+        }
+
+        // Frame: sync, length, record.
+        int size = fgetc(in);
+        uint8_t record[256];
+        if (size == EOF || fread(record, 1, size, in) != static_cast<size_t>(size)) {
+            fprintf(stderr, "Truncated log record at end of input\n");
+            break;
+        }
+
+        log_record_header_t header;
+        if (!log_decode_header(record, size, header)) {
+            print(nullptr, "<truncated log record>\n");
+            continue;
+        }
+
+        auto fmt = lookUp(sections, header.id);
+        if (fmt == nullptr) {
+            print(nullptr, "<unknown log record id 0x%llx>\n", static_cast<unsigned long long>(header.id));
+            continue;
+        }
+
+        if (timestamps && at_line_start) {
+            print(nullptr, "[%10lu] ", static_cast<unsigned long>(header.timestamp));
+        }
+
+        if (!log_print_record(record + header.size, size - header.size, fmt, &print, nullptr)) {
+            print(nullptr, "<truncated log record>\n");
+        }
+    }
+
+    if (in != stdin) {
+        fclose(in);
+    }
+
+    return 0;
+}
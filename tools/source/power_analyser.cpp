@@ -0,0 +1,796 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Slices a power trace by the state markers of the test program's log and prints the statistics of each state. The
+// log is small and read first. Raw float traces are memory mapped and each state is reduced with the vector kernels of
+// TraceKernels.h; other traces are streamed sample by sample. Either way, the length of a trace is not limited by
+// memory.
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <TraceKernels.h>
+
+namespace {
+
+// Percentiles come from a histogram whose bins are the top bits of the current as a float: 64 bins per octave, so a
+// percentile is within 0.8% of the exact value. Currents below MIN_CURRENT, including negative noise, share bin 0
+// and those above MAX_CURRENT the last bin.
+const int MANTISSA_BITS = 6;
+const float MIN_CURRENT = 1.0f / (1 << 30);
+const float MAX_CURRENT = 16.0f;
+
+uint32_t floatBits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+float bitsFloat(uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+const uint32_t FIRST_BIN_KEY = floatBits(MIN_CURRENT) >> (23 - MANTISSA_BITS);
+const size_t BIN_COUNT = (floatBits(MAX_CURRENT) >> (23 - MANTISSA_BITS)) - FIRST_BIN_KEY + 2;
+
+size_t binOf(float amps)
+{
+    if (!(amps >= MIN_CURRENT)) {
+        return 0;
+    }
+
+    if (amps >= MAX_CURRENT) {
+        return BIN_COUNT - 1;
+    }
+
+    return (floatBits(amps) >> (23 - MANTISSA_BITS)) - FIRST_BIN_KEY + 1;
+}
+
+// Middle of the range of currents of a bin.
+double binValue(size_t bin)
+{
+    if (bin == 0) {
+        return 0;
+    }
+
+    if (bin == BIN_COUNT - 1) {
+        return MAX_CURRENT;
+    }
+
+    auto key = static_cast<uint32_t>(bin - 1 + FIRST_BIN_KEY);
+    return (static_cast<double>(bitsFloat(key << (23 - MANTISSA_BITS))) + bitsFloat((key + 1) << (23 - MANTISSA_BITS)))
+        / 2;
+}
+
+// Statistics of the samples of a state.
+struct Stats {
+    uint64_t count = 0;
+    uint64_t samples = 0;
+    double duration_s = 0;
+    double charge_c = 0;
+    double energy_j = 0;
+
+    // Integral of the square of the current, for the RMS current.
+    double squares_a2s = 0;
+    double min_a = INFINITY;
+    double max_a = -INFINITY;
+    uint64_t crossings = 0;
+    std::vector<uint64_t> bins = std::vector<uint64_t>(BIN_COUNT);
+
+    void add(double amps, double volts, double dt, bool crossed)
+    {
+        samples++;
+        duration_s += dt;
+        charge_c += amps * dt;
+        energy_j += amps * volts * dt;
+        squares_a2s += amps * amps * dt;
+        min_a = std::min(min_a, amps);
+        max_a = std::max(max_a, amps);
+        crossings += crossed;
+        bins[binOf(static_cast<float>(amps))]++;
+    }
+
+    // Add the reduction of raw samples taken every dt, which are currents once multiplied by scale. The histogram is
+    // filled separately.
+    void add(const trace_reduction_t &reduction, double scale, double volts, double dt)
+    {
+        auto charge = trace_reduction_sum(reduction) * scale * dt;
+        samples += reduction.count;
+        duration_s += reduction.count * dt;
+        charge_c += charge;
+        energy_j += charge * volts;
+        squares_a2s += trace_reduction_sum_squares(reduction) * scale * scale * dt;
+        min_a = std::min<double>(min_a, trace_reduction_min(reduction) * scale);
+        max_a = std::max<double>(max_a, trace_reduction_max(reduction) * scale);
+        crossings += reduction.crossings;
+    }
+
+    void merge(const Stats &other)
+    {
+        count += other.count;
+        samples += other.samples;
+        duration_s += other.duration_s;
+        charge_c += other.charge_c;
+        energy_j += other.energy_j;
+        squares_a2s += other.squares_a2s;
+        crossings += other.crossings;
+        min_a = std::min(min_a, other.min_a);
+        max_a = std::max(max_a, other.max_a);
+        for (size_t i = 0; i < BIN_COUNT; i++) {
+            bins[i] += other.bins[i];
+        }
+    }
+
+    // Current below which a fraction p of the samples lie, within the observed range.
+    double percentile(double p) const
+    {
+        auto rank = std::max<uint64_t>(static_cast<uint64_t>(ceil(p * samples)), 1);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BIN_COUNT; i++) {
+            seen += bins[i];
+            if (seen >= rank) {
+                return std::min(std::max(binValue(i), min_a), max_a);
+            }
+        }
+
+        return max_a;
+    }
+};
+
+// A state, from its marker to the next one. Times are device uptimes in ms.
+struct Segment {
+    std::string state;
+
+    // Values of the sweep step the state belongs to, e.g. "adv_interval=100", or empty.
+    std::string sweep;
+    uint32_t start_ms;
+};
+
+// A state in a sweep step, which the summary aggregates over repetitions.
+struct Group {
+    std::string state;
+    std::string sweep;
+    Stats stats;
+};
+
+enum class format_t {
+    csv,
+    f32,
+    f64,
+    i16,
+    u16,
+    i32,
+};
+
+struct Options {
+    format_t format = format_t::csv;
+    double sample_rate = 0;
+    bool pairs = false;
+    unsigned time_column = 1;
+    unsigned current_column = 2;
+    unsigned voltage_column = 0;
+    double time_scale = 1;
+    double current_scale = 1;
+    double voltage_scale = 1;
+    double supply_v = 3.0;
+    double offset_ms = 0;
+    double threshold_a = INFINITY;
+    bool segments = false;
+    trace_kernel_t kernel = trace_best_kernel();
+};
+
+size_t sampleSize(format_t format)
+{
+    switch (format) {
+        case format_t::f32: return 4;
+        case format_t::f64: return 8;
+        case format_t::i16: return 2;
+        case format_t::u16: return 2;
+        case format_t::i32: return 4;
+        case format_t::csv: break;
+    }
+
+    return 0;
+}
+
+struct Sample {
+    double time_s;
+    double amps;
+    double volts;
+};
+
+bool readLine(FILE *f, std::string &line)
+{
+    line.clear();
+    char buffer[512];
+    while (fgets(buffer, sizeof(buffer), f) != nullptr) {
+        line += buffer;
+        if (line.back() == '\n') {
+            return true;
+        }
+    }
+
+    return !line.empty();
+}
+
+// Read the markers of the log. Sweep markers label the states up to the next one. Fails if the log covers several
+// boots, since the uptime then goes back.
+bool readMarkers(FILE *f, std::vector<Segment> &segments, std::string &device)
+{
+    std::string line;
+    std::string sweep;
+    while (readLine(f, line)) {
+        // Lines may carry a timestamp from log_decoder -t.
+        size_t pos = line.find_first_not_of(" \t\r");
+        if (pos != std::string::npos && line[pos] == '[') {
+            pos = line.find(']', pos);
+            pos = pos == std::string::npos ? pos : line.find_first_not_of(' ', pos + 1);
+        }
+
+        if (pos == std::string::npos || line[pos] != '#') {
+            continue;
+        }
+
+        auto end = line.find_last_not_of(" \t\r\n");
+        auto marker = line.substr(pos + 1, end - pos);
+        auto name = marker.substr(0, marker.find(' '));
+        if (name == "DEV") {
+            if (!segments.empty()) {
+                fprintf(stderr, "The log covers several boots, split it at the #DEV lines\n");
+                return false;
+            }
+
+            device = marker.size() > 6 ? marker.substr(6) : "";
+            continue;
+        }
+
+        auto t = marker.rfind(" t=");
+        if (t == std::string::npos || name.empty()) {
+            continue;
+        }
+
+        char *number_end;
+        auto time_ms = strtoul(marker.c_str() + t + 3, &number_end, 10);
+        if (*number_end != '\0') {
+            continue;
+        }
+
+        if (name == "SWEEP") {
+            // "#SWEEP 3/12 rep=1 adv_interval=100 t=123456", or "#SWEEP END t=123456".
+            sweep.clear();
+            size_t field = marker.find(' ');
+            while (field < t) {
+                auto next = marker.find(' ', field + 1);
+                auto token = marker.substr(field + 1, next - field - 1);
+                if (token.find('=') != std::string::npos && token.compare(0, 4, "rep=") != 0) {
+                    sweep += (sweep.empty() ? "" : " ") + token;
+                }
+                field = next;
+            }
+            continue;
+        }
+
+        if (!std::all_of(name.begin(), name.end(), [](char c) { return isupper(c) || c == '_'; })) {
+            continue;
+        }
+
+        if (!segments.empty() && time_ms < segments.back().start_ms) {
+            fprintf(stderr, "The state markers go back in time at \"%s\"\n", line.c_str());
+            return false;
+        }
+
+        segments.push_back({ name, sweep, static_cast<uint32_t>(time_ms) });
+    }
+
+    return true;
+}
+
+// Reads samples one at a time from a CSV export or a raw binary capture.
+struct TraceReader {
+    TraceReader(FILE *f, const Options &options)
+    : _f(f)
+    , _options(options)
+    , _index(0)
+    , _position(0)
+    {}
+
+    bool next(Sample &sample)
+    {
+        return _options.format == format_t::csv ? nextCsv(sample) : nextBinary(sample);
+    }
+
+private:
+    static const size_t BUFFER_SAMPLES = 64 * 1024;
+
+    FILE *_f;
+    const Options &_options;
+    uint64_t _index;
+    std::string _line;
+    std::vector<char> _buffer;
+    size_t _position;
+
+    // Lines whose columns are not numbers, such as headers, are skipped.
+    bool nextCsv(Sample &sample)
+    {
+        while (readLine(_f, _line)) {
+            double time = NAN, amps = NAN, volts = NAN;
+            unsigned column = 1;
+            for (const char *field = _line.c_str();; column++) {
+                char *end;
+                auto value = strtod(field, &end);
+                bool parsed = end != field && strchr(",;\t\r\n ", *end) != nullptr;
+                if (column == _options.time_column) {
+                    time = parsed ? value : NAN;
+                }
+                if (column == _options.current_column) {
+                    amps = parsed ? value : NAN;
+                }
+                if (column == _options.voltage_column) {
+                    volts = parsed ? value : NAN;
+                }
+
+                field = strpbrk(field, ",;\t");
+                if (field == nullptr) {
+                    break;
+                }
+                field++;
+            }
+
+            if (isnan(time) || isnan(amps) || (_options.voltage_column != 0 && isnan(volts))) {
+                continue;
+            }
+
+            volts = _options.voltage_column != 0 ? volts * _options.voltage_scale : _options.supply_v;
+            sample = { time * _options.time_scale, amps * _options.current_scale, volts };
+            return true;
+        }
+
+        return false;
+    }
+
+    template<typename T>
+    static double decode(const char *p)
+    {
+        T value;
+        memcpy(&value, p, sizeof(value));
+        return static_cast<double>(value);
+    }
+
+    double decode(const char *p) const
+    {
+        switch (_options.format) {
+            case format_t::f32: return decode<float>(p);
+            case format_t::f64: return decode<double>(p);
+            case format_t::i16: return decode<int16_t>(p);
+            case format_t::u16: return decode<uint16_t>(p);
+            case format_t::i32: return decode<int32_t>(p);
+            case format_t::csv: break;
+        }
+
+        return NAN;
+    }
+
+    // Raw little endian samples at a fixed rate, currents or current and voltage pairs.
+    bool nextBinary(Sample &sample)
+    {
+        size_t size = sampleSize(_options.format) * (_options.pairs ? 2 : 1);
+        if (_buffer.size() - _position < size) {
+            // Keep the partial sample at the end of the buffer and refill the rest.
+            _buffer.erase(_buffer.begin(), _buffer.begin() + _position);
+            _position = 0;
+            auto kept = _buffer.size();
+            _buffer.resize(BUFFER_SAMPLES * size);
+            _buffer.resize(kept + fread(_buffer.data() + kept, 1, _buffer.size() - kept, _f));
+            if (_buffer.size() < size) {
+                return false;
+            }
+        }
+
+        auto p = _buffer.data() + _position;
+        _position += size;
+        auto volts = _options.pairs ? decode(p + size / 2) * _options.voltage_scale : _options.supply_v;
+        sample = { _index++ / _options.sample_rate, decode(p) * _options.current_scale, volts };
+        return true;
+    }
+};
+
+void printHeader(bool segments)
+{
+    printf(
+        "state,sweep,%s,duration_s,samples,mean_uA,rms_uA,min_uA,p50_uA,p90_uA,p99_uA,max_uA,charge_uC,energy_uJ,"
+        "mean_uW,crossings\n",
+        segments ? "start_ms" : "count"
+    );
+}
+
+void printStats(const std::string &state, const std::string &sweep, uint64_t first, const Stats &stats)
+{
+    if (stats.samples == 0) {
+        return;
+    }
+
+    printf(
+        "%s,%s,%" PRIu64 ",%.6f,%" PRIu64 ",%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%" PRIu64 "\n",
+        state.c_str(),
+        sweep.c_str(),
+        first,
+        stats.duration_s,
+        stats.samples,
+        stats.charge_c / stats.duration_s * 1e6,
+        sqrt(stats.squares_a2s / stats.duration_s) * 1e6,
+        stats.min_a * 1e6,
+        stats.percentile(0.5) * 1e6,
+        stats.percentile(0.9) * 1e6,
+        stats.percentile(0.99) * 1e6,
+        stats.max_a * 1e6,
+        stats.charge_c * 1e6,
+        stats.energy_j * 1e6,
+        stats.energy_j / stats.duration_s * 1e6,
+        stats.crossings
+    );
+}
+
+bool parseFormat(const char *text, format_t &format)
+{
+    static const struct {
+        const char *name;
+        format_t format;
+    } FORMATS[] = {
+        { "csv", format_t::csv },
+        { "f32", format_t::f32 },
+        { "f64", format_t::f64 },
+        { "i16", format_t::i16 },
+        { "u16", format_t::u16 },
+        { "i32", format_t::i32 },
+    };
+
+    for (auto &entry : FORMATS) {
+        if (strcmp(text, entry.name) == 0) {
+            format = entry.format;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool parseDouble(const char *text, double &value)
+{
+    char *end;
+    value = strtod(text, &end);
+    return end != text && *end == '\0' && isfinite(value);
+}
+
+bool parseColumns(const char *text, Options &options)
+{
+    unsigned time, current, voltage = 0;
+    int fields = sscanf(text, "%u,%u,%u", &time, &current, &voltage);
+    if (fields < 2 || time == 0 || current == 0) {
+        return false;
+    }
+
+    options.time_column = time;
+    options.current_column = current;
+    options.voltage_column = voltage;
+    return true;
+}
+
+// Statistics of the segments of a trace, as its samples are added in order.
+struct Analysis {
+    Analysis(const Options &options, const std::vector<Segment> &segments)
+    : options(options)
+    , segments(segments)
+    {}
+
+    const Options &options;
+    const std::vector<Segment> &segments;
+    std::vector<Group> groups;
+
+    // Statistics of the current segment.
+    Stats current;
+    size_t segment = 0;
+    uint64_t total = 0;
+    uint64_t skipped = 0;
+
+    // Last sample, for crossings.
+    double previous_a = NAN;
+
+    // Start of a segment in trace time.
+    double startS(size_t i) const
+    {
+        return (segments[i].start_ms - options.offset_ms) / 1000;
+    }
+
+    // Print the current segment if requested, and add it to its group.
+    void finish()
+    {
+        if (current.samples == 0) {
+            return;
+        }
+
+        auto &state = segments[segment];
+        current.count = 1;
+        if (options.segments) {
+            printStats(state.state, state.sweep, state.start_ms, current);
+        }
+
+        auto group = std::find_if(groups.begin(), groups.end(), [&](const Group &g) {
+            return g.state == state.state && g.sweep == state.sweep;
+        });
+        if (group == groups.end()) {
+            groups.push_back({ state.state, state.sweep, Stats() });
+            group = groups.end() - 1;
+        }
+
+        group->stats.merge(current);
+        current = Stats();
+    }
+
+    void add(const Sample &sample, double dt)
+    {
+        total++;
+        bool crossed = previous_a < options.threshold_a && sample.amps >= options.threshold_a;
+        previous_a = sample.amps;
+        if (sample.time_s < startS(0)) {
+            skipped++;
+            return;
+        }
+
+        while (segment + 1 < segments.size() && sample.time_s >= startS(segment + 1)) {
+            finish();
+            segment++;
+        }
+
+        current.add(sample.amps, sample.volts, dt, crossed);
+    }
+};
+
+// Read the samples of a trace one at a time.
+bool stream(const char *path, Analysis &analysis)
+{
+    auto trace = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (trace == nullptr) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+
+    // Each sample stands for the time up to the next one, so a sample is only added once the next has been read.
+    auto &options = analysis.options;
+    TraceReader reader(trace, options);
+    Sample previous{}, sample{};
+    bool has_previous = false;
+    double dt = options.format == format_t::csv ? 0 : 1 / options.sample_rate;
+    while (reader.next(sample)) {
+        if (has_previous) {
+            if (options.format == format_t::csv) {
+                dt = std::max(sample.time_s - previous.time_s, 0.0);
+            }
+            analysis.add(previous, dt);
+        }
+
+        previous = sample;
+        has_previous = true;
+    }
+
+    if (has_previous) {
+        analysis.add(previous, dt);
+    }
+    analysis.finish();
+
+    if (trace != stdin) {
+        fclose(trace);
+    }
+
+    return true;
+}
+
+// Map a trace of raw float currents and reduce each segment with the kernel.
+bool reduceMapped(const char *path, Analysis &analysis)
+{
+    auto fd = open(path, O_RDONLY);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+
+    auto size = static_cast<size_t>(status.st_size);
+    void *data = size == 0 ? nullptr : mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Cannot map %s\n", path);
+        return false;
+    }
+
+    madvise(data, size, MADV_SEQUENTIAL);
+    auto samples = static_cast<const float *>(data);
+    uint64_t count = size / sizeof(float);
+    auto &options = analysis.options;
+    auto dt = 1 / options.sample_rate;
+
+    // The first sample of a segment, with the same times as the streamed samples.
+    auto firstSample = [&](size_t segment) {
+        auto start = analysis.startS(segment);
+        uint64_t k = start > 0 ? static_cast<uint64_t>(ceil(start * options.sample_rate)) : 0;
+        while (k > 0 && static_cast<double>(k - 1) / options.sample_rate >= start) {
+            k--;
+        }
+        while (k < count && static_cast<double>(k) / options.sample_rate < start) {
+            k++;
+        }
+
+        return std::min(k, count);
+    };
+
+    // Reduce in chunks which stay in the cache for the histogram.
+    static const size_t CHUNK_SAMPLES = 16 * 1024;
+    auto threshold = static_cast<float>(options.threshold_a / options.current_scale);
+    auto &segments = analysis.segments;
+    analysis.total = count;
+    analysis.skipped = firstSample(0);
+    for (size_t segment = 0; segment < segments.size(); segment++) {
+        auto begin = firstSample(segment);
+        auto end = segment + 1 < segments.size() ? firstSample(segment + 1) : count;
+        if (begin >= end) {
+            continue;
+        }
+
+        trace_reduction_t reduction;
+        trace_reduction_init(reduction, threshold, begin > 0 ? samples[begin - 1] : NAN);
+        for (auto chunk = begin; chunk < end; chunk += CHUNK_SAMPLES) {
+            auto n = static_cast<size_t>(std::min<uint64_t>(end - chunk, CHUNK_SAMPLES));
+            trace_reduce(options.kernel, reduction, samples + chunk, n);
+            for (size_t i = 0; i < n; i++) {
+                analysis.current.bins[binOf(static_cast<float>(samples[chunk + i] * options.current_scale))]++;
+            }
+        }
+
+        analysis.segment = segment;
+        analysis.current.add(reduction, options.current_scale, options.supply_v, dt);
+        analysis.finish();
+    }
+
+    if (data != nullptr) {
+        munmap(data, size);
+    }
+
+    return true;
+}
+
+void printUsage()
+{
+    fprintf(stderr,
+        "Usage: power_analyser [options] <log> <trace|->\n"
+        "Prints statistics of the power trace in each state marked in the test program's log, as CSV.\n"
+        " -f <format>  Trace format: csv (default), or raw little endian f32, f64, i16, u16 or i32 samples\n"
+        " -r <Hz>      Sample rate of raw traces\n"
+        " -p           Raw samples are current and voltage pairs\n"
+        " -c <t,i[,v]> CSV columns of the time, current and voltage, from 1 (default 1,2)\n"
+        " -t <s>       Seconds per unit of the CSV time (default 1)\n"
+        " -i <A>       Amps per unit of current (default 1), e.g. 1e-6 for uA\n"
+        " -u <V>       Volts per unit of voltage (default 1)\n"
+        " -v <V>       Supply voltage if the trace has none (default 3)\n"
+        " -o <ms>      Device uptime at trace time 0 (default 0)\n"
+        " -x <A>       Count the rises of the current to this threshold or above\n"
+        " -s           One line per state marker instead of per state and sweep step\n"
+        " -k <kernel>  Kernel for raw f32 traces: scalar, sse2, avx2 or neon (default: the fastest supported)\n"
+    );
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options options;
+    bool ok = true;
+    int opt;
+    while (ok && (opt = getopt(argc, argv, "f:r:pc:t:i:u:v:o:x:sk:")) != -1) {
+        switch (opt) {
+            case 'f': ok = parseFormat(optarg, options.format); break;
+            case 'r': ok = parseDouble(optarg, options.sample_rate) && options.sample_rate > 0; break;
+            case 'p': options.pairs = true; break;
+            case 'c': ok = parseColumns(optarg, options); break;
+            case 't': ok = parseDouble(optarg, options.time_scale); break;
+            case 'i': ok = parseDouble(optarg, options.current_scale); break;
+            case 'u': ok = parseDouble(optarg, options.voltage_scale); break;
+            case 'v': ok = parseDouble(optarg, options.supply_v); break;
+            case 'o': ok = parseDouble(optarg, options.offset_ms); break;
+            case 'x': ok = parseDouble(optarg, options.threshold_a); break;
+            case 's': options.segments = true; break;
+            case 'k': ok = trace_parse_kernel(optarg, options.kernel) && trace_kernel_supported(options.kernel); break;
+            default: ok = false; break;
+        }
+    }
+
+    if (!ok || argc - optind != 2 || (options.format != format_t::csv && options.sample_rate == 0)) {
+        printUsage();
+        return 2;
+    }
+
+    auto log = fopen(argv[optind], "rb");
+    if (log == nullptr) {
+        fprintf(stderr, "Cannot open %s\n", argv[optind]);
+        return 1;
+    }
+
+    std::vector<Segment> segments;
+    std::string device;
+    ok = readMarkers(log, segments, device);
+    fclose(log);
+    if (!ok) {
+        return 1;
+    }
+
+    if (segments.empty()) {
+        fprintf(stderr, "No state markers in %s\n", argv[optind]);
+        return 1;
+    }
+
+    Analysis analysis(options, segments);
+    if (options.segments) {
+        printHeader(true);
+    }
+
+    // Raw float currents are mapped and reduced by the kernels, unless they come from a pipe.
+    auto path = argv[optind + 1];
+    if (options.format == format_t::f32 && !options.pairs && options.current_scale > 0 && strcmp(path, "-") != 0) {
+        ok = reduceMapped(path, analysis);
+    } else {
+        ok = stream(path, analysis);
+    }
+
+    if (!ok) {
+        return 1;
+    }
+
+    if (!options.segments) {
+        printHeader(false);
+        for (auto &group : analysis.groups) {
+            printStats(group.state, group.sweep, group.stats.count, group.stats);
+        }
+    }
+
+    fprintf(
+        stderr,
+        "%s%s%zu state markers, %" PRIu64 " samples, %" PRIu64 " before the first marker\n",
+        device.c_str(),
+        device.empty() ? "" : ": ",
+        segments.size(),
+        analysis.total,
+        analysis.skipped
+    );
+    return 0;
+}
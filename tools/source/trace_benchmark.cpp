@@ -0,0 +1,187 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2021 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the throughput of the trace reduction kernels and checks that each gives the same bits as the scalar one,
+// including when the samples are passed in runs of irregular sizes.
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <initializer_list>
+#include <vector>
+
+#include <TraceKernels.h>
+
+namespace {
+
+// A synthetic trace of a board idling around 2 uA with radio events of a few mA, in amps.
+std::vector<float> synthesise(size_t count)
+{
+    std::vector<float> samples(count);
+    uint32_t state = 1;
+    for (size_t i = 0; i < count; i++) {
+        state = state * 1664525 + 1013904223;
+        auto noise = static_cast<float>(state >> 8) / (1 << 24);
+        samples[i] = (i % 10000 < 300 ? 5e-3f : 2e-6f) * (0.9f + 0.2f * noise);
+    }
+
+    return samples;
+}
+
+bool load(const char *path, std::vector<float> &samples)
+{
+    auto f = fopen(path, "rb");
+    if (f == nullptr) {
+        return false;
+    }
+
+    float buffer[4096];
+    for (size_t n; (n = fread(buffer, sizeof(float), 4096, f)) > 0;) {
+        samples.insert(samples.end(), buffer, buffer + n);
+    }
+    fclose(f);
+    return true;
+}
+
+// Reduce the samples in runs whose sizes follow a fixed pseudo-random sequence.
+void reduceInRuns(trace_kernel_t kernel, trace_reduction_t &reduction, const std::vector<float> &samples)
+{
+    uint32_t state = 7;
+    for (size_t i = 0; i < samples.size();) {
+        state = state * 1664525 + 1013904223;
+        auto n = std::min<size_t>(state >> 20, samples.size() - i);
+        trace_reduce(kernel, reduction, samples.data() + i, n);
+        i += n;
+    }
+}
+
+bool sameBits(double a, double b)
+{
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+bool sameTotals(const trace_reduction_t &a, const trace_reduction_t &b)
+{
+    return sameBits(trace_reduction_sum(a), trace_reduction_sum(b))
+        && sameBits(trace_reduction_sum_squares(a), trace_reduction_sum_squares(b))
+        && sameBits(trace_reduction_min(a), trace_reduction_min(b))
+        && sameBits(trace_reduction_max(a), trace_reduction_max(b))
+        && a.count == b.count
+        && a.crossings == b.crossings;
+}
+
+void printUsage()
+{
+    fprintf(stderr,
+        "Usage: trace_benchmark [-n <samples>] [-r <repetitions>] [-x <A>] [trace.f32]\n"
+        "Reduces a raw f32 trace, or a synthetic one, with each supported kernel.\n"
+        " -n <samples>      Samples of the synthetic trace (default 50000000)\n"
+        " -r <repetitions>  Timed runs of each kernel, of which the fastest is reported (default 5)\n"
+        " -x <A>            Threshold for crossings (default 1e-3)\n"
+    );
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    size_t count = 50000000;
+    unsigned repetitions = 5;
+    float threshold = 1e-3f;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:x:")) != -1) {
+        switch (opt) {
+            case 'n': count = strtoull(optarg, nullptr, 10); break;
+            case 'r': repetitions = static_cast<unsigned>(strtoul(optarg, nullptr, 10)); break;
+            case 'x': threshold = strtof(optarg, nullptr); break;
+            default: printUsage(); return 2;
+        }
+    }
+
+    if (argc - optind > 1 || count == 0 || repetitions == 0) {
+        printUsage();
+        return 2;
+    }
+
+    std::vector<float> samples;
+    if (optind < argc) {
+        if (!load(argv[optind], samples) || samples.empty()) {
+            fprintf(stderr, "Cannot read samples from %s\n", argv[optind]);
+            return 1;
+        }
+    } else {
+        samples = synthesise(count);
+    }
+
+    trace_reduction_t reference;
+    trace_reduction_init(reference, threshold, NAN);
+    trace_reduce(trace_kernel_t::SCALAR, reference, samples.data(), samples.size());
+
+    printf("%zu samples, %.1f MB\n", samples.size(), samples.size() * sizeof(float) / 1e6);
+    printf("kernel   Msamples/s     GB/s  speedup  bit-identical\n");
+    bool identical = true;
+    double scalar_s = 0;
+    for (auto kernel : { trace_kernel_t::SCALAR, trace_kernel_t::SSE2, trace_kernel_t::AVX2, trace_kernel_t::NEON }) {
+        if (!trace_kernel_supported(kernel)) {
+            continue;
+        }
+
+        double best_s = 0;
+        trace_reduction_t reduction;
+        for (unsigned i = 0; i < repetitions; i++) {
+            trace_reduction_init(reduction, threshold, NAN);
+            auto start = std::chrono::steady_clock::now();
+            trace_reduce(kernel, reduction, samples.data(), samples.size());
+            auto s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            best_s = i == 0 ? s : std::min(best_s, s);
+        }
+
+        trace_reduction_t runs;
+        trace_reduction_init(runs, threshold, NAN);
+        reduceInRuns(kernel, runs, samples);
+        bool same = sameTotals(reduction, reference) && sameTotals(runs, reference);
+        identical = identical && same;
+        if (kernel == trace_kernel_t::SCALAR) {
+            scalar_s = best_s;
+        }
+
+        printf(
+            "%-8s %10.1f %8.2f %8.2f  %s\n",
+            trace_kernel_name(kernel),
+            samples.size() / best_s / 1e6,
+            samples.size() * sizeof(float) / best_s / 1e9,
+            scalar_s / best_s,
+            same ? "yes" : "NO"
+        );
+    }
+
+    printf(
+        "sum %.17g, sum of squares %.17g, min %.9g, max %.9g, crossings %" PRIu64 "\n",
+        trace_reduction_sum(reference),
+        trace_reduction_sum_squares(reference),
+        trace_reduction_min(reference),
+        trace_reduction_max(reference),
+        reference.crossings
+    );
+    return identical ? 0 : 1;
+}
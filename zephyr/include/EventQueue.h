@@ -17,24 +17,99 @@
 #ifndef EVENTQUEUE_H
 #define EVENTQUEUE_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <time.h>
 
 #include <zephyr.h>
 
+#include <config.h>
+#include <SchedulerStats.h>
+
 /// Event queue with a similar interface to mbed EventQueue.
-/// Callbacks are scheduled in the order (1) that they become ready, and (2) that they arrive. Meaning that if two
-/// callbacks become ready at the same time, the one which was scheduled first runs first.
+/// Callbacks are scheduled in the order (1) that they must run by, and (2) that they arrive. Meaning that if two
+/// callbacks become ready at the same time, the one which was scheduled first runs first. A callback scheduled with
+/// slack may run anywhere between its deadline and its deadline plus the slack, which lets it share a wakeup with
+/// other callbacks.
+/// While no callback is ready the dispatching thread blocks, so the CPU can idle until the next deadline.
+/// Events are taken from a fixed-size pool (CONFIG_APP_EVENT_QUEUE_SIZE), so scheduling never touches the heap. When
+/// the pool is exhausted the program halts, or the event is dropped if CONFIG_APP_EVENT_QUEUE_DROP_ON_OVERFLOW is set.
+/// Only post() may be used from threads other than the dispatching thread, or from ISRs. It is lock-free and writes
+/// into a bounded ring (CONFIG_APP_EVENT_QUEUE_POST_DEPTH) that the dispatcher drains before running timers.
 struct EventQueue {
     typedef void( *callback_t)(void *);
 
-    ~EventQueue();
+    /// Maximum number of pending events.
+    static constexpr size_t CAPACITY = CONFIG_EVENT_QUEUE_SIZE;
+
+    /// Maximum size of a payload copied into an event by call_in().
+    static constexpr size_t PAYLOAD_SIZE = 4 * sizeof(void *);
+
+    /// Capacity of the post() ring and maximum size of a payload copied by post().
+    static constexpr size_t POST_DEPTH = CONFIG_EVENT_QUEUE_POST_DEPTH;
+    static constexpr size_t POST_PAYLOAD_SIZE = 48;
+
+    EventQueue();
+
+    EventQueue(const EventQueue &) = delete;
+
+    /// Add an event to be dispatched ASAP. Returns the event id, or 0 if the event was dropped.
+    int call(callback_t fn, void *arg);
+
+    /// Schedule callback to be called after at least `millis` ms has passed. Returns the event id, or 0 if the event
+    /// was dropped.
+    int call_in(uint32_t millis, callback_t fn, void *arg);
+
+    /// Schedule callback to be called after at least `millis` ms and at most `millis + slack` ms have passed. The exact
+    /// time is chosen to coalesce wakeups. Returns the event id, or 0 if the event was dropped.
+    int call_in(uint32_t millis, uint32_t slack, callback_t fn, void *arg);
+
+    /// As call_in(millis, slack, fn, arg), but the callback gets a pointer to a copy of `size` bytes of `payload`,
+    /// which must not exceed PAYLOAD_SIZE. The copy is stored in the event and is valid until the callback returns.
+    int call_in(uint32_t millis, uint32_t slack, callback_t fn, const void *payload, size_t size);
+
+    /// Schedule callback to be called every `period` ms, starting `period` ms from now. Each deadline is a whole number
+    /// of periods after the first, regardless of dispatch latency. Returns the event id, or 0 if the event was dropped
+    /// or `period` is 0.
+    int call_every(uint32_t period, callback_t fn, void *arg);
+
+    /// Cancel a pending event. Returns false if the id is 0 or the event has already been dispatched or cancelled.
+    /// A recurring event may cancel itself from its callback.
+    bool cancel(int id);
+
+    /// Call `fn` ASAP on the dispatching thread with a pointer to a copy of `size` bytes of `payload`, which must not
+    /// exceed POST_PAYLOAD_SIZE. Safe to call from any thread or ISR. Returns false if the ring is full, in which case
+    /// the call is dropped.
+    bool post(callback_t fn, const void *payload, size_t size);
 
-    /// Add an event to be dispatched ASAP.
-    void call(callback_t fn, void *arg);
+    /// Number of events dropped because the pool was exhausted.
+    uint32_t dropped() const;
 
-    /// Schedule callback to be called after at least `millis` ms has passed.
-    void call_in(uint32_t millis, callback_t fn, void *arg);
+    /// Number of posts dropped because the ring was full.
+    uint32_t postDropped() const;
+
+    /// Counts of dispatcher wakeups that ran events.
+    struct WakeupStats {
+        /// Wakeups that ran timed events, none of them before the end of its slack.
+        uint32_t uncoalesced;
+
+        /// Wakeups that also ran timed events before the end of their slack, which would otherwise have needed
+        /// wakeups of their own.
+        uint32_t coalesced;
+
+        /// Timed events run before the end of their slack by the coalesced wakeups, i.e. wakeups saved.
+        uint32_t coalesced_events;
+
+        /// Posted callbacks, which run at the next wakeup whatever caused it and are not counted above.
+        uint32_t posts;
+    };
+
+    WakeupStats wakeupStats() const;
+
+#if CONFIG_SCHED_STATS
+    /// Lateness and duration of every callback run, including posts.
+    const SchedulerStats &schedulerStats() const;
+#endif
 
     /// Dispatch events continuously.
     void dispatch_forever();
@@ -43,28 +118,111 @@ private:
     struct Event {
         callback_t fn;
         void *arg;
-        uint32_t millis;
-        Event *next;
+        int64_t deadline;
+
+        // Deadline plus slack; the heap is ordered by this.
+        int64_t latest;
+
+        uint32_t sequence;
+
+        // Interval between calls of a recurring event, 0 for a one-shot event.
+        uint32_t period;
+
+        // Id returned to the caller, 0 while the event is in the pool.
+        int id;
+        uint32_t generation;
 
-        Event(callback_t fn_, void *arg_, uint32_t millis_);
+        // Position in _heap, or NOT_PENDING.
+        size_t heap_index;
 
-        uint32_t elapsed();
+        // Next event in the free list while the event is not pending.
+        Event *next_free;
 
-        bool ready();
+        // Inline storage for arguments copied by call_in().
+        alignas(8) uint8_t payload[PAYLOAD_SIZE];
+
+        bool ready(int64_t now) const;
+
+        /// Whether this event must run before `other`: earliest latest time first, then first scheduled first.
+        bool before(const Event &other) const;
 
         void call();
-    private:
-        int64_t _start_time;
     };
 
-    Event *_head;
-    Event *_tail;
+    static constexpr size_t NOT_PENDING = SIZE_MAX;
+
+    // Statically allocated events and the list of those which are not pending.
+    Event _pool[CAPACITY];
+    Event *_free;
+
+    // Event whose callback is running, if any.
+    Event *_current;
+
+    // Binary min-heap of pending events ordered by Event::before(). _heap[0] must run first.
+    Event *_heap[CAPACITY];
+    size_t _size;
+
+    // Ring written by post() and drained by the dispatcher. Each cell's sequence equals its position when free and its
+    // position plus one when written, so producers claim positions with a CAS on _post_tail without locking.
+    struct Post {
+        atomic_t sequence;
+        callback_t fn;
+#if CONFIG_SCHED_STATS
+        uint32_t posted_cycles;
+#endif
+        alignas(8) uint8_t payload[POST_PAYLOAD_SIZE];
+    };
+
+    Post _posts[POST_DEPTH];
+    atomic_t _post_tail;
+    atomic_t _post_dropped;
+
+    // Next position to drain; only accessed by the dispatcher.
+    atomic_val_t _post_head;
+
+    // Incremented for each event so that events with equal deadlines keep their scheduling order.
+    uint32_t _sequence;
+
+    uint32_t _dropped;
+    WakeupStats _wakeup_stats;
+
+#if CONFIG_SCHED_STATS
+    SchedulerStats _sched_stats;
+
+    // Record a callback that was due lateness_us before it started at start_cycles and has just returned.
+    void recordCall(int64_t lateness_us, uint32_t start_cycles);
+#endif
+
+    // Given when an event is added so that dispatch_forever() can re-evaluate its timeout.
+    k_sem _wakeup;
+
+    // Take an event from the pool, or return nullptr (or halt, depending on the overflow policy) if it is exhausted.
+    Event *allocate();
+
+    // Return an event to the pool.
+    void release(Event *event);
+
+    // Initialise an allocated event, insert it into the heap and return its id.
+    int append(Event *event, callback_t fn, void *arg, uint32_t millis, uint32_t slack, uint32_t period);
+
+    // Insert an initialised event into the heap.
+    void insert(Event *event);
+
+    // Remove and return the event at the given heap index without releasing it.
+    Event *removeAt(size_t index);
+
+    // Store the event at the given heap index.
+    void place(size_t index, Event *event);
+
+    // Restore the heap order after the element at index has been inserted or replaced.
+    void siftUp(size_t index);
+    void siftDown(size_t index);
 
-    // Append a new Event.
-    void append(callback_t fn, void *arg, uint32_t millis);
+    // Call all posted callbacks and return how many were called.
+    uint32_t drainPosts();
 
-    // Remove and deallocate the node after prev. If `prev == node` then the head node is removed.
-    void removeNode(Event *prev, Event *node);
+    // Call all posted callbacks and ready events and return the timeout until the earliest pending deadline.
+    k_timeout_t dispatchReady();
 };
 
 #endif // ! EVENTQUEUE_H
@@ -22,6 +22,8 @@
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/conn.h>
+#include <bluetooth/gatt.h>
+#include <device.h>
 
 #include <BluetoothPlatform.h>
 #include <EventQueue.h>
@@ -42,13 +44,29 @@ struct ZephyrBluetoothPlatform : BluetoothPlatform {
 
     void call(BluetoothPlatform::callback_t fn, void *arg) override;
 
-    void callIn(uint32_t millis, BluetoothPlatform::callback_t fn, void *arg) override;
+    timer_id_t callIn(uint32_t millis, BluetoothPlatform::callback_t fn, void *arg) override;
 
-    void printError(intmax_t error, const char *msg) override;
+    timer_id_t callIn(uint32_t millis, uint32_t toleranceMs, BluetoothPlatform::callback_t fn, void *arg) override;
+
+    timer_id_t callIn(
+        uint32_t millis,
+        uint32_t toleranceMs,
+        BluetoothPlatform::callback_t fn,
+        const void *payload,
+        size_t size
+    ) override;
+
+    timer_id_t callEvery(uint32_t periodMs, BluetoothPlatform::callback_t fn, void *arg) override;
+
+    bool cancel(timer_id_t id) override;
 
-    void printf(const char *fmt, ...) override;
+    WakeupStats getWakeupStats() override;
 
-    int getchar() override;
+    bool getSchedulerStats(SchedulerStats &stats) override;
+
+    uint32_t uptimeMs() override;
+
+    void printError(intmax_t error, const char *msg) override;
 
     void putchar(int c) override;
 
@@ -60,6 +78,8 @@ struct ZephyrBluetoothPlatform : BluetoothPlatform {
 
     int startPeriodicAdvertising() override;
 
+    int setScanFilter(const uint8_t *peerAddress) override;
+
     int startScan() override;
 
     int startScanForPeriodicAdvertising() override;
@@ -73,10 +93,25 @@ struct ZephyrBluetoothPlatform : BluetoothPlatform {
         uint32_t syncTimeoutMs
     ) override;
 
+    int setPhy(handle_t connection_handle, phy_t phy) override;
+
+    int startThroughput(handle_t connection_handle) override;
+
+    int prepareWorkload(handle_t connection_handle, traffic_t traffic) override;
+
+    int sendWorkload(handle_t connection_handle, size_t size) override;
+
+    bool getTrafficStats(TrafficStats &stats) override;
+
     int disconnect(handle_t connection_handle) override;
 
     int stopSync(handle_t sync_handle) override;
 
+protected:
+    void vprint(const char *fmt, va_list args) override;
+
+    void write(const uint8_t *data, size_t size) override;
+
 private:
     // Zephyr stuff.
     bt_le_ext_adv *_adv_set;
@@ -85,6 +120,8 @@ private:
     bt_conn_cb conn_callbacks = {
         .connected = &connectedCallback,
         .disconnected = &disconnectedCallback,
+        .le_param_updated = &paramUpdatedCallback,
+        .le_phy_updated = &phyUpdatedCallback,
     };
     bt_le_scan_cb scan_callbacks = {
         .recv = &scanCallback
@@ -97,33 +134,156 @@ private:
     // Event queue.
     EventQueue _event_queue;
 
+    // Console UART, read in its RX interrupt.
+    const device *_uart;
+
+    // Ends advertising or scanning after the configured time, 0 if not scheduled.
+    timer_id_t _end_timer;
+
     // Flags.
     bool _is_scanner;
     bool _is_periodic;
+    bool _is_scan_filtered;
     bool _is_scanning_or_advertising;
-    bool _is_connecting_or_syncing;
-    k_mutex _scan_sync_mutex;
+
+    // Connection or sync which is being established or is up, LINK_NONE if none (see ZephyrBluetoothPlatform.cpp).
+    // Read by scanCallback on the Bluetooth RX thread without taking a lock. An attempt is only started by a
+    // compare-and-swap from LINK_NONE, so a single connection or sync is attempted per scan.
+    atomic_t _link_state;
+
+    // Advertising reports posted to the event queue but not yet handled.
+    atomic_t _pending_reports;
+
+    // GATT throughput run or workload. The sender queues PDUs on the main thread while fewer than
+    // CONFIG_THROUGHPUT_WINDOW (one for indications) are in flight, so that it never blocks waiting for a buffer, and
+    // each completion posts a call to queue more. _backlog is the number of bytes left to queue, unbounded for a
+    // throughput run. The counts are updated on Bluetooth threads by the completions on the sender and by the GATT
+    // callbacks on the receiver, and are reset when a connection is established.
+    bt_gatt_exchange_params _mtu_params;
+    bt_gatt_discover_params _discover_params;
+    bt_gatt_subscribe_params _subscribe_params;
+    bt_gatt_indicate_params _indicate_params;
+    const bt_gatt_attr *_workload_attr;
+    uint16_t _peer_value_handle;
+    bool _is_workload;
+    traffic_t _traffic;
+    uint64_t _backlog;
+    bool _is_streaming;
+    bool _has_traffic;
+    uint32_t _traffic_start_ms;
+    atomic_t _in_flight;
+    atomic_t _pump_pending;
+    atomic_t _traffic_bytes;
+    atomic_t _traffic_packets;
+    atomic_t _traffic_last_ms;
 
     ZephyrBluetoothPlatform() = default;
 
     int startPeriodicAdvertising_Error(int error, const char* func);
     void cleanUpExtendedAdvertising();
 
+    // Advertising interval in ms converted to 0.625 ms units and clamped to the limits of the spec.
+    static uint32_t advInterval(uint32_t ms);
+
+    // Connection parameters from params().
+    bt_le_conn_param connParams();
+
+    // Convert parameters in HCI units.
+    static ConnectionParameters connectionParameters(uint16_t interval, uint16_t latency, uint16_t timeout);
+
+    // Convert a BT_GAP_LE_PHY_* value.
+    static phy_t toPhy(uint8_t zephyr_phy);
+
     void endAdvertising();
     void endScan();
 
+    // Whether _link_state is other than LINK_NONE. Safe to call from any thread.
+    bool isConnectingOrSyncing() const;
+
+    // Move _link_state from LINK_NONE to link. Returns false if a connection or sync has already been started.
+    bool beginLink(atomic_val_t link);
+
+    // Raise the data length and exchange the ATT MTU before a throughput run or workload.
+    int exchangeMtu();
+
+    // Queue PDUs until the window is full or the backlog is empty.
+    void pumpTraffic();
+
+    // Queue a PDU of the throughput run or workload.
+    int sendPdu(uint16_t length);
+
+    // Raise EventHandler::onThroughputStart().
+    void startedThroughput(intmax_t error, connection_role_t role, uint32_t start_ms);
+
+    // Raise EventHandler::onWorkloadReady().
+    void workloadReady(intmax_t error, connection_role_t role);
+
+    // Raise the event of a throughput run or workload which main failed to set up.
+    void gattSetupFailed(intmax_t error);
+
     static ZephyrBluetoothPlatform _instance;
 
     // Internal callbacks.
     static void endAdvertisingCallback(void *ignored);
     static void endScanCallback(void *ignored);
 
-    // Zephyr callbacks.
+    // Post to the event queue, halting if the event is lost.
+    void postOrPanic(EventQueue::callback_t fn, const void *payload, size_t size);
+
+    // Zephyr callbacks. These run on the Bluetooth RX thread and post to the event queue.
     static void scanCallback(const bt_le_scan_recv_info *info, net_buf_simple *buf);
     static void connectedCallback(bt_conn *conn, uint8_t err);
     static void disconnectedCallback(bt_conn *conn, uint8_t reason);
+    static void paramUpdatedCallback(bt_conn *conn, uint16_t interval, uint16_t latency, uint16_t timeout);
+    static void phyUpdatedCallback(bt_conn *conn, bt_conn_le_phy_info *info);
     static void syncedCallback(bt_le_per_adv_sync *sync, bt_le_per_adv_sync_synced_info *info);
     static void syncLostCallback(bt_le_per_adv_sync *sync, const bt_le_per_adv_sync_term_info *info);
+    static void mtuExchangedCallback(bt_conn *conn, uint8_t err, bt_gatt_exchange_params *params);
+    static uint8_t discoverCallback(bt_conn *conn, const bt_gatt_attr *attr, bt_gatt_discover_params *params);
+    static void pduSentCallback(bt_conn *conn, void *user_data);
+    static void indicatedCallback(bt_conn *conn, bt_gatt_indicate_params *params, uint8_t err);
+    static uint8_t notifyCallback(bt_conn *conn, bt_gatt_subscribe_params *params, const void *data, uint16_t length);
+    static void cccChangedCallback(const bt_gatt_attr *attr, uint16_t value);
+    static ssize_t throughputWriteCallback(
+        bt_conn *conn,
+        const bt_gatt_attr *attr,
+        const void *buf,
+        uint16_t len,
+        uint16_t offset,
+        uint8_t flags
+    );
+
+public:
+    // Payloads posted by the Zephyr and UART callbacks (see ZephyrBluetoothPlatform.cpp).
+    struct ScanReport;
+    struct ConnectionChange;
+    struct ParamUpdate;
+    struct PhyUpdate;
+    struct SyncChange;
+    struct GattResult;
+    struct ThroughputStart;
+    struct Subscription;
+
+    struct Input;
+
+private:
+    // Read console input in the UART interrupt and post it to the event queue.
+    static void uartCallback(const device *dev, void *user_data);
+
+    // Handlers for the posts, run on the main thread. arg points to one of the payloads above.
+    static void handleScanReport(void *arg);
+    static void handleConnected(void *arg);
+    static void handleDisconnected(void *arg);
+    static void handleParamUpdated(void *arg);
+    static void handlePhyUpdated(void *arg);
+    static void handleSynced(void *arg);
+    static void handleSyncLost(void *arg);
+    static void handleMtuExchanged(void *arg);
+    static void handleDiscovered(void *arg);
+    static void handlePduSent(void *arg);
+    static void handleThroughputStart(void *arg);
+    static void handleSubscribed(void *arg);
+    static void handleInput(void *arg);
 };
 
 #endif // ! ZEPHYRBLUETOOTHPLATFORM_H
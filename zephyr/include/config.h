@@ -5,7 +5,18 @@
 #define CONFIG_ADVERTISE_TIME    (CONFIG_APP_ADVERTISE_TIME)
 #define CONFIG_CONNECT_TIME      (CONFIG_APP_CONNECT_TIME)
 #define CONFIG_PERIODIC_INTERVAL (CONFIG_APP_PERIODIC_INTERVAL)
+#define CONFIG_TIMER_SLACK       (CONFIG_APP_TIMER_SLACK)
 #define CONFIG_LIST_SCAN_DEVS    (CONFIG_APP_LIST_SCAN_DEVS)
+#define CONFIG_EVENT_QUEUE_SIZE  (CONFIG_APP_EVENT_QUEUE_SIZE)
+#define CONFIG_EVENT_QUEUE_POST_DEPTH (CONFIG_APP_EVENT_QUEUE_POST_DEPTH)
+#define CONFIG_EVENT_QUEUE_DROP_ON_OVERFLOW (CONFIG_APP_EVENT_QUEUE_DROP_ON_OVERFLOW)
+#define CONFIG_SCHED_STATS       (CONFIG_APP_SCHED_STATS)
+#define CONFIG_LOG_BUFFER_SIZE   (CONFIG_APP_LOG_BUFFER_SIZE)
+#define CONFIG_BINARY_LOG        (CONFIG_APP_BINARY_LOG)
+#define CONFIG_THROUGHPUT_WINDOW (CONFIG_APP_THROUGHPUT_WINDOW)
+
+// Scan actively by default, sending scan requests, as the Zephyr backend always has.
+#define CONFIG_ACTIVE_SCAN       1
 
 #if defined(CONFIG_BT_EXT_ADV) && defined(CONFIG_BT_PER_ADV)
 # define CONFIG_USE_PER_ADV_SYNC  ((CONFIG_BT_EXT_ADV) && (CONFIG_BT_PER_ADV))
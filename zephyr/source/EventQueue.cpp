@@ -16,30 +16,26 @@
 
 #include <assert.h>
 #include <inttypes.h>
+#include <string.h>
 #include <time.h>
 
 #include <zephyr.h>
 
 #include <EventQueue.h>
 
-EventQueue::Event::Event(callback_t fn_, void *arg_, uint32_t millis_)
-: fn(fn_)
-, arg(arg_)
-, millis(millis_)
-, _start_time(k_uptime_get())
-{}
-
-uint32_t EventQueue::Event::elapsed()
+bool EventQueue::Event::ready(int64_t now) const
 {
-    // For some reason, k_uptime_delta updates its argument, so when you call it in a loop, all deltas are zero.
-    // This works around it to get the expected behaviour.
-    auto tmp = _start_time;
-    return static_cast<uint32_t>(k_uptime_delta(&tmp));
+    return now >= deadline;
 }
 
-bool EventQueue::Event::ready()
+bool EventQueue::Event::before(const Event &other) const
 {
-    return elapsed() >= millis;
+    if (latest != other.latest) {
+        return latest < other.latest;
+    }
+
+    // Compare as a signed difference so that the order survives the sequence counter wrapping around.
+    return static_cast<int32_t>(sequence - other.sequence) < 0;
 }
 
 void EventQueue::Event::call()
@@ -47,70 +43,383 @@ void EventQueue::Event::call()
     fn(arg);
 }
 
-EventQueue::~EventQueue()
+EventQueue::EventQueue()
+: _free(nullptr)
+, _current(nullptr)
+, _size(0)
+, _sequence(0)
+, _dropped(0)
+, _wakeup_stats{0, 0, 0, 0}
 {
-    if (_head == nullptr) {
-        assert(_tail == nullptr);
-        return;
+#if CONFIG_SCHED_STATS
+    memset(&_sched_stats, 0, sizeof(_sched_stats));
+#endif
+
+    for (auto &event : _pool) {
+        event.generation = 0;
+        release(&event);
     }
 
-    assert(_tail != nullptr);
-    while (_head->next) {
-        auto prev = _head;
-        _head = _head->next;
-        delete prev;
+    for (size_t i = 0; i < POST_DEPTH; i++) {
+        atomic_set(&_posts[i].sequence, static_cast<atomic_val_t>(i));
     }
+
+    atomic_set(&_post_tail, 0);
+    atomic_set(&_post_dropped, 0);
+    _post_head = 0;
+
+    k_sem_init(&_wakeup, 0, 1);
 }
 
-void EventQueue::call(callback_t fn, void *arg)
+int EventQueue::call(callback_t fn, void *arg)
 {
-    append(fn, arg, 0);
+    return call_in(0, fn, arg);
 }
 
-void EventQueue::call_in(uint32_t millis, callback_t fn, void *arg)
+int EventQueue::call_in(uint32_t millis, callback_t fn, void *arg)
 {
-    append(fn, arg, millis);
+    auto event = allocate();
+    if (event == nullptr) {
+        return 0;
+    }
+
+    return append(event, fn, arg, millis, 0, 0);
 }
 
-void EventQueue::dispatch_forever()
+int EventQueue::call_in(uint32_t millis, uint32_t slack, callback_t fn, void *arg)
+{
+    auto event = allocate();
+    if (event == nullptr) {
+        return 0;
+    }
+
+    return append(event, fn, arg, millis, slack, 0);
+}
+
+int EventQueue::call_in(uint32_t millis, uint32_t slack, callback_t fn, const void *payload, size_t size)
+{
+    assert(size <= PAYLOAD_SIZE);
+    auto event = allocate();
+    if (event == nullptr) {
+        return 0;
+    }
+
+    memcpy(event->payload, payload, size);
+    return append(event, fn, event->payload, millis, slack, 0);
+}
+
+int EventQueue::call_every(uint32_t period, callback_t fn, void *arg)
+{
+    // A period of 0 would make the event due again as soon as it ran, and stop the dispatcher running anything else.
+    if (period == 0) {
+        return 0;
+    }
+
+    auto event = allocate();
+    if (event == nullptr) {
+        return 0;
+    }
+
+    return append(event, fn, arg, period, 0, period);
+}
+
+bool EventQueue::cancel(int id)
+{
+    if (id <= 0) {
+        return false;
+    }
+
+    // The pool slot is encoded in the id, see append().
+    auto event = &_pool[static_cast<size_t>(id - 1) % CAPACITY];
+    if (event->id != id) {
+        // Already dispatched or cancelled.
+        return false;
+    }
+
+    if (event == _current) {
+        // Cancelled from its own callback: a recurring event must not be rescheduled.
+        auto recurring = event->period > 0;
+        event->period = 0;
+        return recurring;
+    }
+
+    removeAt(event->heap_index);
+    release(event);
+    return true;
+}
+
+bool EventQueue::post(callback_t fn, const void *payload, size_t size)
 {
+    assert(size <= POST_PAYLOAD_SIZE);
+
+    // Claim a free cell.
+    Post *cell;
+    auto position = atomic_get(&_post_tail);
     while (true) {
-        auto prev = _head;
-        auto node = _head;
-        while (node) {
-            if (node->ready()) {
-                node->call();
-                removeNode(prev, node);
+        cell = &_posts[static_cast<size_t>(position) % POST_DEPTH];
+        auto difference = atomic_get(&cell->sequence) - position;
+        if (difference == 0) {
+            if (atomic_cas(&_post_tail, position, position + 1)) {
+                break;
             }
+        } else if (difference < 0) {
+            // The cell still holds a post from the previous lap, so the ring is full.
+            atomic_inc(&_post_dropped);
+            return false;
+        }
+
+        // Another producer claimed this position first.
+        position = atomic_get(&_post_tail);
+    }
+
+    // Fill the cell, then publish it to the dispatcher.
+    cell->fn = fn;
+#if CONFIG_SCHED_STATS
+    cell->posted_cycles = k_cycle_get_32();
+#endif
+    memcpy(cell->payload, payload, size);
+    atomic_set(&cell->sequence, position + 1);
+
+    k_sem_give(&_wakeup);
+    return true;
+}
+
+uint32_t EventQueue::dropped() const
+{
+    return _dropped;
+}
+
+uint32_t EventQueue::postDropped() const
+{
+    return static_cast<uint32_t>(atomic_get(&_post_dropped));
+}
+
+EventQueue::WakeupStats EventQueue::wakeupStats() const
+{
+    return _wakeup_stats;
+}
+
+#if CONFIG_SCHED_STATS
+const SchedulerStats &EventQueue::schedulerStats() const
+{
+    return _sched_stats;
+}
+
+void EventQueue::recordCall(int64_t lateness_us, uint32_t start_cycles)
+{
+    auto duration_us = k_cyc_to_us_floor32(k_cycle_get_32() - start_cycles);
+    _sched_stats.lateness.record(static_cast<uint32_t>(MIN(MAX(lateness_us, 0), static_cast<int64_t>(UINT32_MAX))));
+    _sched_stats.duration.record(duration_us);
+}
+#endif
+
+void EventQueue::dispatch_forever()
+{
+    while (true) {
+        // Sleep until the earliest deadline, or until a new event is added and the timeout must be recalculated.
+        k_sem_take(&_wakeup, dispatchReady());
+    }
+}
+
+k_timeout_t EventQueue::dispatchReady()
+{
+    // Events are ordered by the latest time they may run, and the queue sleeps until the first of those. Once awake,
+    // every event from the top of the heap whose deadline has passed runs now, so events with overlapping slack
+    // windows share the wakeup.
+    _wakeup_stats.posts += drainPosts();
+    auto now = k_uptime_get();
+    uint32_t dispatched = 0;
+    uint32_t early = 0;
+    while (_size > 0 && _heap[0]->ready(now)) {
+        dispatched++;
+
+        // Only events pulled forward by their slack share a wakeup they would not otherwise have had; those due at
+        // the same time, including call() batches, would have run together anyway.
+        early += _heap[0]->latest > now;
+
+        // Remove before calling so that the callback may schedule further events.
+        auto event = removeAt(0);
+        _current = event;
+#if CONFIG_SCHED_STATS
+        auto start = k_cycle_get_32();
+        auto lateness = static_cast<int64_t>(k_ticks_to_us_floor64(k_uptime_ticks())) - event->deadline * USEC_PER_MSEC;
+#endif
+        event->call();
+#if CONFIG_SCHED_STATS
+        recordCall(lateness, start);
+#endif
+        _current = nullptr;
+
+        if (event->period > 0) {
+            // Step from the previous deadline rather than from now so that lateness does not accumulate. Periods
+            // missed entirely are skipped to keep the phase.
+            auto missed = (now - event->deadline) / event->period;
+            event->deadline += (missed + 1) * event->period;
+            event->latest = event->deadline;
+            event->sequence = _sequence++;
+            insert(event);
+        } else {
+            release(event);
+        }
+    }
+
+    if (early > 0) {
+        _wakeup_stats.coalesced++;
+        _wakeup_stats.coalesced_events += early;
+    } else if (dispatched > 0) {
+        _wakeup_stats.uncoalesced++;
+    }
+
+    if (_size == 0) {
+        return K_FOREVER;
+    }
+
+    return K_MSEC(MAX(_heap[0]->latest - k_uptime_get(), 0));
+}
+
+uint32_t EventQueue::drainPosts()
+{
+    uint32_t count = 0;
+    while (true) {
+        auto cell = &_posts[static_cast<size_t>(_post_head) % POST_DEPTH];
+        if (atomic_get(&cell->sequence) != _post_head + 1) {
+            // Not yet published.
+            break;
+        }
+
+#if CONFIG_SCHED_STATS
+        auto start = k_cycle_get_32();
+        auto lateness = k_cyc_to_us_floor32(start - cell->posted_cycles);
+#endif
+        cell->fn(cell->payload);
+#if CONFIG_SCHED_STATS
+        recordCall(lateness, start);
+#endif
+
+        // Free the cell for the producers' next lap.
+        atomic_set(&cell->sequence, _post_head + static_cast<atomic_val_t>(POST_DEPTH));
+        _post_head++;
+        count++;
+    }
+
+    return count;
+}
+
+EventQueue::Event *EventQueue::allocate()
+{
+    auto event = _free;
+    if (event == nullptr) {
+        _dropped++;
+#if CONFIG_EVENT_QUEUE_DROP_ON_OVERFLOW
+        return nullptr;
+#else
+        // A fatal error halts with interrupts locked and reports through the fatal error handler, where a spin
+        // would keep the board running and look like a live state on the trace.
+        printk("Event queue full (%" PRIu32 " events)\n", static_cast<uint32_t>(CAPACITY));
+        k_panic();
+#endif
+    }
+
+    _free = event->next_free;
+    return event;
+}
+
+void EventQueue::release(Event *event)
+{
+    event->id = 0;
+    event->heap_index = NOT_PENDING;
+    event->next_free = _free;
+    _free = event;
+}
+
+int EventQueue::append(Event *event, callback_t fn, void *arg, uint32_t millis, uint32_t slack, uint32_t period)
+{
+    event->fn = fn;
+    event->arg = arg;
+    event->deadline = k_uptime_get() + millis;
+    event->latest = event->deadline + slack;
+    event->period = period;
+    event->sequence = _sequence++;
 
-            prev = node;
-            node = node->next;
+    // Ids combine the pool slot with a per-slot generation so that a stale id never matches a reused event.
+    static constexpr uint32_t MAX_GENERATION = INT32_MAX / CAPACITY - 1;
+    event->generation = event->generation >= MAX_GENERATION ? 0 : event->generation + 1;
+    event->id = static_cast<int>(event->generation * CAPACITY + static_cast<size_t>(event - _pool) + 1);
+
+    insert(event);
+    k_sem_give(&_wakeup);
+    return event->id;
+}
+
+void EventQueue::insert(Event *event)
+{
+    assert(_size < CAPACITY);
+    place(_size, event);
+    _size++;
+    siftUp(_size - 1);
+}
+
+EventQueue::Event *EventQueue::removeAt(size_t index)
+{
+    assert(index < _size);
+    auto event = _heap[index];
+    event->heap_index = NOT_PENDING;
+    _size--;
+    if (index < _size) {
+        // Move the last event into the hole; it may need to go either way.
+        place(index, _heap[_size]);
+        if (index > 0 && _heap[index]->before(*_heap[(index - 1) / 2])) {
+            siftUp(index);
+        } else {
+            siftDown(index);
         }
     }
+
+    return event;
+}
+
+void EventQueue::place(size_t index, Event *event)
+{
+    _heap[index] = event;
+    event->heap_index = index;
 }
 
-void EventQueue::append(callback_t fn, void *arg, uint32_t millis)
+void EventQueue::siftUp(size_t index)
 {
-    if (_head == nullptr) {
-        assert(_tail == nullptr);
-        _head = new Event(fn, arg, millis);
-        _tail = _head;
-    } else {
-        assert(_tail != nullptr);
-        _tail->next = new Event(fn, arg, millis);
-        _tail = _tail->next;
+    auto event = _heap[index];
+    while (index > 0) {
+        auto parent = (index - 1) / 2;
+        if (!event->before(*_heap[parent])) {
+            break;
+        }
+
+        place(index, _heap[parent]);
+        index = parent;
     }
+
+    place(index, event);
 }
 
-void EventQueue::removeNode(Event *prev, Event *node)
+void EventQueue::siftDown(size_t index)
 {
-    if (prev == node) {
-        assert(prev == _head);
-        _head = _head->next;
-    } else {
-        assert(prev->next == node);
-        prev->next = node->next;
+    auto event = _heap[index];
+    while (true) {
+        auto child = 2 * index + 1;
+        if (child >= _size) {
+            break;
+        }
+
+        if (child + 1 < _size && _heap[child + 1]->before(*_heap[child])) {
+            child++;
+        }
+
+        if (!_heap[child]->before(*event)) {
+            break;
+        }
+
+        place(index, _heap[child]);
+        index = child;
     }
 
-    delete node;
+    place(index, event);
 }
@@ -21,7 +21,7 @@
 #include <stdint.h>
 
 #include <bluetooth/bluetooth.h>
-#include <console/console.h>
+#include <drivers/uart.h>
 #include <zephyr.h>
 
 #include <BluetoothPlatform.h>
@@ -65,6 +65,43 @@
 
 ZephyrBluetoothPlatform ZephyrBluetoothPlatform::_instance;
 
+// Values of _link_state.
+static constexpr atomic_val_t LINK_NONE = 0;
+static constexpr atomic_val_t LINK_CONNECTION = 1;
+static constexpr atomic_val_t LINK_SYNC = 2;
+
+// Service with a characteristic which main writes to without response in a throughput run, and one which carries
+// workloads. It is registered at run time because Zephyr's service definition macros rely on C compound literals.
+static bt_uuid_16 primary_service_uuid = BT_UUID_INIT_16(BT_UUID_GATT_PRIMARY_VAL);
+static bt_uuid_16 characteristic_uuid = BT_UUID_INIT_16(BT_UUID_GATT_CHRC_VAL);
+static bt_uuid_16 ccc_uuid = BT_UUID_INIT_16(BT_UUID_GATT_CCC_VAL);
+static bt_uuid_128 throughput_service_uuid = BT_UUID_INIT_128(
+    BT_UUID_128_ENCODE(0x8b4c0001, 0x6f3e, 0x4f2a, 0x9d1b, 0x2a7c5e0f1d30)
+);
+static bt_uuid_128 throughput_characteristic_uuid = BT_UUID_INIT_128(
+    BT_UUID_128_ENCODE(0x8b4c0002, 0x6f3e, 0x4f2a, 0x9d1b, 0x2a7c5e0f1d30)
+);
+static bt_gatt_chrc throughput_characteristic = {
+    .uuid = &throughput_characteristic_uuid.uuid,
+    .value_handle = 0,
+    .properties = BT_GATT_CHRC_WRITE_WITHOUT_RESP
+};
+static bt_uuid_128 workload_characteristic_uuid = BT_UUID_INIT_128(
+    BT_UUID_128_ENCODE(0x8b4c0003, 0x6f3e, 0x4f2a, 0x9d1b, 0x2a7c5e0f1d30)
+);
+static bt_gatt_chrc workload_characteristic = {
+    .uuid = &workload_characteristic_uuid.uuid,
+    .value_handle = 0,
+    .properties = BT_GATT_CHRC_WRITE_WITHOUT_RESP | BT_GATT_CHRC_NOTIFY | BT_GATT_CHRC_INDICATE
+};
+static _bt_gatt_ccc workload_ccc;
+
+// Index of the workload characteristic's value in the service, which its client configuration descriptor follows.
+static constexpr size_t WORKLOAD_VALUE_INDEX = 4;
+
+// Payload of the writes: the largest LL packet less the L2CAP and ATT headers. Its content does not matter.
+static const uint8_t throughput_data[BT_GAP_DATA_LEN_MAX - 4 - 3] = {};
+
 ZephyrBluetoothPlatform &ZephyrBluetoothPlatform::instance()
 {
     return _instance;
@@ -73,9 +110,72 @@ ZephyrBluetoothPlatform &ZephyrBluetoothPlatform::instance()
 int ZephyrBluetoothPlatform::init()
 {
     // Initialise subsystems.
-    CALLFN(console_init);
+    _uart = device_get_binding(CONFIG_UART_CONSOLE_ON_DEV_NAME);
+    if (_uart == nullptr) {
+        printError(-ENODEV, "device_get_binding");
+        return -ENODEV;
+    }
+
+    uart_irq_callback_user_data_set(_uart, &uartCallback, nullptr);
+    uart_irq_rx_enable(_uart);
     CALL(bt_enable, nullptr);
-    k_mutex_init(&_scan_sync_mutex);
+
+    static bt_gatt_attr throughput_attrs[] = {
+        {
+            .uuid = &primary_service_uuid.uuid,
+            .read = &bt_gatt_attr_read_service,
+            .write = nullptr,
+            .user_data = &throughput_service_uuid,
+            .handle = 0,
+            .perm = BT_GATT_PERM_READ
+        },
+        {
+            .uuid = &characteristic_uuid.uuid,
+            .read = &bt_gatt_attr_read_chrc,
+            .write = nullptr,
+            .user_data = &throughput_characteristic,
+            .handle = 0,
+            .perm = BT_GATT_PERM_READ
+        },
+        {
+            .uuid = &throughput_characteristic_uuid.uuid,
+            .read = nullptr,
+            .write = &throughputWriteCallback,
+            .user_data = nullptr,
+            .handle = 0,
+            .perm = BT_GATT_PERM_WRITE
+        },
+        {
+            .uuid = &characteristic_uuid.uuid,
+            .read = &bt_gatt_attr_read_chrc,
+            .write = nullptr,
+            .user_data = &workload_characteristic,
+            .handle = 0,
+            .perm = BT_GATT_PERM_READ
+        },
+        {
+            .uuid = &workload_characteristic_uuid.uuid,
+            .read = nullptr,
+            .write = &throughputWriteCallback,
+            .user_data = nullptr,
+            .handle = 0,
+            .perm = BT_GATT_PERM_WRITE
+        },
+        {
+            .uuid = &ccc_uuid.uuid,
+            .read = &bt_gatt_attr_read_ccc,
+            .write = &bt_gatt_attr_write_ccc,
+            .user_data = &workload_ccc,
+            .handle = 0,
+            .perm = BT_GATT_PERM_READ | BT_GATT_PERM_WRITE
+        },
+    };
+    static bt_gatt_service throughput_service = BT_GATT_SERVICE(throughput_attrs);
+    workload_ccc.cfg_changed = &cccChangedCallback;
+    _workload_attr = &throughput_attrs[WORKLOAD_VALUE_INDEX];
+    CALL(bt_gatt_service_register, &throughput_service);
+    atomic_set(&_link_state, LINK_NONE);
+    atomic_set(&_pending_reports, 0);
 
     // Register callbacks.
     bt_conn_cb_register(&conn_callbacks);
@@ -112,9 +212,70 @@ void ZephyrBluetoothPlatform::call(BluetoothPlatform::callback_t fn, void *arg)
     _event_queue.call(fn, arg);
 }
 
-void ZephyrBluetoothPlatform::callIn(uint32_t millis, BluetoothPlatform::callback_t fn, void *arg)
+BluetoothPlatform::timer_id_t ZephyrBluetoothPlatform::callIn(
+    uint32_t millis,
+    BluetoothPlatform::callback_t fn,
+    void *arg
+)
+{
+    return _event_queue.call_in(millis, fn, arg);
+}
+
+BluetoothPlatform::timer_id_t ZephyrBluetoothPlatform::callIn(
+    uint32_t millis,
+    uint32_t toleranceMs,
+    BluetoothPlatform::callback_t fn,
+    void *arg
+)
+{
+    return _event_queue.call_in(millis, toleranceMs, fn, arg);
+}
+
+BluetoothPlatform::timer_id_t ZephyrBluetoothPlatform::callIn(
+    uint32_t millis,
+    uint32_t toleranceMs,
+    BluetoothPlatform::callback_t fn,
+    const void *payload,
+    size_t size
+)
+{
+    static_assert(MAX_PAYLOAD_SIZE <= EventQueue::PAYLOAD_SIZE, "EventQueue payload too small");
+    return _event_queue.call_in(millis, toleranceMs, fn, payload, size);
+}
+
+BluetoothPlatform::timer_id_t ZephyrBluetoothPlatform::callEvery(
+    uint32_t periodMs,
+    BluetoothPlatform::callback_t fn,
+    void *arg
+)
+{
+    return _event_queue.call_every(periodMs, fn, arg);
+}
+
+bool ZephyrBluetoothPlatform::cancel(BluetoothPlatform::timer_id_t id)
+{
+    return _event_queue.cancel(id);
+}
+
+BluetoothPlatform::WakeupStats ZephyrBluetoothPlatform::getWakeupStats()
+{
+    auto stats = _event_queue.wakeupStats();
+    return WakeupStats{stats.uncoalesced, stats.coalesced, stats.coalesced_events, stats.posts};
+}
+
+uint32_t ZephyrBluetoothPlatform::uptimeMs()
+{
+    return k_uptime_get_32();
+}
+
+bool ZephyrBluetoothPlatform::getSchedulerStats(SchedulerStats &stats)
 {
-    _event_queue.call_in(millis, fn, arg);
+#if CONFIG_SCHED_STATS
+    stats = _event_queue.schedulerStats();
+    return true;
+#else
+    return false;
+#endif
 }
 
 void ZephyrBluetoothPlatform::printError(intmax_t error, const char *msg)
@@ -132,22 +293,26 @@ void ZephyrBluetoothPlatform::printError(intmax_t error, const char *msg)
     }
 }
 
-void ZephyrBluetoothPlatform::printf(const char *fmt, ...)
+void ZephyrBluetoothPlatform::vprint(const char *fmt, va_list args)
 {
-    va_list args;
-    va_start(args, fmt);
     vprintk(fmt, args);
-    va_end(args);
 }
 
-int ZephyrBluetoothPlatform::getchar()
+void ZephyrBluetoothPlatform::write(const uint8_t *data, size_t size)
 {
-    return console_getchar();
+    // Bypass printk(), whose console driver would insert '\r' before every 0x0a byte.
+    if (_uart == nullptr) {
+        return;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        uart_poll_out(_uart, data[i]);
+    }
 }
 
 void ZephyrBluetoothPlatform::putchar(int c)
 {
-    console_putchar(static_cast<char>(c));
+    printk("%c", c);
 }
 
 const char *ZephyrBluetoothPlatform::deviceName() const
@@ -165,30 +330,62 @@ static const bt_data adv_data[] = {
     BT_DATA(BT_DATA_MANUFACTURER_DATA, adv_data_data, ARRAY_SIZE(adv_data_data))
 };
 
+uint32_t ZephyrBluetoothPlatform::advInterval(uint32_t ms)
+{
+    return MIN(MAX(ms * 8 / 5, 0x0020), 0x4000);
+}
+
+bt_le_conn_param ZephyrBluetoothPlatform::connParams()
+{
+    // Intervals in 1.25 ms units and supervision timeout in 10 ms units.
+    auto min_interval = params().conn_interval;
+    auto max_interval = min_interval + params().conn_interval_span;
+    return BT_LE_CONN_PARAM_INIT(
+        static_cast<uint16_t>(MIN(MAX(min_interval * 4 / 5, 0x0006), 0x0c80)),
+        static_cast<uint16_t>(MIN(MAX(max_interval * 4 / 5, 0x0006), 0x0c80)),
+        static_cast<uint16_t>(params().conn_latency),
+        static_cast<uint16_t>(params().supervision_timeout / 10)
+    );
+}
+
+BluetoothPlatform::ConnectionParameters ZephyrBluetoothPlatform::connectionParameters(
+    uint16_t interval,
+    uint16_t latency,
+    uint16_t timeout
+)
+{
+    return ConnectionParameters { interval * 1250U, latency, timeout * 10U };
+}
+
 int ZephyrBluetoothPlatform::startAdvertising()
 {
-    assert(!_is_connecting_or_syncing);
+    assert(!isConnectingOrSyncing());
     assert(!_is_scanning_or_advertising);
     _is_scanner = false;
     _is_periodic = false;
 
-    static const bt_le_adv_param adv_params[] = {
+    const bt_le_adv_param adv_params[] = {
         BT_LE_ADV_PARAM_INIT(
             BT_LE_ADV_OPT_CONNECTABLE | BT_LE_ADV_OPT_USE_NAME,
-            BT_GAP_ADV_FAST_INT_MIN_2,
-            BT_GAP_ADV_FAST_INT_MAX_2,
+            advInterval(params().adv_interval),
+            advInterval(params().adv_interval + params().adv_interval_span),
             nullptr
         )
     };
     CALL(bt_le_adv_start, adv_params, adv_data, ARRAY_SIZE(adv_data), nullptr, 0);
 
     _is_scanning_or_advertising = true;
-    _is_connecting_or_syncing = false;
-    _event_queue.call_in(CONFIG_ADVERTISE_TIME, &ZephyrBluetoothPlatform::endAdvertisingCallback, this);
+    atomic_set(&_link_state, LINK_NONE);
+    _end_timer = _event_queue.call_in(
+        params().advertise_time,
+        CONFIG_TIMER_SLACK,
+        &ZephyrBluetoothPlatform::endAdvertisingCallback,
+        this
+    );
 
     getEventHandler()->onAdvertisingStart(
         AdvertisingStartEvent(
-            CONFIG_ADVERTISE_TIME,
+            params().advertise_time,
             false,
             0
         )
@@ -196,52 +393,115 @@ int ZephyrBluetoothPlatform::startAdvertising()
     return 0;
 }
 
+int ZephyrBluetoothPlatform::setScanFilter(const uint8_t *peerAddress)
+{
+    assert(!_is_scanning_or_advertising);
+    _is_scan_filtered = false;
+#if !defined(CONFIG_BT_WHITELIST)
+    if (peerAddress != nullptr) {
+        printError(-ENOTSUP, "Scan filter needs CONFIG_BT_WHITELIST");
+        return -ENOTSUP;
+    }
+
+    return 0;
+#else
+    CALLFN(bt_le_whitelist_clear);
+    if (peerAddress == nullptr) {
+        return 0;
+    }
+
+    // The address type is not known until the peer is seen, so accept both.
+    static const uint8_t types[] = { BT_ADDR_LE_PUBLIC, BT_ADDR_LE_RANDOM };
+    bt_addr_le_t address;
+    memcpy(address.a.val, peerAddress, sizeof(address.a.val));
+    for (auto type : types) {
+        address.type = type;
+        auto error = bt_le_whitelist_add(&address);
+        if (error) {
+            // Don't leave half a filter behind: an unfiltered scan must not miss the peer's other address type.
+            printError(error, "bt_le_whitelist_add");
+            CALLFN_NORET(bt_le_whitelist_clear);
+            return error;
+        }
+    }
+
+    _is_scan_filtered = true;
+    return 0;
+#endif
+}
+
 int ZephyrBluetoothPlatform::startScan()
 {
-    assert(!_is_connecting_or_syncing);
+    assert(!isConnectingOrSyncing());
     assert(!_is_scanning_or_advertising);
     _is_scanner = true;
     _is_periodic = false;
 
-    static const bt_le_scan_param scan_params = {
-        .type     = BT_LE_SCAN_TYPE_ACTIVE,
-        .options  = BT_LE_SCAN_OPT_NONE,
-        .interval = 0x10, // ] Default values
-        .window   = 0x10, // ]
+    // In 0.625 ms units.
+    auto interval = params().scan_interval * 8 / 5;
+    auto window = MIN(params().scan_window, params().scan_interval) * 8 / 5;
+    // Only the target's reports reach the host if it is in the filter accept list (see setScanFilter()).
+    uint32_t options = _is_scan_filtered ? BT_LE_SCAN_OPT_FILTER_WHITELIST : BT_LE_SCAN_OPT_NONE;
+    const bt_le_scan_param scan_params = {
+        .type     = static_cast<uint8_t>(params().active_scan ? BT_LE_SCAN_TYPE_ACTIVE : BT_LE_SCAN_TYPE_PASSIVE),
+        .options  = options,
+        .interval = static_cast<uint16_t>(MIN(MAX(interval, 0x0004), 0x4000)),
+        .window   = static_cast<uint16_t>(MIN(MAX(window, 0x0004), 0x4000)),
     };
 
-    CALL(bt_le_scan_start, &scan_params, nullptr);
+    auto error = bt_le_scan_start(&scan_params, nullptr);
+    if (error) {
+        printError(error, _is_scan_filtered ? "bt_le_scan_start with the scan filter" : "bt_le_scan_start");
+        return error;
+    }
 
     _is_scanning_or_advertising = true;
-    _is_connecting_or_syncing = false;
-    _event_queue.call_in(CONFIG_SCAN_TIME, &ZephyrBluetoothPlatform::endScanCallback, this);
+    atomic_set(&_link_state, LINK_NONE);
+    _end_timer = _event_queue.call_in(
+        params().scan_time,
+        CONFIG_TIMER_SLACK,
+        &ZephyrBluetoothPlatform::endScanCallback,
+        this
+    );
 
-    getEventHandler()->onScanStart(ScanStartEvent(CONFIG_SCAN_TIME));
+    getEventHandler()->onScanStart(ScanStartEvent(params().scan_time));
 
     return 0;
 }
 
+bool ZephyrBluetoothPlatform::isConnectingOrSyncing() const
+{
+    return atomic_get(&_link_state) != LINK_NONE;
+}
+
+bool ZephyrBluetoothPlatform::beginLink(atomic_val_t link)
+{
+    return atomic_cas(&_link_state, LINK_NONE, link);
+}
+
 int ZephyrBluetoothPlatform::establishConnection(uint8_t peerAddressType, const uint8_t *peerAddress)
 {
     assert(_is_scanner);
     assert(_conn == nullptr);
 
-    _is_connecting_or_syncing = true;
+    if (!beginLink(LINK_CONNECTION)) {
+        return -EALREADY;
+    }
+
     endScan();
 
     // Create the connection. The connectedCallback will be called when the connection is actually established.
     static const struct bt_conn_le_create_param create_params[] {
         BT_CONN_LE_CREATE_PARAM_INIT(BT_CONN_LE_OPT_NONE, BT_GAP_SCAN_FAST_INTERVAL, BT_GAP_SCAN_FAST_WINDOW)
     };
-    static const struct bt_le_conn_param conn_params[] {
-        BT_LE_CONN_PARAM_INIT(BT_GAP_INIT_CONN_INT_MIN, BT_GAP_INIT_CONN_INT_MAX, 0, 400)
-    };
+    const bt_le_conn_param conn_params[] { connParams() };
     bt_addr_le_t addr {.type = peerAddressType};
     memcpy(addr.a.val, peerAddress, sizeof(addr.a.val));
 
     auto error = bt_conn_le_create(&addr, create_params, conn_params, &_conn);
     if (error) {
         printError(error, "bt_conn_le_create");
+        atomic_set(&_link_state, LINK_NONE);
         // NB: If bt_conn_le_create is successful we will call 'EventHandler::onConnection()' in 'connected()'. This is
         // to keep the program running if we don't get that far, as 'connectedCallback()' won't be called.
         getEventHandler()->onConnection(ConnectEvent(error));
@@ -255,9 +515,9 @@ int ZephyrBluetoothPlatform::disconnect(handle_t connection_handle)
 {
     assert(_conn != nullptr);
     assert(connection_handle == _conn);
-    assert(_is_connecting_or_syncing);
+    assert(isConnectingOrSyncing());
 
-    _is_connecting_or_syncing = false;
+    atomic_set(&_link_state, LINK_NONE);
 
     CALL(bt_conn_disconnect, _conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
 
@@ -266,6 +526,188 @@ int ZephyrBluetoothPlatform::disconnect(handle_t connection_handle)
     return 0;
 }
 
+int ZephyrBluetoothPlatform::setPhy(handle_t connection_handle, phy_t phy)
+{
+    assert(_conn != nullptr);
+    assert(connection_handle == _conn);
+
+    uint8_t zephyr_phy = BT_GAP_LE_PHY_1M;
+    if (phy == phy_t::le_2m) {
+        zephyr_phy = BT_GAP_LE_PHY_2M;
+    } else if (phy == phy_t::le_coded) {
+        zephyr_phy = BT_GAP_LE_PHY_CODED;
+    }
+
+    const bt_conn_le_phy_param phy_params[] {
+        { .options = BT_CONN_LE_PHY_OPT_NONE, .pref_tx_phy = zephyr_phy, .pref_rx_phy = zephyr_phy }
+    };
+    CALL(bt_conn_le_phy_update, _conn, phy_params);
+    return 0;
+}
+
+int ZephyrBluetoothPlatform::startThroughput(handle_t connection_handle)
+{
+    assert(_conn != nullptr);
+    assert(connection_handle == _conn);
+    _is_workload = false;
+    return exchangeMtu();
+}
+
+int ZephyrBluetoothPlatform::prepareWorkload(handle_t connection_handle, traffic_t traffic)
+{
+    assert(_conn != nullptr);
+    assert(connection_handle == _conn);
+    _is_workload = true;
+    _traffic = traffic;
+    return exchangeMtu();
+}
+
+int ZephyrBluetoothPlatform::sendWorkload(handle_t connection_handle, size_t size)
+{
+    // The connection may have been closed by disconnect() since the burst was scheduled.
+    if (_conn == nullptr || connection_handle != _conn || !_is_workload || !_is_streaming) {
+        return -ENOTCONN;
+    }
+
+    if (_backlog > 0) {
+        return -EBUSY;
+    }
+
+    _backlog = size;
+    pumpTraffic();
+    return 0;
+}
+
+int ZephyrBluetoothPlatform::exchangeMtu()
+{
+    // Fewer, longer LL packets carry the same data with less overhead. The traffic does not depend on it, since the
+    // controller fragments PDUs if the data length stays at its default.
+    const bt_conn_le_data_len_param data_len_params[] {
+        { .tx_max_len = BT_GAP_DATA_LEN_MAX, .tx_max_time = BT_GAP_DATA_TIME_MAX }
+    };
+    CALL_NORET(bt_conn_le_data_len_update, _conn, data_len_params);
+
+    // Continues in handleMtuExchanged().
+    _mtu_params.func = &mtuExchangedCallback;
+    CALL(bt_gatt_exchange_mtu, _conn, &_mtu_params);
+    return 0;
+}
+
+bool ZephyrBluetoothPlatform::getTrafficStats(TrafficStats &stats)
+{
+    stats.bytes = static_cast<uint32_t>(atomic_get(&_traffic_bytes));
+    stats.packets = static_cast<uint32_t>(atomic_get(&_traffic_packets));
+    stats.durationMs = 0;
+    if (_has_traffic && !_is_workload && stats.packets > 0) {
+        stats.durationMs = static_cast<uint32_t>(atomic_get(&_traffic_last_ms)) - _traffic_start_ms;
+    }
+
+    return _has_traffic || stats.packets > 0;
+}
+
+void ZephyrBluetoothPlatform::pumpTraffic()
+{
+    // _conn is cleared by disconnect() and upon disconnection, which end the traffic.
+    if (!_is_streaming || _conn == nullptr) {
+        _is_streaming = false;
+        return;
+    }
+
+    // Only one indication may await confirmation at a time.
+    atomic_val_t window = _is_workload && _traffic == traffic_t::indication ? 1 : CONFIG_THROUGHPUT_WINDOW;
+    while (_backlog > 0 && atomic_get(&_in_flight) < window) {
+        uint16_t length = MIN(MIN(bt_gatt_get_mtu(_conn) - 3U, sizeof(throughput_data)), _backlog);
+        atomic_inc(&_in_flight);
+        auto error = sendPdu(length);
+        if (error == 0) {
+            _backlog -= length;
+            continue;
+        }
+
+        atomic_dec(&_in_flight);
+        if (error != -ENOMEM && error != -ENOBUFS) {
+            printError(error, "GATT send");
+            _is_streaming = false;
+        } else if (atomic_get(&_in_flight) == 0) {
+            // Out of buffers with no completion to come: poll.
+            _event_queue.call_in(1, &handlePduSent, nullptr);
+        }
+
+        break;
+    }
+}
+
+int ZephyrBluetoothPlatform::sendPdu(uint16_t length)
+{
+    // The completion callbacks count the PDU, passed its length.
+    auto length_arg = reinterpret_cast<void *>(static_cast<uintptr_t>(length));
+    if (!_is_workload || _traffic == traffic_t::write) {
+        return bt_gatt_write_without_response_cb(
+            _conn,
+            _peer_value_handle,
+            throughput_data,
+            length,
+            false,
+            &pduSentCallback,
+            length_arg
+        );
+    }
+
+    if (_traffic == traffic_t::notification) {
+        bt_gatt_notify_params params;
+        memset(&params, 0, sizeof(params));
+        params.attr = _workload_attr;
+        params.data = throughput_data;
+        params.len = length;
+        params.func = &pduSentCallback;
+        params.user_data = length_arg;
+        return bt_gatt_notify_cb(_conn, &params);
+    }
+
+    // Must stay valid until the confirmation, so a member.
+    memset(&_indicate_params, 0, sizeof(_indicate_params));
+    _indicate_params.attr = _workload_attr;
+    _indicate_params.data = throughput_data;
+    _indicate_params.len = length;
+    _indicate_params.func = &indicatedCallback;
+    return bt_gatt_indicate(_conn, &_indicate_params);
+}
+
+void ZephyrBluetoothPlatform::startedThroughput(intmax_t error, connection_role_t role, uint32_t start_ms)
+{
+    _has_traffic = error == 0;
+    _traffic_start_ms = start_ms;
+    getEventHandler()->onThroughputStart(
+        ThroughputStartEvent(error, role, _conn == nullptr ? 0 : bt_gatt_get_mtu(_conn))
+    );
+}
+
+void ZephyrBluetoothPlatform::workloadReady(intmax_t error, connection_role_t role)
+{
+    _has_traffic = error == 0;
+    getEventHandler()->onWorkloadReady(
+        WorkloadReadyEvent(error, role, _traffic, _conn == nullptr ? 0 : bt_gatt_get_mtu(_conn))
+    );
+}
+
+void ZephyrBluetoothPlatform::gattSetupFailed(intmax_t error)
+{
+    if (_is_workload) {
+        workloadReady(error, connection_role_t::main);
+    } else {
+        startedThroughput(error, connection_role_t::main, 0);
+    }
+}
+
+BluetoothPlatform::phy_t ZephyrBluetoothPlatform::toPhy(uint8_t zephyr_phy)
+{
+    switch (zephyr_phy) {
+        case BT_GAP_LE_PHY_2M:    return phy_t::le_2m;
+        case BT_GAP_LE_PHY_CODED: return phy_t::le_coded;
+        default:                  return phy_t::le_1m;
+    }
+}
+
 #if CONFIG_USE_PER_ADV_SYNC
 int ZephyrBluetoothPlatform::startPeriodicAdvertising_Error(int error, const char* func)
 {
@@ -276,26 +718,28 @@ int ZephyrBluetoothPlatform::startPeriodicAdvertising_Error(int error, const cha
 
 int ZephyrBluetoothPlatform::startPeriodicAdvertising()
 {
-    assert(!_is_connecting_or_syncing);
+    assert(!isConnectingOrSyncing());
     assert(!_is_scanning_or_advertising);
     _is_scanner = false;
     _is_periodic = true;
 
-    static const bt_le_adv_param adv_params[] = {
+    const bt_le_adv_param adv_params[] = {
         BT_LE_ADV_PARAM_INIT(
             BT_LE_ADV_OPT_EXT_ADV | BT_LE_ADV_OPT_USE_NAME,
-            BT_GAP_ADV_FAST_INT_MIN_2,
-            BT_GAP_ADV_FAST_INT_MAX_2,
+            advInterval(params().adv_interval),
+            advInterval(params().adv_interval + params().adv_interval_span),
             nullptr
         )
     };
-	static const bt_le_per_adv_param per_adv_params[] {
-		BT_LE_PER_ADV_PARAM_INIT(
-            BT_GAP_ADV_SLOW_INT_MIN,
-            BT_GAP_ADV_SLOW_INT_MAX,
+    // Allow the controller the same range around the requested interval as the mbed backend, in 1.25 ms units.
+    auto interval = params().periodic_interval * 4 / 5;
+    bt_le_per_adv_param per_adv_params[] {
+        BT_LE_PER_ADV_PARAM_INIT(
+            static_cast<uint16_t>(MIN(MAX(interval / 2, 0x0006), 0xFFFF)),
+            static_cast<uint16_t>(MIN(MAX(interval * 2, 0x0006), 0xFFFF)),
             BT_LE_PER_ADV_OPT_NONE
         )
-	};
+    };
     static bt_le_ext_adv_start_param adv_start_params[] = {
         BT_LE_EXT_ADV_START_PARAM_INIT(0, 0)
     };
@@ -322,14 +766,19 @@ int ZephyrBluetoothPlatform::startPeriodicAdvertising()
     }
 
     _is_scanning_or_advertising = true;
-    _is_connecting_or_syncing = false;
-    _event_queue.call_in(CONFIG_ADVERTISE_TIME, &ZephyrBluetoothPlatform::endAdvertisingCallback, this);
+    atomic_set(&_link_state, LINK_NONE);
+    _end_timer = _event_queue.call_in(
+        params().advertise_time,
+        CONFIG_TIMER_SLACK,
+        &ZephyrBluetoothPlatform::endAdvertisingCallback,
+        this
+    );
 
     getEventHandler()->onAdvertisingStart(
         AdvertisingStartEvent(
-            CONFIG_ADVERTISE_TIME,
+            params().advertise_time,
             true,
-            CONFIG_APP_PERIODIC_INTERVAL
+            params().periodic_interval
         )
     );
     return 0;
@@ -349,35 +798,32 @@ int ZephyrBluetoothPlatform::syncToPeriodicAdvertising(
     uint32_t syncTimeoutMs
 )
 {
-    // Hold sync lock to prevent scanCallback from running again until we have tried to sync.
-    int error;
-    CALL(k_mutex_lock, &_scan_sync_mutex, K_FOREVER);
-    {
-        static bt_le_per_adv_sync_param sync_params;
-        memset(&sync_params, 0, sizeof(sync_params));
-        sync_params.sid = sid;
-        sync_params.timeout = MIN(MAX(0xA, syncTimeoutMs/10), 0x4000);
-        sync_params.addr.type = peerAddressType;
-        memcpy(sync_params.addr.a.val, peerAddress, sizeof(sync_params.addr.a.val));
-        error = bt_le_per_adv_sync_create(&sync_params, &_sync);
-        if (error) {
-            printError(error, "bt_le_per_adv_sync_create");
-            _is_connecting_or_syncing = false;
-        } else {
-            _is_connecting_or_syncing = true;
-        }
+    // Stop scanCallback from raising reports while we try to sync, and from starting a second attempt.
+    if (!beginLink(LINK_SYNC)) {
+        return -EALREADY;
+    }
+
+    static bt_le_per_adv_sync_param sync_params;
+    memset(&sync_params, 0, sizeof(sync_params));
+    sync_params.sid = sid;
+    sync_params.timeout = MIN(MAX(0xA, syncTimeoutMs/10), 0x4000);
+    sync_params.addr.type = peerAddressType;
+    memcpy(sync_params.addr.a.val, peerAddress, sizeof(sync_params.addr.a.val));
+    auto error = bt_le_per_adv_sync_create(&sync_params, &_sync);
+    if (error) {
+        printError(error, "bt_le_per_adv_sync_create");
+        atomic_set(&_link_state, LINK_NONE);
     }
 
-    k_mutex_unlock(&_scan_sync_mutex);
     return error;
 }
 
 int ZephyrBluetoothPlatform::stopSync(handle_t sync_handle)
 {
-    assert(_is_connecting_or_syncing);
+    assert(isConnectingOrSyncing());
     CALL(bt_le_per_adv_sync_delete, _sync);
     _sync = nullptr;
-    _is_connecting_or_syncing = false;
+    atomic_set(&_link_state, LINK_NONE);
     return 0;
 }
 
@@ -399,8 +845,10 @@ void ZephyrBluetoothPlatform::endAdvertising()
         return;
     }
 
-    // Update flags and stop advertising.
+    // Update flags, cancel the timeout if ending early and stop advertising.
     _is_scanning_or_advertising = false;
+    _event_queue.cancel(_end_timer);
+    _end_timer = 0;
 #if CONFIG_USE_PER_ADV_SYNC
     if (_is_periodic) {
         cleanUpExtendedAdvertising();
@@ -413,7 +861,7 @@ void ZephyrBluetoothPlatform::endAdvertising()
 #endif
 
     // Trigger timeout, unless we are already connecting.
-    if (!_is_connecting_or_syncing) {
+    if (!isConnectingOrSyncing()) {
         getEventHandler()->onAdvertisingTimeout();
     }
 }
@@ -424,12 +872,14 @@ void ZephyrBluetoothPlatform::endScan()
         return;
     }
 
-    // Update flags & stop the scan.
+    // Update flags, cancel the timeout if ending early & stop the scan.
     _is_scanning_or_advertising = false;
+    _event_queue.cancel(_end_timer);
+    _end_timer = 0;
     CALLFN_NORET(bt_le_scan_stop);
 
     // Trigger timeout unless we are already connecting.
-    if (!_is_connecting_or_syncing) {
+    if (!isConnectingOrSyncing()) {
         getEventHandler()->onScanTimeout();
     }
 }
@@ -446,59 +896,314 @@ void ZephyrBluetoothPlatform::endScanCallback(void *ignored)
     _instance.endScan();
 }
 
-#define DEV_NAME_MAX 50
+// Bluetooth callbacks run on the Bluetooth RX thread. They only update the flag which gates further reports and copy
+// what they need into a post to the event queue; the handle* functions then run on the main thread.
+
+// Legacy advertising data. Longer extended advertising data is truncated, which findLocalName() tolerates.
+#define ADV_DATA_MAX 31
+
+struct ZephyrBluetoothPlatform::ScanReport {
+    bt_addr_le_t addr;
+    uint8_t sid;
+    uint16_t interval;
+    uint8_t data_len;
+    uint8_t data[ADV_DATA_MAX];
+};
+
+struct ZephyrBluetoothPlatform::ConnectionChange {
+    bt_conn *conn;
+    uint8_t status;
+};
 
-static bool nameCallback(bt_data *data, void *user_data)
+struct ZephyrBluetoothPlatform::ParamUpdate {
+    bt_conn *conn;
+    uint16_t interval;
+    uint16_t latency;
+    uint16_t timeout;
+};
+
+struct ZephyrBluetoothPlatform::PhyUpdate {
+    bt_conn *conn;
+    uint8_t tx_phy;
+    uint8_t rx_phy;
+};
+
+struct ZephyrBluetoothPlatform::SyncChange {
+    bt_le_per_adv_sync *sync;
+    bt_addr_le_t addr;
+    uint8_t sid;
+};
+
+struct ZephyrBluetoothPlatform::GattResult {
+    bt_conn *conn;
+    uint8_t err;
+    uint16_t handle;
+};
+
+struct ZephyrBluetoothPlatform::ThroughputStart {
+    bt_conn *conn;
+    uint32_t start_ms;
+};
+
+struct ZephyrBluetoothPlatform::Subscription {
+    uint16_t value;
+};
+
+static_assert(sizeof(ZephyrBluetoothPlatform::ScanReport) <= EventQueue::POST_PAYLOAD_SIZE, "ScanReport too large");
+
+// Leave room in the event queue for connection and sync events when reports arrive faster than they are handled.
+static constexpr atomic_val_t MAX_PENDING_REPORTS = EventQueue::POST_DEPTH / 2;
+
+void ZephyrBluetoothPlatform::scanCallback(const bt_le_scan_recv_info *info, net_buf_simple *buf)
 {
-	if (data->type == BT_DATA_NAME_SHORTENED || data->type == BT_DATA_NAME_COMPLETE) {
-	    auto name = reinterpret_cast<char *>(user_data);
-        auto len = MIN(data->data_len, DEV_NAME_MAX - 1);
-        memcpy(name, data->data, len);
-        name[len] = '\0';
-        return false;
+    // Don't call the event handler if we are already connecting or syncing.
+    if (_instance.isConnectingOrSyncing()) {
+        return;
     }
 
-    return true;
+    if (atomic_inc(&_instance._pending_reports) >= MAX_PENDING_REPORTS) {
+        // Reports repeat, so dropping one is harmless.
+        atomic_dec(&_instance._pending_reports);
+        return;
+    }
+
+    // The data is copied as it is and only parsed by the event handler if it needs the name.
+    ScanReport report;
+    report.addr = *info->addr;
+    report.sid = info->sid;
+    report.interval = info->interval;
+    report.data_len = MIN(buf->len, ADV_DATA_MAX);
+    memcpy(report.data, buf->data, report.data_len);
+    if (!_instance._event_queue.post(&handleScanReport, &report, sizeof(report))) {
+        atomic_dec(&_instance._pending_reports);
+    }
 }
 
-void ZephyrBluetoothPlatform::scanCallback(const bt_le_scan_recv_info *info, net_buf_simple *buf)
+void ZephyrBluetoothPlatform::connectedCallback(bt_conn *conn, uint8_t err)
 {
-    {
-        // Don't call the event handler if we are already connecting or syncing.
-        auto error = k_mutex_lock(&_instance._scan_sync_mutex, K_FOREVER);
-        if (error) {
-            _instance.printError(error, "k_mutex_lock");
-            return;
+    // Stop reports from being raised while the connection is handled. The reference is released by the handler.
+    atomic_set(&_instance._link_state, LINK_CONNECTION);
+
+    // Reset the throughput counts here rather than in the handler, as the peer's writes may come before it runs.
+    atomic_set(&_instance._traffic_bytes, 0);
+    atomic_set(&_instance._traffic_packets, 0);
+    atomic_set(&_instance._traffic_last_ms, 0);
+
+    ConnectionChange change = {bt_conn_ref(conn), err};
+    _instance.postOrPanic(&handleConnected, &change, sizeof(change));
+}
+
+void ZephyrBluetoothPlatform::disconnectedCallback(bt_conn *conn, uint8_t reason)
+{
+    ConnectionChange change = {bt_conn_ref(conn), reason};
+    _instance.postOrPanic(&handleDisconnected, &change, sizeof(change));
+}
+
+void ZephyrBluetoothPlatform::paramUpdatedCallback(bt_conn *conn, uint16_t interval, uint16_t latency, uint16_t timeout)
+{
+    // The connection is only compared with _conn, so no reference is taken.
+    ParamUpdate update = {conn, interval, latency, timeout};
+    _instance.postOrPanic(&handleParamUpdated, &update, sizeof(update));
+}
+
+void ZephyrBluetoothPlatform::phyUpdatedCallback(bt_conn *conn, bt_conn_le_phy_info *info)
+{
+    PhyUpdate update = {conn, info->tx_phy, info->rx_phy};
+    _instance.postOrPanic(&handlePhyUpdated, &update, sizeof(update));
+}
+
+void ZephyrBluetoothPlatform::syncedCallback(bt_le_per_adv_sync *sync, bt_le_per_adv_sync_synced_info *sync_info)
+{
+    atomic_set(&_instance._link_state, LINK_SYNC);
+    SyncChange change = {sync, *sync_info->addr, sync_info->sid};
+    _instance.postOrPanic(&handleSynced, &change, sizeof(change));
+}
+
+void ZephyrBluetoothPlatform::syncLostCallback(bt_le_per_adv_sync *sync, const bt_le_per_adv_sync_term_info *info)
+{
+    SyncChange change = {sync, *info->addr, info->sid};
+    _instance.postOrPanic(&handleSyncLost, &change, sizeof(change));
+}
+
+void ZephyrBluetoothPlatform::mtuExchangedCallback(bt_conn *conn, uint8_t err, bt_gatt_exchange_params *params)
+{
+    GattResult result = {conn, err, 0};
+    _instance.postOrPanic(&handleMtuExchanged, &result, sizeof(result));
+}
+
+uint8_t ZephyrBluetoothPlatform::discoverCallback(
+    bt_conn *conn,
+    const bt_gatt_attr *attr,
+    bt_gatt_discover_params *params
+)
+{
+    // attr is nullptr if discovery ended without a match.
+    GattResult result = {conn, 0, 0};
+    if (attr != nullptr) {
+        result.handle = reinterpret_cast<const bt_gatt_chrc *>(attr->user_data)->value_handle;
+    }
+
+    _instance.postOrPanic(&handleDiscovered, &result, sizeof(result));
+    return BT_GATT_ITER_STOP;
+}
+
+void ZephyrBluetoothPlatform::pduSentCallback(bt_conn *conn, void *user_data)
+{
+    // The PDU has been handed to the controller, or an indication confirmed. user_data is its length.
+    atomic_add(&_instance._traffic_bytes, static_cast<atomic_val_t>(reinterpret_cast<uintptr_t>(user_data)));
+    atomic_inc(&_instance._traffic_packets);
+    atomic_set(&_instance._traffic_last_ms, k_uptime_get_32());
+    atomic_dec(&_instance._in_flight);
+
+    // One call refills the whole window, so post it only if none is pending. If the ring is full, a later completion
+    // posts it instead.
+    if (atomic_cas(&_instance._pump_pending, 0, 1)) {
+        if (!_instance._event_queue.post(&handlePduSent, &conn, sizeof(conn))) {
+            atomic_set(&_instance._pump_pending, 0);
         }
+    }
+}
+
+void ZephyrBluetoothPlatform::indicatedCallback(bt_conn *conn, bt_gatt_indicate_params *params, uint8_t err)
+{
+    // Called when main confirms the indication, or upon error.
+    if (err == 0) {
+        pduSentCallback(conn, reinterpret_cast<void *>(static_cast<uintptr_t>(params->len)));
+    } else {
+        atomic_dec(&_instance._in_flight);
+    }
+}
+
+uint8_t ZephyrBluetoothPlatform::notifyCallback(
+    bt_conn *conn,
+    bt_gatt_subscribe_params *params,
+    const void *data,
+    uint16_t length
+)
+{
+    // data is nullptr when the subscription is removed, e.g. upon disconnection.
+    if (data == nullptr) {
+        params->value_handle = 0;
+        return BT_GATT_ITER_STOP;
+    }
 
-        auto ignore = _instance._is_connecting_or_syncing;
-        k_mutex_unlock(&_instance._scan_sync_mutex);
-        if (ignore) {
-            return;
+    atomic_add(&_instance._traffic_bytes, length);
+    atomic_inc(&_instance._traffic_packets);
+    atomic_set(&_instance._traffic_last_ms, k_uptime_get_32());
+    return BT_GATT_ITER_CONTINUE;
+}
+
+void ZephyrBluetoothPlatform::cccChangedCallback(const bt_gatt_attr *attr, uint16_t value)
+{
+    Subscription subscription = {value};
+    _instance.postOrPanic(&handleSubscribed, &subscription, sizeof(subscription));
+}
+
+ssize_t ZephyrBluetoothPlatform::throughputWriteCallback(
+    bt_conn *conn,
+    const bt_gatt_attr *attr,
+    const void *buf,
+    uint16_t len,
+    uint16_t offset,
+    uint8_t flags
+)
+{
+    auto now = k_uptime_get_32();
+    atomic_add(&_instance._traffic_bytes, len);
+    atomic_set(&_instance._traffic_last_ms, now);
+
+    // Only a throughput run starts with the first write; a workload is only counted.
+    auto is_first = atomic_inc(&_instance._traffic_packets) == 0;
+    if (is_first && attr->uuid == &throughput_characteristic_uuid.uuid) {
+        ThroughputStart start = {conn, now};
+        _instance.postOrPanic(&handleThroughputStart, &start, sizeof(start));
+    }
+
+    return len;
+}
+
+struct ZephyrBluetoothPlatform::Input {
+    uint8_t length;
+    char data[EventQueue::POST_PAYLOAD_SIZE - 1];
+};
+
+void ZephyrBluetoothPlatform::uartCallback(const device *dev, void *user_data)
+{
+    // Runs in the UART ISR. Read everything the FIFO holds and hand it to the main thread in as few posts as possible.
+    while (uart_irq_update(dev) && uart_irq_rx_ready(dev)) {
+        Input input;
+        auto length = uart_fifo_read(dev, reinterpret_cast<uint8_t *>(input.data), sizeof(input.data));
+        if (length <= 0) {
+            break;
         }
+
+        // Input which does not fit in the post ring is lost, as it would be with a full UART buffer.
+        input.length = static_cast<uint8_t>(length);
+        _instance._event_queue.post(&handleInput, &input, sizeof(input));
+    }
+}
+
+void ZephyrBluetoothPlatform::postOrPanic(EventQueue::callback_t fn, const void *payload, size_t size)
+{
+    // Losing a connection or sync event would leave the state machine stuck. This may run in an ISR, where spinning
+    // would hang the system silently, so halt through the fatal error handler.
+    if (!_event_queue.post(fn, payload, size)) {
+        printk("Event queue post ring full, Bluetooth event lost\n");
+        k_panic();
+    }
+}
+
+void ZephyrBluetoothPlatform::handleScanReport(void *arg)
+{
+    auto report = reinterpret_cast<const ScanReport *>(arg);
+    atomic_dec(&_instance._pending_reports);
+
+    // A connection or sync may have been started by a report handled after this one was posted.
+    if (_instance.isConnectingOrSyncing()) {
+        return;
     }
 
-    char local_name[DEV_NAME_MAX];
-    memset(local_name, 0, sizeof(local_name));
-    bt_data_parse(buf, &nameCallback, local_name);
     _instance.getEventHandler()->onAdvertisingReport(
         AdvertisingReportEvent(
-            info->sid,
-            info->addr->type,
-            info->addr->a.val,
-            sizeof(info->addr->a.val),
-            local_name,
-            info->interval > 0,
-            info->interval
+            report->sid,
+            report->addr.type,
+            report->addr.a.val,
+            sizeof(report->addr.a.val),
+            report->data,
+            report->data_len,
+            report->interval > 0,
+            report->interval
         )
     );
 }
 
-void ZephyrBluetoothPlatform::connectedCallback(bt_conn *conn, uint8_t err)
+void ZephyrBluetoothPlatform::handleConnected(void *arg)
 {
+    auto change = reinterpret_cast<const ConnectionChange *>(arg);
+    auto conn = change->conn;
+    auto err = change->status;
+
+    // The connection was not established, e.g. the peer stopped advertising. Drop the reference which
+    // bt_conn_le_create() stored in _conn, so that the test can scan or connect again straight away.
+    if (err) {
+        if (_instance._conn == conn) {
+            bt_conn_unref(_instance._conn);
+            _instance._conn = nullptr;
+        }
+
+        atomic_set(&_instance._link_state, LINK_NONE);
+        _instance.getEventHandler()->onConnection(ConnectEvent(static_cast<intmax_t>(err)));
+        bt_conn_unref(conn);
+        return;
+    }
+
     // Update flags and stop scan/adv.
-    _instance._is_connecting_or_syncing = true;
+    atomic_set(&_instance._link_state, LINK_CONNECTION);
     _instance._conn = conn;
+    _instance._is_streaming = false;
+    _instance._has_traffic = false;
+    _instance._is_workload = false;
+    _instance._backlog = 0;
     if (_instance._is_scanner) {
         _instance.endScan();
     } else {
@@ -527,23 +1232,175 @@ void ZephyrBluetoothPlatform::connectedCallback(bt_conn *conn, uint8_t err)
             info.role == BT_CONN_ROLE_MASTER
                        ? BluetoothPlatform::connection_role_t::main
                        : BluetoothPlatform::connection_role_t::peripheral,
-            _instance._conn
+            _instance._conn,
+            connectionParameters(info.le.interval, info.le.latency, info.le.timeout)
+        )
+    );
+
+    bt_conn_unref(conn);
+}
+
+void ZephyrBluetoothPlatform::handleParamUpdated(void *arg)
+{
+    auto update = reinterpret_cast<const ParamUpdate *>(arg);
+    if (update->conn != _instance._conn) {
+        return;
+    }
+
+    _instance.getEventHandler()->onConnectionParametersUpdate(
+        ConnectionParametersUpdateEvent(
+            0,
+            _instance._conn,
+            connectionParameters(update->interval, update->latency, update->timeout)
         )
     );
 }
 
-void ZephyrBluetoothPlatform::disconnectedCallback(bt_conn *conn, uint8_t reason)
+void ZephyrBluetoothPlatform::handleDisconnected(void *arg)
 {
-    assert(_instance._conn == conn);
-    _instance._conn = nullptr;
-    _instance._is_connecting_or_syncing = false;
+    auto change = reinterpret_cast<const ConnectionChange *>(arg);
+
+    // disconnect() has already released our reference if we initiated the disconnection.
+    if (_instance._conn == change->conn) {
+        _instance._conn = nullptr;
+    }
+
+    atomic_set(&_instance._link_state, LINK_NONE);
+    _instance._is_streaming = false;
     _instance.getEventHandler()->onDisconnect();
+    bt_conn_unref(change->conn);
 }
 
-void ZephyrBluetoothPlatform::syncedCallback(bt_le_per_adv_sync *sync, bt_le_per_adv_sync_synced_info *sync_info)
+void ZephyrBluetoothPlatform::handlePhyUpdated(void *arg)
+{
+    auto update = reinterpret_cast<const PhyUpdate *>(arg);
+    if (update->conn != _instance._conn) {
+        return;
+    }
+
+    _instance.getEventHandler()->onPhyUpdate(
+        PhyUpdateEvent(0, _instance._conn, toPhy(update->tx_phy), toPhy(update->rx_phy))
+    );
+}
+
+void ZephyrBluetoothPlatform::handleMtuExchanged(void *arg)
+{
+    auto result = reinterpret_cast<const GattResult *>(arg);
+    if (result->conn != _instance._conn) {
+        return;
+    }
+
+    if (result->err) {
+        _instance.gattSetupFailed(result->err);
+        return;
+    }
+
+    // Find the peer's characteristic. Continues in handleDiscovered().
+    auto &params = _instance._discover_params;
+    memset(&params, 0, sizeof(params));
+    params.uuid = _instance._is_workload ? &workload_characteristic_uuid.uuid : &throughput_characteristic_uuid.uuid;
+    params.func = &discoverCallback;
+    params.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+    params.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+    params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+    auto error = bt_gatt_discover(_instance._conn, &params);
+    if (error) {
+        _instance.printError(error, "bt_gatt_discover");
+        _instance.gattSetupFailed(error);
+    }
+}
+
+void ZephyrBluetoothPlatform::handleDiscovered(void *arg)
+{
+    auto result = reinterpret_cast<const GattResult *>(arg);
+    if (result->conn != _instance._conn) {
+        return;
+    }
+
+    if (result->handle == 0) {
+        _instance.gattSetupFailed(-ENOENT);
+        return;
+    }
+
+    _instance._peer_value_handle = result->handle;
+    atomic_set(&_instance._in_flight, 0);
+    atomic_set(&_instance._pump_pending, 0);
+    if (!_instance._is_workload) {
+        _instance._is_streaming = true;
+        _instance._backlog = UINT64_MAX;
+        _instance.startedThroughput(0, connection_role_t::main, k_uptime_get_32());
+        _instance.pumpTraffic();
+        return;
+    }
+
+    if (_instance._traffic == traffic_t::write) {
+        _instance._is_streaming = true;
+        _instance.workloadReady(0, connection_role_t::main);
+        return;
+    }
+
+    // The client configuration descriptor directly follows the value in our service.
+    auto &params = _instance._subscribe_params;
+    memset(&params, 0, sizeof(params));
+    params.notify = &notifyCallback;
+    params.value_handle = result->handle;
+    params.ccc_handle = result->handle + 1;
+    params.value = _instance._traffic == traffic_t::notification ? BT_GATT_CCC_NOTIFY : BT_GATT_CCC_INDICATE;
+    auto error = bt_gatt_subscribe(_instance._conn, &params);
+    if (error) {
+        _instance.printError(error, "bt_gatt_subscribe");
+    }
+
+    _instance.workloadReady(error, connection_role_t::main);
+}
+
+void ZephyrBluetoothPlatform::handlePduSent(void *arg)
 {
-    assert(_sync == nullptr);
-    _instance._is_connecting_or_syncing = true;
+    atomic_set(&_instance._pump_pending, 0);
+    _instance.pumpTraffic();
+}
+
+void ZephyrBluetoothPlatform::handleThroughputStart(void *arg)
+{
+    auto start = reinterpret_cast<const ThroughputStart *>(arg);
+    if (start->conn != _instance._conn) {
+        return;
+    }
+
+    _instance.startedThroughput(0, connection_role_t::peripheral, start->start_ms);
+}
+
+void ZephyrBluetoothPlatform::handleSubscribed(void *arg)
+{
+    auto subscription = reinterpret_cast<const Subscription *>(arg);
+    if (_instance._conn == nullptr) {
+        return;
+    }
+
+    // Main sets one of the bits; clearing both ends the workload.
+    if (subscription->value & BT_GATT_CCC_INDICATE) {
+        _instance._traffic = traffic_t::indication;
+    } else if (subscription->value & BT_GATT_CCC_NOTIFY) {
+        _instance._traffic = traffic_t::notification;
+    } else {
+        _instance._is_streaming = false;
+        return;
+    }
+
+    _instance._is_workload = true;
+    _instance._is_streaming = true;
+    _instance._backlog = 0;
+    atomic_set(&_instance._in_flight, 0);
+    atomic_set(&_instance._pump_pending, 0);
+    _instance.workloadReady(0, connection_role_t::peripheral);
+}
+
+void ZephyrBluetoothPlatform::handleSynced(void *arg)
+{
+    auto change = reinterpret_cast<const SyncChange *>(arg);
+    // bt_le_per_adv_sync_create() has already stored the handle when we requested the sync.
+    assert(_instance._sync == nullptr || _instance._sync == change->sync);
+    atomic_set(&_instance._link_state, LINK_SYNC);
     if (_instance._is_scanner) {
         _instance.endScan();
     } else {
@@ -552,14 +1409,13 @@ void ZephyrBluetoothPlatform::syncedCallback(bt_le_per_adv_sync *sync, bt_le_per
 
     int error = 0;
 
-    _instance._sync = sync;
-    auto addr = bt_conn_get_dst(sync_info->conn);
+    _instance._sync = change->sync;
     _instance.getEventHandler()->onPeriodicSync(
         PeriodicSyncEvent(
-            sync_info->sid,
-            addr->type,
-            &(addr->a.val[0]),
-            sizeof(addr->a.val),
+            change->sid,
+            change->addr.type,
+            &(change->addr.a.val[0]),
+            sizeof(change->addr.a.val),
             static_cast<intmax_t>(error),
             _instance._is_scanner ? BluetoothPlatform::connection_role_t::main
                                   : BluetoothPlatform::connection_role_t::peripheral,
@@ -568,8 +1424,16 @@ void ZephyrBluetoothPlatform::syncedCallback(bt_le_per_adv_sync *sync, bt_le_per
     );
 }
 
-void ZephyrBluetoothPlatform::syncLostCallback(bt_le_per_adv_sync *sync, const bt_le_per_adv_sync_term_info *info)
+void ZephyrBluetoothPlatform::handleSyncLost(void *arg)
 {
-    _instance._is_connecting_or_syncing = false;
+    atomic_set(&_instance._link_state, LINK_NONE);
     _instance.getEventHandler()->onSyncLoss();
 }
+
+void ZephyrBluetoothPlatform::handleInput(void *arg)
+{
+    auto input = reinterpret_cast<const Input *>(arg);
+    for (size_t i = 0; i < input->length; i++) {
+        _instance.getEventHandler()->onInput(input->data[i]);
+    }
+}